@@ -24,6 +24,7 @@
 #include "mate-wp-info.h"
 #include "mate-wp-item.h"
 #include "mate-wp-xml.h"
+#include "capplet-util.h"
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 #include <string.h>
@@ -47,6 +48,10 @@ static const GtkTargetEntry drag_types[] = {
 
 static void wp_update_preview(GtkFileChooser* chooser, AppearanceData* data);
 
+/* The thumbnail column, sized up front so rows without a thumbnail yet
+ * don't jump around */
+static GtkCellRenderer *thumbnail_renderer = NULL;
+
 static void select_item(AppearanceData* data, MateWPItem* item, gboolean scroll)
 {
 	GtkTreePath* path;
@@ -101,36 +106,53 @@ static gboolean predicate (gpointer key, gpointer value, gpointer data)
   return item->bg == bg;
 }
 
-static void on_item_changed (MateBG *bg, AppearanceData *data) {
-  GtkTreeModel *model;
-  GtkTreeIter iter;
+static void
+wp_thumbnail_ready (MateWPItem *item,
+                    GdkPixbuf *pixbuf,
+                    AppearanceData *data)
+{
   GtkTreePath *path;
-  MateWPItem *item;
+  GtkTreeIter iter;
 
-  item = g_hash_table_find (data->wp_hash, predicate, bg);
+  /* removed from the list since */
+  if (item->deleted || !gtk_tree_row_reference_valid (item->rowref))
+    return;
 
-  if (!item)
+  mate_wp_item_update_description (item);
+
+  if (pixbuf == NULL)
     return;
 
-  model = gtk_tree_row_reference_get_model (item->rowref);
   path = gtk_tree_row_reference_get_path (item->rowref);
 
-  if (gtk_tree_model_get_iter (model, &iter, path)) {
-    GdkPixbuf *pixbuf;
+  if (gtk_tree_model_get_iter (data->wp_model, &iter, path))
+    gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter, 0, pixbuf, -1);
+
+  gtk_tree_path_free (path);
+}
 
-    g_signal_handlers_block_by_func (bg, G_CALLBACK (on_item_changed), data);
+/* The row keeps its current thumbnail until the new one is rendered */
+static void
+wp_request_thumbnail (AppearanceData *data,
+                      MateWPItem *item)
+{
+  item->thumbnail_requested = TRUE;
+  mate_wp_item_get_thumbnail_async (item, data->thumb_factory,
+                                    data->thumb_width,
+                                    data->thumb_height,
+                                    (MateWPItemThumbnailFunc) wp_thumbnail_ready,
+                                    data);
+}
 
-    pixbuf = mate_wp_item_get_thumbnail (item,
-                                          data->thumb_factory,
-                                          data->thumb_width,
-                                          data->thumb_height);
-    if (pixbuf) {
-      gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter, 0, pixbuf, -1);
-      g_object_unref (pixbuf);
-    }
+static void on_item_changed (MateBG *bg, AppearanceData *data) {
+  MateWPItem *item;
 
-    g_signal_handlers_unblock_by_func (bg, G_CALLBACK (on_item_changed), data);
-  }
+  item = g_hash_table_find (data->wp_hash, predicate, bg);
+
+  if (!item || !gtk_tree_row_reference_valid (item->rowref))
+    return;
+
+  wp_request_thumbnail (data, item);
 }
 
 static void
@@ -140,25 +162,18 @@ wp_props_load_wallpaper (gchar *key,
 {
   GtkTreeIter iter;
   GtkTreePath *path;
-  GdkPixbuf *pixbuf;
 
   if (item->deleted == TRUE)
     return;
 
-  gtk_list_store_append (GTK_LIST_STORE (data->wp_model), &iter);
-
-  pixbuf = mate_wp_item_get_thumbnail (item, data->thumb_factory,
-                                        data->thumb_width,
-                                        data->thumb_height);
-  mate_wp_item_update_description (item);
+  /* the thumbnail is rendered once the row is shown, see
+   * wp_thumbnail_cell_data_func() */
+  item->thumbnail_requested = FALSE;
 
-  gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter,
-                      0, pixbuf,
-                      1, item,
-                      -1);
-
-  if (pixbuf != NULL)
-    g_object_unref (pixbuf);
+  gtk_list_store_insert_with_values (GTK_LIST_STORE (data->wp_model), &iter, -1,
+                                     0, NULL,
+                                     1, item,
+                                     -1);
 
   path = gtk_tree_model_get_path (data->wp_model, &iter);
   item->rowref = gtk_tree_row_reference_new (data->wp_model, path);
@@ -302,22 +317,15 @@ wp_scale_type_changed (GtkComboBox *combobox,
                        AppearanceData *data)
 {
   MateWPItem *item;
-  GtkTreeIter iter;
-  GdkPixbuf *pixbuf;
 
-  item = get_selected_item (data, &iter);
+  item = get_selected_item (data, NULL);
 
   if (item == NULL)
     return;
 
   item->options = gtk_combo_box_get_active (GTK_COMBO_BOX (data->wp_style_menu));
 
-  pixbuf = mate_wp_item_get_thumbnail (item, data->thumb_factory,
-                                        data->thumb_width,
-                                        data->thumb_height);
-  gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter, 0, pixbuf, -1);
-  if (pixbuf != NULL)
-    g_object_unref (pixbuf);
+  wp_request_thumbnail (data, item);
 
   if (g_settings_is_writable (data->wp_settings, WP_OPTIONS_KEY))
   {
@@ -332,22 +340,15 @@ wp_shade_type_changed (GtkWidget *combobox,
                        AppearanceData *data)
 {
   MateWPItem *item;
-  GtkTreeIter iter;
-  GdkPixbuf *pixbuf;
 
-  item = get_selected_item (data, &iter);
+  item = get_selected_item (data, NULL);
 
   if (item == NULL)
     return;
 
   item->shade_type = gtk_combo_box_get_active (GTK_COMBO_BOX (data->wp_color_menu));
 
-  pixbuf = mate_wp_item_get_thumbnail (item, data->thumb_factory,
-                                        data->thumb_width,
-                                        data->thumb_height);
-  gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter, 0, pixbuf, -1);
-  if (pixbuf != NULL)
-    g_object_unref (pixbuf);
+  wp_request_thumbnail (data, item);
 
   if (g_settings_is_writable (data->wp_settings, WP_SHADING_KEY))
   {
@@ -803,7 +804,12 @@ wp_list_sort (GtkTreeModel *model,
   }
   else
   {
-    retval = g_utf8_collate (itema->description, itemb->description);
+    /* not the description: it only gets the image size once the
+     * thumbnail is rendered, which would reorder the list */
+    retval = g_utf8_collate (itema->name, itemb->name);
+
+    if (retval == 0)
+      retval = strcmp (itema->filename, itemb->filename);
   }
 
   return retval;
@@ -860,6 +866,57 @@ wp_update_preview (GtkFileChooser *chooser,
   gtk_file_chooser_set_preview_widget_active (chooser, TRUE);
 }
 
+static gboolean
+path_is_visible (GtkIconView *view, GtkTreePath *path)
+{
+  GtkTreePath *start, *end;
+  gboolean visible = FALSE;
+
+  if (gtk_icon_view_get_visible_range (view, &start, &end)) {
+    visible = gtk_tree_path_compare (path, start) >= 0 &&
+              gtk_tree_path_compare (path, end) <= 0;
+
+    gtk_tree_path_free (start);
+    gtk_tree_path_free (end);
+  }
+
+  return visible;
+}
+
+/* Only the rows actually on screen get their thumbnail rendered; the icon
+ * view asks for the others too, but just to lay them out. */
+static void
+wp_thumbnail_cell_data_func (GtkCellLayout   *layout,
+                             GtkCellRenderer *cell,
+                             GtkTreeModel    *model,
+                             GtkTreeIter     *iter,
+                             gpointer         user_data)
+{
+  AppearanceData *data = user_data;
+  MateWPItem *item;
+  GdkPixbuf *pixbuf;
+  GtkTreePath *path;
+
+  gtk_tree_model_get (model, iter, 0, &pixbuf, 1, &item, -1);
+
+  g_object_set (cell, "pixbuf", pixbuf, NULL);
+
+  if (pixbuf != NULL) {
+    g_object_unref (pixbuf);
+    return;
+  }
+
+  if (item->thumbnail_requested)
+    return;
+
+  path = gtk_tree_model_get_path (model, iter);
+
+  if (path_is_visible (data->wp_view, path))
+    wp_request_thumbnail (data, item);
+
+  gtk_tree_path_free (path);
+}
+
 static gboolean
 reload_item (GtkTreeModel *model,
              GtkTreePath *path,
@@ -867,18 +924,13 @@ reload_item (GtkTreeModel *model,
              AppearanceData *data)
 {
   MateWPItem *item;
-  GdkPixbuf *pixbuf;
 
   gtk_tree_model_get (model, iter, 1, &item, -1);
 
-  pixbuf = mate_wp_item_get_thumbnail (item,
-                                        data->thumb_factory,
-                                        data->thumb_width,
-                                        data->thumb_height);
-  if (pixbuf) {
-    gtk_list_store_set (GTK_LIST_STORE (data->wp_model), iter, 0, pixbuf, -1);
-    g_object_unref (pixbuf);
-  }
+  /* rendered again at the new size as soon as it is shown */
+  mate_wp_item_cancel_thumbnail (item);
+  item->thumbnail_requested = FALSE;
+  gtk_list_store_set (GTK_LIST_STORE (data->wp_model), iter, 0, NULL, -1);
 
   return FALSE;
 }
@@ -913,6 +965,16 @@ compute_thumbnail_sizes (AppearanceData *data)
     data->thumb_width = LIST_IMAGE_SIZE;
     data->thumb_height = LIST_IMAGE_SIZE * aspect;
   }
+
+  if (thumbnail_renderer != NULL) {
+    gint xpad, ypad;
+
+    /* room for the frame around slide shows too */
+    gtk_cell_renderer_get_padding (thumbnail_renderer, &xpad, &ypad);
+    gtk_cell_renderer_set_fixed_size (thumbnail_renderer,
+                                      data->thumb_width + 6 + 2 * xpad,
+                                      data->thumb_height + 6 + 2 * ypad);
+  }
 }
 
 static void
@@ -922,20 +984,27 @@ reload_wallpapers (AppearanceData *data)
   gtk_tree_model_foreach (data->wp_model, (GtkTreeModelForeachFunc)reload_item, data);
 }
 
-static gboolean
-wp_load_stuffs (void *user_data)
+static void
+wp_load_wallpapers (GSList *items,
+                    AppearanceData *data)
 {
-  AppearanceData *data;
-  gchar *imagepath, *uri, *style;
-  MateWPItem *item;
+  GSList *l;
 
-  data = (AppearanceData *) user_data;
+  for (l = items; l != NULL; l = l->next) {
+    MateWPItem *item = l->data;
 
-  compute_thumbnail_sizes (data);
+    wp_props_load_wallpaper (item->filename, item, data);
+  }
+}
 
-  mate_wp_xml_load_list (data);
-  g_hash_table_foreach (data->wp_hash, (GHFunc) wp_props_load_wallpaper,
-                        data);
+/* Selects the current wallpaper once the whole list is in */
+static void
+wp_load_finished (AppearanceData *data)
+{
+  gchar *imagepath, *uri, *style;
+  MateWPItem *item;
+
+  capplet_trace_mark ("wp_load_stuffs: wallpapers loaded");
 
   style = g_settings_get_string (data->wp_settings,
                                    WP_OPTIONS_KEY);
@@ -1016,6 +1085,23 @@ wp_load_stuffs (void *user_data)
     wp_add_images (data, data->wp_uris);
     data->wp_uris = NULL;
   }
+}
+
+static gboolean
+wp_load_stuffs (void *user_data)
+{
+  AppearanceData *data;
+
+  data = (AppearanceData *) user_data;
+
+  capplet_trace_begin ("wp_load_stuffs");
+
+  compute_thumbnail_sizes (data);
+
+  /* the list fills in as the wallpapers are found */
+  mate_wp_xml_load_list_async (data, wp_load_wallpapers, wp_load_finished);
+
+  capplet_trace_end ("wp_load_stuffs");
 
   return FALSE;
 }
@@ -1101,6 +1187,8 @@ next_frame (AppearanceData  *data,
                                                 data->thumb_height,
                                                 frame);
   if (pixbuf) {
+    /* not to be overwritten by a thumbnail still being rendered */
+    mate_wp_item_cancel_thumbnail (item);
     gtk_list_store_set (GTK_LIST_STORE (data->wp_model), &iter, 0, pixbuf, -1);
     g_object_unref (pixbuf);
     data->frame = frame;
@@ -1269,11 +1357,11 @@ desktop_init (AppearanceData *data,
 
   cr = gtk_cell_renderer_pixbuf_new ();
   g_object_set (cr, "xpad", 5, "ypad", 5, NULL);
+  thumbnail_renderer = cr;
 
   gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (data->wp_view), cr, TRUE);
-  gtk_cell_layout_set_attributes (GTK_CELL_LAYOUT (data->wp_view), cr,
-                                  "pixbuf", 0,
-                                  NULL);
+  gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (data->wp_view), cr,
+                                      wp_thumbnail_cell_data_func, data, NULL);
 
   cr = gtk_cell_renderer_pixbuf_new ();
   create_button_images (data);
@@ -1366,6 +1454,8 @@ desktop_init (AppearanceData *data,
 void
 desktop_shutdown (AppearanceData *data)
 {
+  mate_wp_item_thumbnails_shutdown ();
+
   mate_wp_xml_save_list (data);
 
   if (data->screen_monitors_handler > 0) {
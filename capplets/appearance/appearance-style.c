@@ -33,18 +33,18 @@
 #define GSETTINGS_KEY      "GSETTINGS_KEY"
 #define THEME_DATA         "THEME_DATA"
 
-typedef void (* ThumbnailGenFunc) (void               *type,
-				   ThemeThumbnailFunc  theme,
-				   AppearanceData     *data,
-				   GDestroyNotify     *destroy);
-
 typedef struct {
   AppearanceData *data;
   GdkPixbuf *thumbnail;
+  /* theme name -> thumbnail request id, or 0 once the request is done */
+  GHashTable *requests;
 } ThemeConvData;
 
+/* names of cursor themes whose rows are shown without a thumbnail */
+static GSList *cursor_thumbnail_queue = NULL;
+static guint cursor_thumbnail_idle_id = 0;
+
 static void update_message_area (AppearanceData *data);
-static void create_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *data);
 
 static const gchar *symbolic_names[NUM_SYMBOLIC_COLORS] = {
   "fg_color", "bg_color",
@@ -118,8 +118,6 @@ treeview_gsettings_changed_callback (GSettings *settings, gchar *key, GtkTreeVie
     gtk_tree_model_sort_convert_child_iter_to_iter (GTK_TREE_MODEL_SORT (store),
                                                     &sort_iter, &iter);
     path = gtk_tree_model_get_string_from_iter (store, &sort_iter);
-
-    create_thumbnail (curr_value, conv->thumbnail, conv->data);
   }
   /* select the new gsettings theme in treeview */
   GtkTreeSelection *selection = gtk_tree_view_get_selection (list);
@@ -660,6 +658,18 @@ cursor_theme_delete_cb (GtkWidget *button, AppearanceData *data)
   generic_theme_delete ("cursor_themes_list", THEME_TYPE_CURSOR, data);
 }
 
+static void
+forget_thumbnail_request (ThemeConvData *conv,
+                          const gchar *theme_name)
+{
+  guint request_id = GPOINTER_TO_UINT (g_hash_table_lookup (conv->requests, theme_name));
+
+  if (request_id != 0)
+    theme_thumbnail_cancel (request_id);
+
+  g_hash_table_remove (conv->requests, theme_name);
+}
+
 static void
 add_to_treeview (const gchar *tv_name,
 		 const gchar *theme_name,
@@ -698,6 +708,8 @@ remove_from_treeview (const gchar *tv_name,
 
   if (theme_find_in_model (GTK_TREE_MODEL (model), theme_name, &iter))
     gtk_list_store_remove (model, &iter);
+
+  forget_thumbnail_request (g_object_get_data (G_OBJECT (treeview), THEME_DATA), theme_name);
 }
 
 static void
@@ -732,11 +744,17 @@ update_thumbnail_in_treeview (const gchar *tv_name,
   GtkTreeView *treeview;
   GtkListStore *model;
   GtkTreeIter iter;
+  ThemeConvData *conv;
+
+  treeview = GTK_TREE_VIEW (appearance_capplet_get_widget (data, tv_name));
+
+  /* a theme without a thumbnail isn't tried again */
+  conv = g_object_get_data (G_OBJECT (treeview), THEME_DATA);
+  g_hash_table_replace (conv->requests, g_strdup (theme_name), GUINT_TO_POINTER (0));
 
   if (theme_thumbnail == NULL)
     return;
 
-  treeview = GTK_TREE_VIEW (appearance_capplet_get_widget (data, tv_name));
   model = GTK_LIST_STORE (
           gtk_tree_model_sort_get_model (
           GTK_TREE_MODEL_SORT (gtk_tree_view_get_model (treeview))));
@@ -748,6 +766,33 @@ update_thumbnail_in_treeview (const gchar *tv_name,
   }
 }
 
+/* Shows the placeholder again, so that the row gets a new thumbnail once
+ * it is drawn */
+static void
+reset_thumbnail_in_treeview (const gchar *tv_name,
+                             const gchar *theme_name,
+                             AppearanceData *data)
+{
+  GtkTreeView *treeview;
+  GtkListStore *model;
+  GtkTreeIter iter;
+  ThemeConvData *conv;
+
+  treeview = GTK_TREE_VIEW (appearance_capplet_get_widget (data, tv_name));
+  model = GTK_LIST_STORE (
+          gtk_tree_model_sort_get_model (
+          GTK_TREE_MODEL_SORT (gtk_tree_view_get_model (treeview))));
+  conv = g_object_get_data (G_OBJECT (treeview), THEME_DATA);
+
+  forget_thumbnail_request (conv, theme_name);
+
+  if (theme_find_in_model (GTK_TREE_MODEL (model), theme_name, &iter)) {
+    gtk_list_store_set (model, &iter,
+          COL_THUMBNAIL, conv->thumbnail,
+          -1);
+  }
+}
+
 static void
 gtk_theme_thumbnail_cb (GdkPixbuf *pixbuf,
                         gchar *theme_name,
@@ -772,31 +817,33 @@ icon_theme_thumbnail_cb (GdkPixbuf *pixbuf,
   update_thumbnail_in_treeview ("icon_themes_list", theme_name, pixbuf, data);
 }
 
-static void
+static guint
 create_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *data)
 {
   if (default_thumb == data->icon_theme_icon) {
     MateThemeIconInfo *info;
     info = mate_theme_icon_info_find (name);
     if (info != NULL) {
-      generate_icon_theme_thumbnail_async (info,
+      return generate_icon_theme_thumbnail_async (info, G_PRIORITY_DEFAULT,
           (ThemeThumbnailFunc) icon_theme_thumbnail_cb, data, NULL);
     }
   } else if (default_thumb == data->gtk_theme_icon) {
     MateThemeInfo *info;
     info = mate_theme_info_find (name);
     if (info != NULL && info->has_gtk) {
-      generate_gtk_theme_thumbnail_async (info,
+      return generate_gtk_theme_thumbnail_async (info, G_PRIORITY_DEFAULT,
           (ThemeThumbnailFunc) gtk_theme_thumbnail_cb, data, NULL);
     }
   } else if (default_thumb == data->window_theme_icon) {
     MateThemeInfo *info;
     info = mate_theme_info_find (name);
     if (info != NULL && info->has_marco) {
-      generate_marco_theme_thumbnail_async (info,
+      return generate_marco_theme_thumbnail_async (info, G_PRIORITY_DEFAULT,
           (ThemeThumbnailFunc) marco_theme_thumbnail_cb, data, NULL);
     }
   }
+
+  return 0;
 }
 
 static void
@@ -821,8 +868,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
         else if (change_type == MATE_THEME_CHANGE_CHANGED)
           update_in_treeview ("gtk_themes_list", info->name, info->name, data);
 
-        generate_gtk_theme_thumbnail_async (info,
-            (ThemeThumbnailFunc) gtk_theme_thumbnail_cb, data, NULL);
+        reset_thumbnail_in_treeview ("gtk_themes_list", info->name, data);
       }
 
       if (element_type & MATE_THEME_MARCO) {
@@ -831,8 +877,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
         else if (change_type == MATE_THEME_CHANGE_CHANGED)
           update_in_treeview ("window_themes_list", info->name, info->name, data);
 
-        generate_marco_theme_thumbnail_async (info,
-            (ThemeThumbnailFunc) marco_theme_thumbnail_cb, data, NULL);
+        reset_thumbnail_in_treeview ("window_themes_list", info->name, data);
       }
     }
 
@@ -847,8 +892,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
       else if (change_type == MATE_THEME_CHANGE_CHANGED)
         update_in_treeview ("icon_themes_list", info->name, info->readable_name, data);
 
-      generate_icon_theme_thumbnail_async (info,
-          (ThemeThumbnailFunc) icon_theme_thumbnail_cb, data, NULL);
+      reset_thumbnail_in_treeview ("icon_themes_list", info->name, data);
     }
 
   } else if (theme->type == MATE_THEME_TYPE_CURSOR) {
@@ -865,6 +909,161 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
   }
 }
 
+/* Rows are also measured when they aren't on screen; thumbnails are only
+ * made for the ones which are actually shown. */
+static gboolean
+row_is_visible (GtkTreeView *treeview,
+                GtkTreeModel *model,
+                GtkTreeIter *iter)
+{
+  GtkTreePath *start, *end, *path;
+  gboolean visible;
+
+  if (!gtk_tree_view_get_visible_range (treeview, &start, &end))
+    return FALSE;
+
+  path = gtk_tree_model_get_path (model, iter);
+  visible = gtk_tree_path_compare (path, start) >= 0 && gtk_tree_path_compare (path, end) <= 0;
+
+  gtk_tree_path_free (path);
+  gtk_tree_path_free (start);
+  gtk_tree_path_free (end);
+
+  return visible;
+}
+
+static gboolean
+load_cursor_thumbnails_idle (AppearanceData *data)
+{
+  while (cursor_thumbnail_queue) {
+    gchar *name = cursor_thumbnail_queue->data;
+    MateThemeCursorInfo *info;
+
+    info = mate_theme_cursor_info_find (name);
+    if (info)
+      update_thumbnail_in_treeview ("cursor_themes_list", name,
+                                    mate_theme_cursor_info_get_thumbnail (info), data);
+
+    cursor_thumbnail_queue = g_slist_delete_link (cursor_thumbnail_queue, cursor_thumbnail_queue);
+    g_free (name);
+  }
+
+  cursor_thumbnail_idle_id = 0;
+  return FALSE;
+}
+
+static gboolean
+cursor_thumbnail_loaded (const gchar *name)
+{
+  MateThemeCursorInfo *info;
+
+  info = mate_theme_cursor_info_find (name);
+  return info == NULL || info->thumbnail_loaded;
+}
+
+static void
+cursor_thumbnail_cell_data_func (GtkTreeViewColumn *column,
+                                 GtkCellRenderer *renderer,
+                                 GtkTreeModel *model,
+                                 GtkTreeIter *iter,
+                                 AppearanceData *data)
+{
+  GdkPixbuf *thumbnail;
+  gchar *name;
+
+  gtk_tree_model_get (model, iter, COL_THUMBNAIL, &thumbnail, COL_NAME, &name, -1);
+  g_object_set (renderer, "pixbuf", thumbnail, NULL);
+
+  /* Storing the thumbnail in the model from an idle gets the row
+   * measured again with it.  Themes whose thumbnail couldn't be loaded
+   * aren't queued again on every redraw. */
+  if (thumbnail == NULL && name != NULL &&
+      !cursor_thumbnail_loaded (name) &&
+      !g_slist_find_custom (cursor_thumbnail_queue, name, (GCompareFunc) strcmp) &&
+      row_is_visible (GTK_TREE_VIEW (gtk_tree_view_column_get_tree_view (column)), model, iter)) {
+    cursor_thumbnail_queue = g_slist_prepend (cursor_thumbnail_queue, name);
+    name = NULL;
+
+    if (cursor_thumbnail_idle_id == 0)
+      cursor_thumbnail_idle_id = g_idle_add ((GSourceFunc) load_cursor_thumbnails_idle, data);
+  }
+
+  if (thumbnail)
+    g_object_unref (thumbnail);
+  g_free (name);
+}
+
+static void
+theme_thumbnail_cell_data_func (GtkTreeViewColumn *column,
+                                GtkCellRenderer *renderer,
+                                GtkTreeModel *model,
+                                GtkTreeIter *iter,
+                                ThemeConvData *conv)
+{
+  GdkPixbuf *thumbnail;
+  gchar *name;
+
+  gtk_tree_model_get (model, iter, COL_THUMBNAIL, &thumbnail, COL_NAME, &name, -1);
+  g_object_set (renderer, "pixbuf", thumbnail, NULL);
+
+  if (thumbnail == conv->thumbnail && name != NULL &&
+      !g_hash_table_contains (conv->requests, name) &&
+      row_is_visible (GTK_TREE_VIEW (gtk_tree_view_column_get_tree_view (column)), model, iter)) {
+    guint request_id = create_thumbnail (name, conv->thumbnail, conv->data);
+
+    g_hash_table_insert (conv->requests, name, GUINT_TO_POINTER (request_id));
+    name = NULL;
+  }
+
+  if (thumbnail)
+    g_object_unref (thumbnail);
+  g_free (name);
+}
+
+/* Drops the thumbnail requests of rows which were scrolled out of view,
+ * or of all rows once the list is hidden; they are made again when the
+ * rows are drawn. */
+static void
+prune_thumbnail_requests (GtkTreeView *list)
+{
+  ThemeConvData *conv = g_object_get_data (G_OBJECT (list), THEME_DATA);
+  GtkTreeModel *model = gtk_tree_view_get_model (list);
+  GtkTreePath *start = NULL, *end = NULL;
+  GHashTableIter iter;
+  gpointer name, request_id;
+  gboolean shown;
+
+  shown = gtk_widget_get_mapped (GTK_WIDGET (list)) &&
+          gtk_tree_view_get_visible_range (list, &start, &end);
+
+  g_hash_table_iter_init (&iter, conv->requests);
+  while (g_hash_table_iter_next (&iter, &name, &request_id)) {
+    gchar *path_str;
+
+    if (GPOINTER_TO_UINT (request_id) == 0)
+      continue;
+
+    if (shown && (path_str = find_string_in_model (model, name, COL_NAME)) != NULL) {
+      GtkTreePath *path = gtk_tree_path_new_from_string (path_str);
+      gboolean visible = gtk_tree_path_compare (path, start) >= 0 && gtk_tree_path_compare (path, end) <= 0;
+
+      gtk_tree_path_free (path);
+      g_free (path_str);
+
+      if (visible)
+        continue;
+    }
+
+    theme_thumbnail_cancel (GPOINTER_TO_UINT (request_id));
+    g_hash_table_iter_remove (&iter);
+  }
+
+  if (start)
+    gtk_tree_path_free (start);
+  if (end)
+    gtk_tree_path_free (end);
+}
+
 static void
 prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback callback)
 {
@@ -875,10 +1074,9 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
   GtkTreeModel *sort_model;
   GdkPixbuf *thumbnail;
   const gchar *key;
-  ThumbnailGenFunc generator;
-  ThemeThumbnailFunc thumb_cb;
   ThemeConvData *conv_data;
   GSettings *settings;
+  GtkAdjustment *adjustment;
 
   switch (type)
   {
@@ -887,8 +1085,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->gtk_theme_icon;
       settings = data->interface_settings;
       key = GTK_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_gtk_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) gtk_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_WINDOW:
@@ -896,8 +1092,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->window_theme_icon;
       settings = data->marco_settings;
       key = MARCO_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_marco_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) marco_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_ICON:
@@ -905,8 +1099,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->icon_theme_icon;
       settings = data->interface_settings;
       key = ICON_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_icon_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) icon_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_CURSOR:
@@ -914,8 +1106,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = NULL;
       settings = data->mouse_settings;
       key = CURSOR_THEME_KEY;
-      generator = NULL;
-      thumb_cb = NULL;
       break;
 
     default:
@@ -930,22 +1120,12 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
     MateThemeCommonInfo *theme = (MateThemeCommonInfo *) l->data;
     GtkTreeIter i;
 
-    if (type == THEME_TYPE_CURSOR) {
-      thumbnail = ((MateThemeCursorInfo *) theme)->thumbnail;
-    } else {
-      generator (theme, thumb_cb, data, NULL);
-    }
-
+    /* thumbnails are made once their row is drawn */
     gtk_list_store_insert_with_values (store, &i, 0,
                                        COL_LABEL, theme->readable_name,
                                        COL_NAME, theme->name,
                                        COL_THUMBNAIL, thumbnail,
                                        -1);
-
-    if (type == THEME_TYPE_CURSOR && thumbnail) {
-      g_object_unref (thumbnail);
-      thumbnail = NULL;
-    }
   }
   g_list_free (themes);
 
@@ -960,12 +1140,24 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
 
   gtk_tree_view_set_model (GTK_TREE_VIEW (list), GTK_TREE_MODEL (sort_model));
 
+  conv_data = g_new (ThemeConvData, 1);
+  conv_data->data = data;
+  conv_data->thumbnail = thumbnail;
+  conv_data->requests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   renderer = gtk_cell_renderer_pixbuf_new ();
   g_object_set (renderer, "xpad", 3, "ypad", 3, NULL);
 
   column = gtk_tree_view_column_new ();
   gtk_tree_view_column_pack_start (column, renderer, FALSE);
-  gtk_tree_view_column_add_attribute (column, renderer, "pixbuf", COL_THUMBNAIL);
+  if (type == THEME_TYPE_CURSOR)
+    gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                             (GtkTreeCellDataFunc) cursor_thumbnail_cell_data_func,
+                                             data, NULL);
+  else
+    gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                             (GtkTreeCellDataFunc) theme_thumbnail_cell_data_func,
+                                             conv_data, NULL);
   gtk_tree_view_append_column (GTK_TREE_VIEW (list), column);
 
   renderer = gtk_cell_renderer_text_new ();
@@ -975,10 +1167,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
   gtk_tree_view_column_add_attribute (column, renderer, "text", COL_LABEL);
   gtk_tree_view_append_column (GTK_TREE_VIEW (list), column);
 
-  conv_data = g_new (ThemeConvData, 1);
-  conv_data->data = data;
-  conv_data->thumbnail = thumbnail;
-  
   /* set useful data for callbacks */
   g_object_set_data (G_OBJECT (list), THEME_DATA, conv_data);
   g_object_set_data (G_OBJECT (list), GSETTINGS_SETTINGS, settings);
@@ -1010,6 +1198,14 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
   /* connect to treeview change event */
   g_signal_connect (gtk_tree_view_get_selection (GTK_TREE_VIEW (list)),
       "changed", G_CALLBACK (treeview_selection_changed_callback), list);
+
+  /* drop thumbnails nobody is going to see */
+  if (type != THEME_TYPE_CURSOR) {
+    adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (gtk_widget_get_parent (list)));
+    g_signal_connect_swapped (adjustment, "value-changed",
+        G_CALLBACK (prune_thumbnail_requests), list);
+    g_signal_connect (list, "unmap", G_CALLBACK (prune_thumbnail_requests), NULL);
+  }
 }
 
 void
@@ -30,7 +30,6 @@
 #include <glib/gi18n.h>
 #include <libwindow-settings/mate-wm-manager.h>
 #include <string.h>
-#include <libmate-desktop/mate-desktop-thumbnail.h>
 #include <libmate-desktop/mate-gsettings.h>
 
 #define CUSTOM_THEME_NAME "__custom__"
@@ -55,32 +54,7 @@ static const GtkTargetEntry drop_types[] =
 
 static void theme_message_area_update(AppearanceData* data);
 
-static time_t theme_get_mtime(const char* name)
-{
-	MateThemeMetaInfo* theme;
-	time_t mtime = -1;
-
-	theme = mate_theme_meta_info_find(name);
-	if (theme != NULL)
-	{
-		GFile* file;
-		GFileInfo* file_info;
-
-		file = g_file_new_for_path(theme->path);
-		file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, NULL);
-		g_object_unref(file);
-
-		if (file_info != NULL)
-		{
-			mtime = g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-			g_object_unref(file_info);
-		}
-	}
-
-	return mtime;
-}
-
-static void theme_thumbnail_update(GdkPixbuf* pixbuf, gchar* theme_name, AppearanceData* data, gboolean cache)
+static void theme_thumbnail_update(GdkPixbuf* pixbuf, gchar* theme_name, AppearanceData* data)
 {
 	GtkTreeIter iter;
 	GtkTreeModel* model = GTK_TREE_MODEL(data->theme_store);
@@ -91,72 +65,77 @@ static void theme_thumbnail_update(GdkPixbuf* pixbuf, gchar* theme_name, Appeara
 
 	if (theme_find_in_model(model, theme_name, &iter))
 	{
-		time_t mtime;
-
 		gtk_list_store_set(data->theme_store, &iter, COL_THUMBNAIL, pixbuf, -1);
+	}
+}
 
-		/* cache thumbnail */
-		if (cache && (mtime = theme_get_mtime(theme_name)) != -1)
-		{
-			gchar* path;
-
-			/* try to share thumbs with caja, use themes:/// */
-			path = g_strconcat("themes:///", theme_name, NULL);
+static void
+theme_thumbnail_done_cb (GdkPixbuf *pixbuf, gchar *theme_name, AppearanceData *data)
+{
+  g_hash_table_remove (data->theme_thumbnail_requests, theme_name);
+  theme_thumbnail_update (pixbuf, theme_name, data);
+}
 
-			mate_desktop_thumbnail_factory_save_thumbnail(data->thumb_factory, pixbuf, path, mtime);
+static void theme_thumbnail_cancel_request(const gchar* name, AppearanceData* data)
+{
+	guint request_id = GPOINTER_TO_UINT(g_hash_table_lookup(data->theme_thumbnail_requests, name));
 
-			g_free(path);
-		}
+	if (request_id != 0)
+	{
+		theme_thumbnail_cancel(request_id);
+		g_hash_table_remove(data->theme_thumbnail_requests, name);
 	}
 }
 
-static GdkPixbuf* theme_get_thumbnail_from_cache(MateThemeMetaInfo* info, AppearanceData* data)
+/* Thumbnails are cached by the thumbnailer itself.  They are all made in
+ * the background; the ones on screen are moved ahead by
+ * theme_thumbnail_prioritize_visible(). */
+static void theme_thumbnail_generate(MateThemeMetaInfo* info, AppearanceData* data)
 {
-	GdkPixbuf* thumb = NULL;
-	gchar* path, *thumb_filename;
-	time_t mtime;
+	guint request_id;
+
+	theme_thumbnail_cancel_request(info->name, data);
 
-	if (info == data->theme_custom)
-		return NULL;
+	request_id = generate_meta_theme_thumbnail_async(info, G_PRIORITY_LOW, (ThemeThumbnailFunc) theme_thumbnail_done_cb, data, NULL);
 
-	mtime = theme_get_mtime(info->name);
+	g_hash_table_insert(data->theme_thumbnail_requests, g_strdup(info->name), GUINT_TO_POINTER(request_id));
+}
 
-	if (mtime == -1)
-		return NULL;
+static void theme_thumbnail_prioritize_visible(AppearanceData* data)
+{
+	GtkIconView* icon_view = GTK_ICON_VIEW(appearance_capplet_get_widget(data, "theme_list"));
+	GtkTreeModel* model = gtk_icon_view_get_model(icon_view);
+	GtkTreePath* start;
+	GtkTreePath* end;
+	GtkTreeIter iter;
 
-	/* try to share thumbs with caja, use themes:/// */
-	path = g_strconcat ("themes:///", info->name, NULL);
-	thumb_filename = mate_desktop_thumbnail_factory_lookup(data->thumb_factory, path, mtime);
-	g_free(path);
+	if (model == NULL || !gtk_icon_view_get_visible_range(icon_view, &start, &end))
+		return;
 
-	if (thumb_filename != NULL)
+	if (gtk_tree_model_get_iter(model, &iter, start))
 	{
-		thumb = gdk_pixbuf_new_from_file(thumb_filename, NULL);
-		g_free(thumb_filename);
-	}
+		GtkTreePath* path = gtk_tree_path_copy(start);
 
-	return thumb;
-}
+		do
+		{
+			gchar* name;
+			guint request_id;
 
-static void
-theme_thumbnail_done_cb (GdkPixbuf *pixbuf, gchar *theme_name, AppearanceData *data)
-{
-  theme_thumbnail_update (pixbuf, theme_name, data, TRUE);
-}
+			gtk_tree_model_get(model, &iter, COL_NAME, &name, -1);
+			request_id = GPOINTER_TO_UINT(g_hash_table_lookup(data->theme_thumbnail_requests, name));
 
-static void theme_thumbnail_generate(MateThemeMetaInfo* info, AppearanceData* data)
-{
-	GdkPixbuf* thumb = theme_get_thumbnail_from_cache(info, data);
+			if (request_id != 0)
+				theme_thumbnail_set_priority(request_id, G_PRIORITY_DEFAULT);
 
-	if (thumb != NULL)
-	{
-		theme_thumbnail_update(thumb, info->name, data, FALSE);
-		g_object_unref(thumb);
-	}
-	else
-	{
-		generate_meta_theme_thumbnail_async(info, (ThemeThumbnailFunc) theme_thumbnail_done_cb, data, NULL);
+			g_free(name);
+			gtk_tree_path_next(path);
+		} while (gtk_tree_path_compare(path, end) <= 0 && gtk_tree_model_iter_next(model, &iter));
+
+		gtk_tree_path_free(path);
 	}
+
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
 }
 
 static void theme_changed_on_disk_cb(MateThemeCommonInfo* theme, MateThemeChangeType change_type, MateThemeElement element_type, AppearanceData* data)
@@ -178,6 +157,8 @@ static void theme_changed_on_disk_cb(MateThemeCommonInfo* theme, MateThemeChange
 			{
 				gtk_list_store_remove(data->theme_store, &iter);
 			}
+
+			theme_thumbnail_cancel_request(meta->name, data);
 		}
 		else if (change_type == MATE_THEME_CHANGE_CHANGED)
 		{
@@ -1006,6 +987,7 @@ void themes_init(AppearanceData* data)
   data->theme_icon = gdk_pixbuf_new_from_file (MATECC_PIXMAP_DIR "/theme-thumbnailing.png", NULL);
   data->theme_store = theme_store =
       gtk_list_store_new (NUM_COLS, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING);
+  data->theme_thumbnail_requests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   /* set up theme list */
   theme_list = mate_theme_meta_info_find_all ();
@@ -1071,6 +1053,9 @@ void themes_init(AppearanceData* data)
   gtk_icon_view_set_model (icon_view, GTK_TREE_MODEL (sort_model));
 
   g_signal_connect (icon_view, "selection-changed", (GCallback) theme_selection_changed_cb, data);
+  g_signal_connect_swapped (icon_view, "map", (GCallback) theme_thumbnail_prioritize_visible, data);
+  g_signal_connect_swapped (gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (gtk_widget_get_parent (GTK_WIDGET (icon_view)))),
+                            "value-changed", (GCallback) theme_thumbnail_prioritize_visible, data);
   g_signal_connect_after (icon_view, "realize", (GCallback) theme_select_name, meta_theme->name);
 
   w = appearance_capplet_get_widget (data, "theme_install");
@@ -1147,6 +1132,14 @@ void themes_init(AppearanceData* data)
 void
 themes_shutdown (AppearanceData *data)
 {
+  GHashTableIter iter;
+  gpointer request_id;
+
+  g_hash_table_iter_init (&iter, data->theme_thumbnail_requests);
+  while (g_hash_table_iter_next (&iter, NULL, &request_id))
+    theme_thumbnail_cancel (GPOINTER_TO_UINT (request_id));
+  g_hash_table_destroy (data->theme_thumbnail_requests);
+
   mate_theme_meta_info_free (data->theme_custom);
 
   if (data->theme_icon)
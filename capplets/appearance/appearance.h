@@ -112,6 +112,7 @@ typedef struct {
 	GtkListStore* theme_store;
 	MateThemeMetaInfo* theme_custom;
 	GdkPixbuf* theme_icon;
+	GHashTable* theme_thumbnail_requests;
 	GtkWidget* theme_save_dialog;
 	GtkWidget* theme_message_area;
 	GtkWidget* theme_message_label;
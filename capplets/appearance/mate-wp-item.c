@@ -25,6 +25,7 @@
 #include <string.h>
 #include "appearance.h"
 #include "mate-wp-item.h"
+#include "capplet-util.h"
 
 const gchar *wp_item_option_to_string (MateBGPlacement type)
 {
@@ -151,8 +152,10 @@ void mate_wp_item_update (MateWPItem *item) {
   item->scolor = gdk_color_copy (&color2);
 }
 
-MateWPItem * mate_wp_item_new (const gchar * filename,
-				 GHashTable * wallpapers,
+/* Returns an item for filename if it is a wallpaper, without its colors,
+ * options and MateBG.  Only looks at the file, so it may be called from
+ * any thread. */
+MateWPItem * mate_wp_item_probe (const gchar * filename,
 				 MateDesktopThumbnailFactory * thumbnails) {
   MateWPItem *item = g_new0 (MateWPItem, 1);
 
@@ -168,15 +171,25 @@ MateWPItem * mate_wp_item_new (const gchar * filename,
     else
       item->name = g_filename_to_utf8 (item->fileinfo->name, -1, NULL,
 				       NULL, NULL);
+  } else {
+    mate_wp_item_free (item);
+    item = NULL;
+  }
+
+  return item;
+}
 
+MateWPItem * mate_wp_item_new (const gchar * filename,
+				 GHashTable * wallpapers,
+				 MateDesktopThumbnailFactory * thumbnails) {
+  MateWPItem *item = mate_wp_item_probe (filename, thumbnails);
+
+  if (item != NULL) {
     mate_wp_item_update (item);
     mate_wp_item_ensure_mate_bg (item);
     mate_wp_item_update_description (item);
 
     g_hash_table_insert (wallpapers, item->filename, item);
-  } else {
-    mate_wp_item_free (item);
-    item = NULL;
   }
 
   return item;
@@ -263,6 +276,186 @@ GdkPixbuf * mate_wp_item_get_frame_thumbnail (MateWPItem * item,
 }
 
 
+/* Thumbnails rendered in the background.  MateBG isn't thread-safe, so
+ * each job renders with its own MateBG, set up from a copy of the item's
+ * properties; the item itself is only touched in the main thread. */
+typedef struct {
+  MateWPItem *item;
+  guint generation;
+
+  gchar *filename;
+  MateBGPlacement options;
+  MateBGColorType shade_type;
+  GdkColor pcolor;
+  GdkColor scolor;
+
+  MateDesktopThumbnailFactory *thumbs;
+  GdkScreen *screen;
+  gint width;
+  gint height;
+
+  MateWPItemThumbnailFunc func;
+  gpointer user_data;
+
+  /* what the thread found */
+  GdkPixbuf *pixbuf;
+  gint image_width;
+  gint image_height;
+} ThumbnailJob;
+
+/* Decoding full size wallpapers takes a lot of memory, so only a few at
+ * a time */
+#define MAX_THUMBNAIL_THREADS 4
+
+static GThreadPool *thumbnail_pool = NULL;
+static gboolean thumbnails_shutting_down = FALSE;
+
+/* protects what follows */
+static GMutex thumbnail_lock;
+static GQueue thumbnails_done = G_QUEUE_INIT;
+static guint thumbnails_done_id = 0;
+
+static void thumbnail_job_free (ThumbnailJob *job)
+{
+  g_free (job->filename);
+  g_object_unref (job->thumbs);
+  g_object_unref (job->screen);
+  if (job->pixbuf)
+    g_object_unref (job->pixbuf);
+  g_free (job);
+}
+
+static gboolean thumbnails_done_idle (gpointer user_data)
+{
+  GQueue done;
+  ThumbnailJob *job;
+
+  g_mutex_lock (&thumbnail_lock);
+  done = thumbnails_done;
+  g_queue_init (&thumbnails_done);
+  thumbnails_done_id = 0;
+  g_mutex_unlock (&thumbnail_lock);
+
+  while ((job = g_queue_pop_head (&done)) != NULL) {
+    MateWPItem *item = job->item;
+
+    /* the size or the item changed since it was asked for */
+    if (job->generation == item->thumbnail_generation) {
+      item->width = job->image_width;
+      item->height = job->image_height;
+
+      job->func (item, job->pixbuf, job->user_data);
+    }
+
+    thumbnail_job_free (job);
+  }
+
+  return FALSE;
+}
+
+static void render_thumbnail (ThumbnailJob *job, gpointer user_data)
+{
+  if (!thumbnails_shutting_down) {
+    MateBG *bg;
+
+    capplet_trace_begin ("wallpaper thumbnail");
+
+    bg = mate_bg_new ();
+    if (job->filename)
+      mate_bg_set_filename (bg, job->filename);
+
+    mate_bg_set_color (bg, job->shade_type, &job->pcolor, &job->scolor);
+    mate_bg_set_placement (bg, job->options);
+
+    job->pixbuf = mate_bg_create_thumbnail (bg, job->thumbs, job->screen,
+                                            job->width, job->height);
+
+    if (job->pixbuf && mate_bg_changes_with_time (bg)) {
+      GdkPixbuf *tmp;
+
+      tmp = add_slideshow_frame (job->pixbuf);
+      g_object_unref (job->pixbuf);
+      job->pixbuf = tmp;
+    }
+
+    mate_bg_get_image_size (bg, job->thumbs, job->width, job->height,
+                            &job->image_width, &job->image_height);
+
+    g_object_unref (bg);
+
+    capplet_trace_end ("wallpaper thumbnail");
+  }
+
+  g_mutex_lock (&thumbnail_lock);
+  g_queue_push_tail (&thumbnails_done, job);
+  if (thumbnails_done_id == 0)
+    thumbnails_done_id = g_idle_add (thumbnails_done_idle, NULL);
+  g_mutex_unlock (&thumbnail_lock);
+}
+
+/* Renders the item's thumbnail in a thread, and hands it to func in the
+ * main thread.  func isn't called if the item's thumbnail is asked for
+ * again, or cancelled, in the meantime. */
+void mate_wp_item_get_thumbnail_async (MateWPItem * item,
+                                       MateDesktopThumbnailFactory * thumbs,
+                                       gint width,
+                                       gint height,
+                                       MateWPItemThumbnailFunc func,
+                                       gpointer user_data) {
+  ThumbnailJob *job;
+
+  if (thumbnail_pool == NULL)
+    thumbnail_pool = g_thread_pool_new ((GFunc) render_thumbnail, NULL,
+                                        CLAMP (g_get_num_processors (), 1, MAX_THUMBNAIL_THREADS),
+                                        FALSE, NULL);
+
+  job = g_new0 (ThumbnailJob, 1);
+  job->item = item;
+  job->generation = ++item->thumbnail_generation;
+
+  job->filename = g_strdup (item->filename);
+  job->options = item->options;
+  job->shade_type = item->shade_type;
+  job->pcolor = *item->pcolor;
+  job->scolor = *item->scolor;
+
+  job->thumbs = g_object_ref (thumbs);
+  job->screen = g_object_ref (gdk_screen_get_default ());
+  job->width = width;
+  job->height = height;
+
+  job->func = func;
+  job->user_data = user_data;
+
+  g_thread_pool_push (thumbnail_pool, job, NULL);
+}
+
+void mate_wp_item_cancel_thumbnail (MateWPItem * item) {
+  item->thumbnail_generation++;
+}
+
+/* Waits for the threads; the thumbnails not rendered yet are dropped */
+void mate_wp_item_thumbnails_shutdown (void) {
+  ThumbnailJob *job;
+
+  if (thumbnail_pool == NULL)
+    return;
+
+  thumbnails_shutting_down = TRUE;
+  g_thread_pool_free (thumbnail_pool, FALSE, TRUE);
+  thumbnail_pool = NULL;
+
+  if (thumbnails_done_id != 0) {
+    g_source_remove (thumbnails_done_id);
+    thumbnails_done_id = 0;
+  }
+
+  while ((job = g_queue_pop_head (&thumbnails_done)) != NULL)
+    thumbnail_job_free (job);
+
+  thumbnails_shutting_down = FALSE;
+}
+
 GdkPixbuf * mate_wp_item_get_thumbnail (MateWPItem * item,
 					 MateDesktopThumbnailFactory * thumbs,
                                          gint width,
@@ -59,11 +59,23 @@ struct _MateWPItem {
   /* Width and Height of the original image */
   gint width;
   gint height;
+
+  /* Whether the thumbnail in the list was asked for since the row was
+   * added, or the thumbnail size changed */
+  gboolean thumbnail_requested;
+  /* Bumped to drop the thumbnails still being rendered in the background */
+  guint thumbnail_generation;
 };
 
+typedef void (*MateWPItemThumbnailFunc) (MateWPItem *item,
+                                         GdkPixbuf *pixbuf,
+                                         gpointer user_data);
+
 MateWPItem * mate_wp_item_new (const gchar *filename,
 				 GHashTable *wallpapers,
 				 MateDesktopThumbnailFactory *thumbnails);
+MateWPItem * mate_wp_item_probe (const gchar *filename,
+				 MateDesktopThumbnailFactory *thumbnails);
 
 void mate_wp_item_free (MateWPItem *item);
 GdkPixbuf * mate_wp_item_get_thumbnail (MateWPItem *item,
@@ -75,6 +87,14 @@ GdkPixbuf * mate_wp_item_get_frame_thumbnail (MateWPItem *item,
                                                gint width,
                                                gint height,
                                                gint frame);
+void mate_wp_item_get_thumbnail_async (MateWPItem *item,
+                                       MateDesktopThumbnailFactory *thumbs,
+                                       gint width,
+                                       gint height,
+                                       MateWPItemThumbnailFunc func,
+                                       gpointer user_data);
+void mate_wp_item_cancel_thumbnail (MateWPItem *item);
+void mate_wp_item_thumbnails_shutdown (void);
 void mate_wp_item_update (MateWPItem *item);
 void mate_wp_item_update_description (MateWPItem *item);
 void mate_wp_item_ensure_mate_bg (MateWPItem *item);
@@ -20,6 +20,7 @@
 
 #include "appearance.h"
 #include "mate-wp-item.h"
+#include "mate-wp-xml.h"
 #include <gio/gio.h>
 #include <string.h>
 #include <libxml/parser.h>
@@ -65,7 +66,73 @@ static void mate_wp_xml_set_bool(const xmlNode* parent, const xmlChar* prop_name
 	}
 }
 
-static void mate_wp_load_legacy(AppearanceData* data)
+/* One pass over wallpaper lists.  It doesn't touch AppearanceData, so
+ * that it can run in a thread; the wallpapers it finds are added to
+ * data->wp_hash by mate_wp_xml_add_items(). */
+typedef struct {
+	MateDesktopThumbnailFactory* thumbs;
+
+	/* for what the lists don't say, from GSettings */
+	MateBGPlacement options;
+	MateBGColorType shade_type;
+	gchar* pcolor;
+	gchar* scolor;
+
+	/* filename -> MateWPItem of the wallpapers found so far */
+	GHashTable* seen;
+	/* the same, in the order they were found */
+	GQueue items;
+	/* paths of the directories to monitor */
+	GSList* dirs;
+} MateWPXmlParser;
+
+/* Streams the wallpapers found by a MateWPXmlParser running in a thread to
+ * the main thread */
+typedef struct {
+	AppearanceData* data;
+	MateWPXmlItemsFunc items_func;
+	MateWPXmlDoneFunc done_func;
+
+	MateWPXmlParser parser;
+	GThread* thread;
+
+	/* protects what follows */
+	GMutex lock;
+	/* found, but not handed to the main thread yet */
+	GQueue items;
+	gboolean finished;
+	guint idle_id;
+} MateWPXmlLoader;
+
+/* How many wallpapers are added to the list in one main loop iteration */
+#define WP_XML_BATCH_SIZE 32
+
+static MateWPXmlLoader* wp_loader = NULL;
+
+static void mate_wp_xml_parser_init(MateWPXmlParser* parser, AppearanceData* data)
+{
+	parser->thumbs = data->thumb_factory;
+	parser->options = g_settings_get_enum(data->wp_settings, WP_OPTIONS_KEY);
+	parser->shade_type = g_settings_get_enum(data->wp_settings, WP_SHADING_KEY);
+	parser->pcolor = g_settings_get_string(data->wp_settings, WP_PCOLOR_KEY);
+	parser->scolor = g_settings_get_string(data->wp_settings, WP_SCOLOR_KEY);
+	parser->seen = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&parser->items);
+	parser->dirs = NULL;
+}
+
+/* The items themselves belong to whoever took them out of parser->items */
+static void mate_wp_xml_parser_clear(MateWPXmlParser* parser)
+{
+	g_free(parser->pcolor);
+	g_free(parser->scolor);
+	g_hash_table_destroy(parser->seen);
+	g_queue_foreach(&parser->items, (GFunc) mate_wp_item_free, NULL);
+	g_queue_clear(&parser->items);
+	g_slist_free_full(parser->dirs, g_free);
+}
+
+static void mate_wp_load_legacy(MateWPXmlParser* parser)
 {
 	/* Legacy of GNOME2
 	 * ~/.gnome2/wallpapers.list */
@@ -82,13 +149,14 @@ static void mate_wp_load_legacy(AppearanceData* data)
 			while (fgets(foo, 4096, fp))
 			{
 				MateWPItem * item;
+				GdkColor color;
 
 				if (foo[strlen(foo) - 1] == '\n')
 				{
 					foo[strlen(foo) - 1] = '\0';
 				}
 
-				item = g_hash_table_lookup(data->wp_hash, foo);
+				item = g_hash_table_lookup(parser->seen, foo);
 
 				if (item != NULL)
 				{
@@ -100,12 +168,23 @@ static void mate_wp_load_legacy(AppearanceData* data)
 					continue;
 				}
 
-				item = mate_wp_item_new(foo, data->wp_hash, data->thumb_factory);
+				item = mate_wp_item_probe(foo, parser->thumbs);
 
-				if (item != NULL && item->fileinfo == NULL)
+				if (item == NULL)
 				{
-					mate_wp_item_free(item);
+					continue;
 				}
+
+				/* what mate_wp_item_update() would read */
+				item->options = parser->options;
+				item->shade_type = parser->shade_type;
+				gdk_color_parse(parser->pcolor, &color);
+				item->pcolor = gdk_color_copy(&color);
+				gdk_color_parse(parser->scolor, &color);
+				item->scolor = gdk_color_copy(&color);
+
+				g_hash_table_insert(parser->seen, item->filename, item);
+				g_queue_push_tail(&parser->items, item);
 			}
 
 			fclose(fp);
@@ -116,7 +195,7 @@ static void mate_wp_load_legacy(AppearanceData* data)
 	g_free(filename);
 }
 
-static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
+static void mate_wp_xml_load_xml(MateWPXmlParser* parser, const char* filename)
 {
 	xmlDoc* wplist;
 	xmlNode* root;
@@ -261,7 +340,7 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 			}
 
 			/* Make sure we don't already have this one and that filename exists */
-			if (wp->filename == NULL || g_hash_table_lookup (data->wp_hash, wp->filename) != NULL)
+			if (wp->filename == NULL || g_hash_table_lookup (parser->seen, wp->filename) != NULL)
 			{
 
 				mate_wp_item_free (wp);
@@ -273,22 +352,22 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 			/* Verify the colors and alloc some GdkColors here */
 			if (!have_scale)
 			{
-				wp->options = g_settings_get_enum(data->wp_settings, WP_OPTIONS_KEY);
+				wp->options = parser->options;
 			}
 
 			if (!have_shade)
 			{
-				wp->shade_type = g_settings_get_enum(data->wp_settings, WP_SHADING_KEY);
+				wp->shade_type = parser->shade_type;
 			}
 
 			if (pcolor == NULL)
 			{
-				pcolor = g_settings_get_string(data->wp_settings, WP_PCOLOR_KEY);
+				pcolor = g_strdup(parser->pcolor);
 			}
 
 			if (scolor == NULL)
 			{
-				scolor = g_settings_get_string (data->wp_settings, WP_SCOLOR_KEY);
+				scolor = g_strdup(parser->scolor);
 			}
 
 			if (!have_artist)
@@ -306,7 +385,7 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 
 			if ((wp->filename != NULL && g_file_test (wp->filename, G_FILE_TEST_EXISTS)) || !strcmp (wp->filename, "(none)"))
 			{
-				wp->fileinfo = mate_wp_info_new(wp->filename, data->thumb_factory);
+				wp->fileinfo = mate_wp_info_new(wp->filename, parser->thumbs);
 
 				if (wp->name == NULL || !strcmp(wp->filename, "(none)"))
 				{
@@ -314,9 +393,8 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 					wp->name = g_strdup (wp->fileinfo->name);
 				}
 
-				mate_wp_item_ensure_mate_bg (wp);
-				mate_wp_item_update_description (wp);
-				g_hash_table_insert (data->wp_hash, wp->filename, wp);
+				g_hash_table_insert (parser->seen, wp->filename, wp);
+				g_queue_push_tail (&parser->items, wp);
 			}
 			else
 			{
@@ -329,8 +407,35 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 	xmlFreeDoc(wplist);
 }
 
+/* Adds what the parser found to data->wp_hash, in the main thread.
+ * Returns the items which weren't there yet; the others are dropped. */
+static GSList* mate_wp_xml_add_items(AppearanceData* data, GQueue* items)
+{
+	GSList* added = NULL;
+	MateWPItem* wp;
+
+	while ((wp = g_queue_pop_head(items)) != NULL)
+	{
+		/* added by the user in the meantime, or by an earlier pass */
+		if (g_hash_table_lookup(data->wp_hash, wp->filename) != NULL)
+		{
+			mate_wp_item_free(wp);
+			continue;
+		}
+
+		mate_wp_item_ensure_mate_bg(wp);
+		mate_wp_item_update_description(wp);
+		g_hash_table_insert(data->wp_hash, wp->filename, wp);
+
+		added = g_slist_prepend(added, wp);
+	}
+
+	return g_slist_reverse(added);
+}
+
 static void mate_wp_file_changed(GFileMonitor* monitor, GFile* file, GFile* other_file, GFileMonitorEvent event_type, AppearanceData* data)
 {
+	MateWPXmlParser parser;
 	char* filename;
 
 	switch (event_type)
@@ -338,7 +443,10 @@ static void mate_wp_file_changed(GFileMonitor* monitor, GFile* file, GFile* othe
 		case G_FILE_MONITOR_EVENT_CHANGED:
 		case G_FILE_MONITOR_EVENT_CREATED:
 			filename = g_file_get_path(file);
-			mate_wp_xml_load_xml(data, filename);
+			mate_wp_xml_parser_init(&parser, data);
+			mate_wp_xml_load_xml(&parser, filename);
+			g_slist_free(mate_wp_xml_add_items(data, &parser.items));
+			mate_wp_xml_parser_clear(&parser);
 			g_free(filename);
 			break;
 		default:
@@ -364,7 +472,29 @@ static void mate_wp_xml_add_monitor(GFile* directory, AppearanceData* data)
 	g_signal_connect(monitor, "changed", G_CALLBACK(mate_wp_file_changed), data);
 }
 
-static void mate_wp_xml_load_from_dir(const char* path, AppearanceData* data)
+static gboolean mate_wp_xml_load_idle(MateWPXmlLoader* loader);
+
+/* Hands what the parser found so far to the main thread */
+static void mate_wp_xml_loader_flush(MateWPXmlLoader* loader, gboolean finished)
+{
+	g_mutex_lock(&loader->lock);
+
+	while (!g_queue_is_empty(&loader->parser.items))
+	{
+		g_queue_push_tail(&loader->items, g_queue_pop_head(&loader->parser.items));
+	}
+
+	loader->finished = finished;
+
+	if (loader->idle_id == 0 && (finished || !g_queue_is_empty(&loader->items)))
+	{
+		loader->idle_id = g_idle_add((GSourceFunc) mate_wp_xml_load_idle, loader);
+	}
+
+	g_mutex_unlock(&loader->lock);
+}
+
+static void mate_wp_xml_load_from_dir(MateWPXmlLoader* loader, const char* path)
 {
 	GFile* directory;
 	GFileEnumerator* enumerator;
@@ -399,18 +529,22 @@ static void mate_wp_xml_load_from_dir(const char* path, AppearanceData* data)
 
 		g_object_unref(info);
 
-		mate_wp_xml_load_xml(data, fullpath);
+		mate_wp_xml_load_xml(&loader->parser, fullpath);
 		g_free(fullpath);
+
+		mate_wp_xml_loader_flush(loader, FALSE);
 	}
 
 	g_file_enumerator_close(enumerator, NULL, NULL);
+	g_object_unref(enumerator);
 
-	mate_wp_xml_add_monitor(directory, data);
+	/* monitors belong to the main thread */
+	loader->parser.dirs = g_slist_prepend(loader->parser.dirs, g_strdup(path));
 
 	g_object_unref(directory);
 }
 
-void mate_wp_xml_load_list(AppearanceData* data)
+static gpointer mate_wp_xml_load_thread(MateWPXmlLoader* loader)
 {
 	const char* const* system_data_dirs;
 	char* datadir;
@@ -421,7 +555,7 @@ void mate_wp_xml_load_list(AppearanceData* data)
 
 	if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
 	{
-		mate_wp_xml_load_xml(data, wpdbfile);
+		mate_wp_xml_load_xml(&loader->parser, wpdbfile);
 	}
 	else
 	{
@@ -431,7 +565,7 @@ void mate_wp_xml_load_list(AppearanceData* data)
 
 		if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
 		{
-			mate_wp_xml_load_xml(data, wpdbfile);
+			mate_wp_xml_load_xml(&loader->parser, wpdbfile);
 		}
 	}
 
@@ -444,7 +578,7 @@ void mate_wp_xml_load_list(AppearanceData* data)
 
 	if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
 	{
-		mate_wp_xml_load_xml(data, wpdbfile);
+		mate_wp_xml_load_xml(&loader->parser, wpdbfile);
 	}
 	else
 	{
@@ -454,15 +588,18 @@ void mate_wp_xml_load_list(AppearanceData* data)
 
 		if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
 		{
-			mate_wp_xml_load_xml(data, wpdbfile);
+			mate_wp_xml_load_xml(&loader->parser, wpdbfile);
 		}
 	}
 
 	g_free(wpdbfile);*/
 	#endif /* MATE_DISABLE_DEPRECATED */
 
+	/* the user's own list first, so that it shows up right away */
+	mate_wp_xml_loader_flush(loader, FALSE);
+
 	datadir = g_build_filename(g_get_user_data_dir(), "mate-background-properties", NULL);
-	mate_wp_xml_load_from_dir(datadir, data);
+	mate_wp_xml_load_from_dir(loader, datadir);
 	g_free(datadir);
 
 	system_data_dirs = g_get_system_data_dirs();
@@ -470,13 +607,135 @@ void mate_wp_xml_load_list(AppearanceData* data)
 	for (i = 0; system_data_dirs[i]; i++)
 	{
 		datadir = g_build_filename(system_data_dirs[i], "mate-background-properties", NULL);
-		mate_wp_xml_load_from_dir(datadir, data);
+		mate_wp_xml_load_from_dir(loader, datadir);
 		g_free (datadir);
 	}
 
-	mate_wp_xml_load_from_dir(WALLPAPER_DATADIR, data);
+	mate_wp_xml_load_from_dir(loader, WALLPAPER_DATADIR);
+
+	mate_wp_load_legacy(&loader->parser);
+
+	mate_wp_xml_loader_flush(loader, TRUE);
+
+	return NULL;
+}
+
+static void mate_wp_xml_loader_free(MateWPXmlLoader* loader)
+{
+	g_queue_foreach(&loader->items, (GFunc) mate_wp_item_free, NULL);
+	g_queue_clear(&loader->items);
+	mate_wp_xml_parser_clear(&loader->parser);
+	g_mutex_clear(&loader->lock);
+	g_free(loader);
+
+	wp_loader = NULL;
+}
+
+static gboolean mate_wp_xml_load_idle(MateWPXmlLoader* loader)
+{
+	AppearanceData* data = loader->data;
+	GQueue batch = G_QUEUE_INIT;
+	gboolean finished;
+	gboolean again;
+	GSList* added;
+	guint i;
+
+	g_mutex_lock(&loader->lock);
+
+	for (i = 0; i < WP_XML_BATCH_SIZE && !g_queue_is_empty(&loader->items); i++)
+	{
+		g_queue_push_tail(&batch, g_queue_pop_head(&loader->items));
+	}
+
+	finished = loader->finished && g_queue_is_empty(&loader->items);
+
+	/* the thread adds a new idle once it found more */
+	again = finished || !g_queue_is_empty(&loader->items);
+
+	if (!again)
+	{
+		loader->idle_id = 0;
+	}
+
+	g_mutex_unlock(&loader->lock);
+
+	added = mate_wp_xml_add_items(data, &batch);
+
+	if (added != NULL)
+	{
+		loader->items_func(added, data);
+		g_slist_free(added);
+	}
+
+	if (finished)
+	{
+		MateWPXmlDoneFunc done_func = loader->done_func;
+		GSList* l;
+
+		g_thread_join(loader->thread);
+
+		for (l = loader->parser.dirs; l != NULL; l = l->next)
+		{
+			GFile* directory = g_file_new_for_path(l->data);
+			mate_wp_xml_add_monitor(directory, data);
+			g_object_unref(directory);
+		}
+
+		mate_wp_xml_loader_free(loader);
+
+		done_func(data);
+		return FALSE;
+	}
+
+	return again;
+}
+
+/* Reads the wallpaper lists in a thread.  Batches of the wallpapers found
+ * are added to data->wp_hash and passed to items_func in the main thread;
+ * done_func is called after the last one.
+ */
+void mate_wp_xml_load_list_async(AppearanceData* data, MateWPXmlItemsFunc items_func, MateWPXmlDoneFunc done_func)
+{
+	MateWPXmlLoader* loader;
+
+	g_return_if_fail(wp_loader == NULL);
+
+	/* libxml2 has to be set up before it is used from a thread */
+	xmlInitParser();
+
+	loader = g_new0(MateWPXmlLoader, 1);
+	loader->data = data;
+	loader->items_func = items_func;
+	loader->done_func = done_func;
+	mate_wp_xml_parser_init(&loader->parser, data);
+	g_mutex_init(&loader->lock);
+	g_queue_init(&loader->items);
+
+	wp_loader = loader;
+	loader->thread = g_thread_new("mate-wp-xml", (GThreadFunc) mate_wp_xml_load_thread, loader);
+}
+
+/* Waits for the lists to be read completely, without handing the rest to
+ * the caller of mate_wp_xml_load_list_async(); all of it still ends up in
+ * data->wp_hash. */
+static void mate_wp_xml_load_list_wait(AppearanceData* data)
+{
+	MateWPXmlLoader* loader = wp_loader;
+
+	if (loader == NULL)
+	{
+		return;
+	}
+
+	g_thread_join(loader->thread);
 
-	mate_wp_load_legacy(data);
+	if (loader->idle_id != 0)
+	{
+		g_source_remove(loader->idle_id);
+	}
+
+	g_slist_free(mate_wp_xml_add_items(data, &loader->items));
+	mate_wp_xml_loader_free(loader);
 }
 
 static void mate_wp_list_flatten(const char* key, MateWPItem* item, GSList** list)
@@ -496,6 +755,9 @@ void mate_wp_xml_save_list(AppearanceData* data)
 	GSList* list = NULL;
 	char* wpfile;
 
+	/* don't lose what wasn't read yet */
+	mate_wp_xml_load_list_wait(data);
+
 	g_hash_table_foreach(data->wp_hash, (GHFunc) mate_wp_list_flatten, &list);
 	g_hash_table_destroy(data->wp_hash);
 	list = g_slist_reverse(list);
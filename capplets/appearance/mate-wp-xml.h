@@ -21,7 +21,11 @@
 #ifndef _MATE_WP_XML_H_
 #define _MATE_WP_XML_H_
 
-void mate_wp_xml_load_list(AppearanceData* data);
+/* Called in the main thread with wallpapers just added to data->wp_hash */
+typedef void (*MateWPXmlItemsFunc) (GSList* items, AppearanceData* data);
+typedef void (*MateWPXmlDoneFunc) (AppearanceData* data);
+
+void mate_wp_xml_load_list_async(AppearanceData* data, MateWPXmlItemsFunc items_func, MateWPXmlDoneFunc done_func);
 void mate_wp_xml_save_list(AppearanceData* data);
 
 #endif
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 
 #include "capplet-util.h"
+#include "trace-event.h"
 
 static void
 capplet_error_dialog (GtkWindow *parent, char const *msg, GError *err)
@@ -201,3 +202,34 @@ capplet_init (GOptionContext *context,
 
 	gtk_init (argc, argv);
 }
+
+/**
+ * capplet_trace_begin :
+ * @name : the name of the span
+ *
+ * Opens a span in the startup trace; it must be closed by
+ * capplet_trace_end() on the same thread.
+ **/
+void
+capplet_trace_begin (char const *name)
+{
+	trace_event ("capplet", name, "B");
+}
+
+void
+capplet_trace_end (char const *name)
+{
+	trace_event ("capplet", name, "E");
+}
+
+/**
+ * capplet_trace_mark :
+ * @name : the name of the event
+ *
+ * Records an instant event, for things that finish asynchronously.
+ **/
+void
+capplet_trace_mark (char const *name)
+{
+	trace_event ("capplet", name, "i");
+}
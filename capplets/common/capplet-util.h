@@ -41,4 +41,9 @@ void capplet_set_icon (GtkWidget *window, char const *icon_file_name);
 gboolean capplet_file_delete_recursive (GFile *directory, GError **error);
 void capplet_init (GOptionContext *context, int *argc, char ***argv);
 
+/* Startup tracing, enabled by $MATECC_TRACE */
+void capplet_trace_begin (char const *name);
+void capplet_trace_end (char const *name);
+void capplet_trace_mark (char const *name);
+
 #endif /* __CAPPLET_UTIL_H */
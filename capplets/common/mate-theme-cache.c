@@ -0,0 +1,693 @@
+/* mate-theme-cache.c - On-disk index of parsed MATE themes
+ *
+ * This file is part of the Mate Library.
+ *
+ * The Mate Library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * The Mate Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with the Mate Library; see the file COPYING.LIB.  If not,
+ * write to the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "mate-theme-cache.h"
+#include "gtkrc-utils.h"
+
+/* The cache is a single file which is mapped read-only by mate_theme_init:
+ *
+ *   ThemeCacheHeader
+ *   ThemeCacheRecord  records[n_records]  sorted by (type, common_theme_dir)
+ *   guint32           values[n_values]    string offsets and integers
+ *   gchar             strings[strings_size]
+ *
+ * Each record describes one common_theme_dir for one theme type, including
+ * directories which turned out not to contain a theme of that type.  All
+ * integers are in host byte order; a cache written by another architecture,
+ * another version of this code or under another locale is ignored and
+ * rewritten.
+ */
+
+#define THEME_CACHE_MAGIC      "MATETIDX"
+#define THEME_CACHE_VERSION    2
+#define THEME_CACHE_BYTE_ORDER 0x01020304
+#define THEME_CACHE_NO_STRING  G_MAXUINT32
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 byte_order;
+	guint32 n_records;
+	guint32 records_offset;
+	guint32 n_values;
+	guint32 values_offset;
+	guint32 strings_size;
+	guint32 strings_offset;
+	guint32 locale;
+	guint32 padding;
+} ThemeCacheHeader;
+
+typedef struct {
+	guint32 type;
+	guint32 common_theme_dir;
+	MateThemeCacheStamp stamp;
+	guint32 present;
+	guint32 n_strings;
+	guint32 n_ints;
+	guint32 values;
+} ThemeCacheRecord;
+
+G_STATIC_ASSERT (sizeof (ThemeCacheHeader) % 8 == 0);
+G_STATIC_ASSERT (sizeof (ThemeCacheRecord) % 8 == 0);
+
+/* What we know about a common_theme_dir in this session */
+typedef struct {
+	MateThemeType type;
+	gchar* common_theme_dir;
+	MateThemeCacheStamp stamp;
+	gboolean present;
+	GPtrArray* strings;
+	GArray* ints;
+} ThemeCacheEntry;
+
+struct _MateThemeCache {
+	gchar* filename;
+	gchar* locale;
+
+	GMappedFile* mapped;
+	const ThemeCacheHeader* header;
+	const ThemeCacheRecord* records;
+	const guint32* values;
+	const gchar* strings;
+
+	GHashTable* entries;
+	gboolean dirty;
+};
+
+static const glong common_string_fields[] = {
+	G_STRUCT_OFFSET (MateThemeCommonInfo, path),
+	G_STRUCT_OFFSET (MateThemeCommonInfo, name),
+	G_STRUCT_OFFSET (MateThemeCommonInfo, readable_name)
+};
+
+static const glong meta_string_fields[] = {
+	G_STRUCT_OFFSET (MateThemeMetaInfo, comment),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, icon_file),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, gtk_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, gtk_color_scheme),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, marco_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, icon_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, notification_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, sound_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, cursor_theme_name),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, application_font),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, documents_font),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, desktop_font),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, windowtitle_font),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, monospace_font),
+	G_STRUCT_OFFSET (MateThemeMetaInfo, background_image)
+};
+
+static guint
+n_string_fields (MateThemeType type)
+{
+  if (type == MATE_THEME_TYPE_METATHEME)
+    return G_N_ELEMENTS (common_string_fields) + G_N_ELEMENTS (meta_string_fields);
+
+  return G_N_ELEMENTS (common_string_fields);
+}
+
+static gchar **
+string_field (MateThemeCommonInfo *theme_info,
+              guint                i)
+{
+  glong offset;
+
+  if (i < G_N_ELEMENTS (common_string_fields))
+    offset = common_string_fields[i];
+  else
+    offset = meta_string_fields[i - G_N_ELEMENTS (common_string_fields)];
+
+  return &G_STRUCT_MEMBER (gchar *, theme_info, offset);
+}
+
+static void
+stat_file (const gchar *filename,
+           guint64     *mtime,
+           guint64     *size,
+           guint64     *inode)
+{
+  GStatBuf buf;
+
+  if (g_stat (filename, &buf) != 0)
+    return;
+
+  if (mtime != NULL)
+    *mtime = buf.st_mtime;
+  if (size != NULL)
+    *size = buf.st_size;
+  if (inode != NULL)
+    *inode = buf.st_ino;
+}
+
+static gchar *
+metatheme_gtkrc (const gchar *common_theme_dir)
+{
+  GKeyFile *key_file;
+  gchar *filename, *gtk_theme_name, *gtkrc = NULL;
+
+  filename = g_build_filename (common_theme_dir, "index.theme", NULL);
+  key_file = g_key_file_new ();
+
+  if (g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, NULL)) {
+    gtk_theme_name = g_key_file_get_string (key_file, "X-GNOME-Metatheme", "GtkTheme", NULL);
+
+    if (gtk_theme_name != NULL && gtk_theme_name[0] != '\0')
+      gtkrc = gtkrc_find_named (gtk_theme_name);
+
+    g_free (gtk_theme_name);
+  }
+
+  g_key_file_free (key_file);
+  g_free (filename);
+
+  return gtkrc;
+}
+
+void
+mate_theme_cache_stamp_init (MateThemeCacheStamp *stamp,
+                             MateThemeType        type,
+                             const gchar         *common_theme_dir)
+{
+  gchar *filename;
+
+  memset (stamp, 0, sizeof (MateThemeCacheStamp));
+
+  stat_file (common_theme_dir, &stamp->dir_mtime, NULL, &stamp->dir_inode);
+
+  /* index.theme may be edited in place, which leaves the dir alone */
+  filename = g_build_filename (common_theme_dir, "index.theme", NULL);
+  stat_file (filename, &stamp->index_mtime, &stamp->index_size, NULL);
+  g_free (filename);
+
+  /* Metathemes without a color scheme take it from the gtkrc of the GTK
+   * theme they name; cursor themes are made of cursors/. */
+  if (type == MATE_THEME_TYPE_METATHEME)
+    filename = metatheme_gtkrc (common_theme_dir);
+  else if (type == MATE_THEME_TYPE_CURSOR)
+    filename = g_build_filename (common_theme_dir, "cursors", NULL);
+  else
+    filename = NULL;
+
+  if (filename != NULL) {
+    stat_file (filename, &stamp->aux_mtime, NULL, NULL);
+    g_free (filename);
+  }
+}
+
+static gchar *
+entry_key (MateThemeType  type,
+           const gchar   *common_theme_dir)
+{
+  return g_strdup_printf ("%u:%s", type, common_theme_dir);
+}
+
+static void
+theme_cache_entry_free (ThemeCacheEntry *entry)
+{
+  g_free (entry->common_theme_dir);
+  g_ptr_array_free (entry->strings, TRUE);
+  g_array_free (entry->ints, TRUE);
+  g_slice_free (ThemeCacheEntry, entry);
+}
+
+static gboolean
+region_is_valid (gsize   length,
+                 guint32 offset,
+                 guint32 n_items,
+                 gsize   item_size)
+{
+  return offset <= length && (guint64) n_items * item_size <= length - offset;
+}
+
+static const gchar *
+cache_string (MateThemeCache *cache,
+              guint32         offset)
+{
+  if (offset == THEME_CACHE_NO_STRING || offset >= cache->header->strings_size)
+    return NULL;
+
+  return cache->strings + offset;
+}
+
+static void
+theme_cache_unmap (MateThemeCache *cache)
+{
+  if (cache->mapped != NULL)
+    g_mapped_file_unref (cache->mapped);
+
+  cache->mapped = NULL;
+  cache->header = NULL;
+  cache->records = NULL;
+  cache->values = NULL;
+  cache->strings = NULL;
+}
+
+static gboolean
+theme_cache_map (MateThemeCache *cache)
+{
+  const ThemeCacheHeader *header;
+  const gchar *contents;
+  gsize length;
+
+  theme_cache_unmap (cache);
+
+  cache->mapped = g_mapped_file_new (cache->filename, FALSE, NULL);
+  if (cache->mapped == NULL)
+    return FALSE;
+
+  contents = g_mapped_file_get_contents (cache->mapped);
+  length = g_mapped_file_get_length (cache->mapped);
+  header = (const ThemeCacheHeader *) contents;
+
+  if (length < sizeof (ThemeCacheHeader) ||
+      memcmp (header->magic, THEME_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != THEME_CACHE_VERSION ||
+      header->byte_order != THEME_CACHE_BYTE_ORDER ||
+      header->records_offset % 8 != 0 ||
+      header->values_offset % 4 != 0 ||
+      !region_is_valid (length, header->records_offset, header->n_records, sizeof (ThemeCacheRecord)) ||
+      !region_is_valid (length, header->values_offset, header->n_values, sizeof (guint32)) ||
+      !region_is_valid (length, header->strings_offset, header->strings_size, 1) ||
+      header->strings_size == 0 ||
+      contents[header->strings_offset + header->strings_size - 1] != '\0') {
+    theme_cache_unmap (cache);
+    return FALSE;
+  }
+
+  cache->header = header;
+  cache->records = (const ThemeCacheRecord *) (contents + header->records_offset);
+  cache->values = (const guint32 *) (contents + header->values_offset);
+  cache->strings = contents + header->strings_offset;
+
+  /* readable names are localized */
+  if (g_strcmp0 (cache_string (cache, header->locale), cache->locale) != 0) {
+    theme_cache_unmap (cache);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gint
+record_compare (MateThemeCache         *cache,
+                const ThemeCacheRecord *record,
+                MateThemeType           type,
+                const gchar            *common_theme_dir)
+{
+  const gchar *record_dir;
+
+  if (record->type != type)
+    return record->type < type ? -1 : 1;
+
+  record_dir = cache_string (cache, record->common_theme_dir);
+
+  return strcmp (record_dir ? record_dir : "", common_theme_dir);
+}
+
+static const ThemeCacheRecord *
+find_record (MateThemeCache *cache,
+             MateThemeType   type,
+             const gchar    *common_theme_dir)
+{
+  const ThemeCacheRecord *record;
+  guint lo, hi;
+
+  if (cache->header == NULL)
+    return NULL;
+
+  lo = 0;
+  hi = cache->header->n_records;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    gint cmp;
+
+    cmp = record_compare (cache, &cache->records[mid], type, common_theme_dir);
+    if (cmp == 0) {
+      record = &cache->records[mid];
+
+      if ((guint64) record->values + record->n_strings + record->n_ints > cache->header->n_values)
+        return NULL;
+
+      return record;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+entry_matches_record (MateThemeCache        *cache,
+                      const ThemeCacheEntry *entry)
+{
+  const ThemeCacheRecord *record;
+  const guint32 *values;
+  guint i;
+
+  record = find_record (cache, entry->type, entry->common_theme_dir);
+
+  if (record == NULL ||
+      memcmp (&record->stamp, &entry->stamp, sizeof (MateThemeCacheStamp)) != 0 ||
+      record->present != entry->present ||
+      record->n_strings != entry->strings->len ||
+      record->n_ints != entry->ints->len)
+    return FALSE;
+
+  values = cache->values + record->values;
+
+  for (i = 0; i < record->n_strings; i++) {
+    if (g_strcmp0 (cache_string (cache, values[i]), g_ptr_array_index (entry->strings, i)) != 0)
+      return FALSE;
+  }
+
+  values += record->n_strings;
+
+  for (i = 0; i < record->n_ints; i++) {
+    if (values[i] != g_array_index (entry->ints, guint32, i))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+MateThemeCache *
+mate_theme_cache_new (const gchar *filename)
+{
+  MateThemeCache *cache;
+
+  cache = g_new0 (MateThemeCache, 1);
+  cache->filename = g_strdup (filename);
+  cache->locale = g_strjoinv (":", (gchar **) g_get_language_names ());
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) theme_cache_entry_free);
+
+  /* a missing or unusable cache has to be written out */
+  cache->dirty = !theme_cache_map (cache);
+
+  return cache;
+}
+
+void
+mate_theme_cache_free (MateThemeCache *cache)
+{
+  theme_cache_unmap (cache);
+  g_hash_table_destroy (cache->entries);
+  g_free (cache->locale);
+  g_free (cache->filename);
+  g_free (cache);
+}
+
+/* Look up what was recorded for common_theme_dir.  Returns TRUE if the
+ * record is still valid for stamp; theme_info is then set to a newly
+ * allocated theme, or to NULL if the directory holds no theme of that type.
+ * This only reads the mapped file and may be called from any thread.
+ */
+gboolean
+mate_theme_cache_lookup (MateThemeCache             *cache,
+                         MateThemeType               type,
+                         const gchar                *common_theme_dir,
+                         const MateThemeCacheStamp  *stamp,
+                         MateThemeCommonInfo       **theme_info)
+{
+  const ThemeCacheRecord *record;
+  const guint32 *values;
+  MateThemeCommonInfo *info;
+  guint i;
+
+  record = find_record (cache, type, common_theme_dir);
+
+  if (record == NULL ||
+      memcmp (&record->stamp, stamp, sizeof (MateThemeCacheStamp)) != 0)
+    return FALSE;
+
+  if (!record->present) {
+    *theme_info = NULL;
+    return TRUE;
+  }
+
+  if (record->n_strings != n_string_fields (type) || record->n_ints < 1)
+    return FALSE;
+
+  values = cache->values + record->values;
+
+  switch (type) {
+  case MATE_THEME_TYPE_METATHEME:
+    if (record->n_ints != 2)
+      return FALSE;
+    info = (MateThemeCommonInfo *) mate_theme_meta_info_new ();
+    ((MateThemeMetaInfo *) info)->cursor_size = values[record->n_strings + 1];
+    break;
+  case MATE_THEME_TYPE_ICON:
+    if (record->n_ints != 1)
+      return FALSE;
+    info = (MateThemeCommonInfo *) mate_theme_icon_info_new ();
+    break;
+  case MATE_THEME_TYPE_CURSOR:
+    info = (MateThemeCommonInfo *) mate_theme_cursor_info_new ();
+    ((MateThemeCursorInfo *) info)->sizes = g_array_sized_new (FALSE, FALSE, sizeof (gint),
+                                                               record->n_ints - 1);
+    for (i = 1; i < record->n_ints; i++) {
+      gint size = values[record->n_strings + i];
+      g_array_append_val (((MateThemeCursorInfo *) info)->sizes, size);
+    }
+    break;
+  default:
+    return FALSE;
+  }
+
+  for (i = 0; i < record->n_strings; i++)
+    *string_field (info, i) = g_strdup (cache_string (cache, values[i]));
+
+  info->hidden = values[record->n_strings] != 0;
+
+  if (info->path == NULL || info->name == NULL) {
+    /* damaged record, reread the theme */
+    switch (type) {
+    case MATE_THEME_TYPE_METATHEME:
+      mate_theme_meta_info_free ((MateThemeMetaInfo *) info);
+      break;
+    case MATE_THEME_TYPE_ICON:
+      mate_theme_icon_info_free ((MateThemeIconInfo *) info);
+      break;
+    default:
+      mate_theme_cursor_info_free ((MateThemeCursorInfo *) info);
+      break;
+    }
+    return FALSE;
+  }
+
+  *theme_info = info;
+  return TRUE;
+}
+
+/* Remember what common_theme_dir looked like when stamp was taken; theme_info
+ * is NULL if it holds no theme of that type.  Must be called from the thread
+ * that owns the cache.
+ */
+void
+mate_theme_cache_update (MateThemeCache            *cache,
+                         MateThemeType              type,
+                         const gchar               *common_theme_dir,
+                         const MateThemeCacheStamp *stamp,
+                         const MateThemeCommonInfo *theme_info)
+{
+  ThemeCacheEntry *entry;
+  guint32 value;
+  guint i;
+
+  entry = g_slice_new0 (ThemeCacheEntry);
+  entry->type = type;
+  entry->common_theme_dir = g_strdup (common_theme_dir);
+  entry->stamp = *stamp;
+  entry->present = theme_info != NULL;
+  entry->strings = g_ptr_array_new_with_free_func (g_free);
+  entry->ints = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  if (theme_info != NULL) {
+    MateThemeCommonInfo *info = (MateThemeCommonInfo *) theme_info;
+
+    for (i = 0; i < n_string_fields (type); i++)
+      g_ptr_array_add (entry->strings, g_strdup (*string_field (info, i)));
+
+    value = info->hidden ? 1 : 0;
+    g_array_append_val (entry->ints, value);
+
+    if (type == MATE_THEME_TYPE_METATHEME) {
+      value = ((MateThemeMetaInfo *) info)->cursor_size;
+      g_array_append_val (entry->ints, value);
+    } else if (type == MATE_THEME_TYPE_CURSOR) {
+      GArray *sizes = ((MateThemeCursorInfo *) info)->sizes;
+
+      for (i = 0; i < sizes->len; i++) {
+        value = g_array_index (sizes, gint, i);
+        g_array_append_val (entry->ints, value);
+      }
+    }
+  }
+
+  if (!cache->dirty && !entry_matches_record (cache, entry))
+    cache->dirty = TRUE;
+
+  g_hash_table_replace (cache->entries, entry_key (type, common_theme_dir), entry);
+}
+
+static gint
+entry_compare (ThemeCacheEntry **a,
+               ThemeCacheEntry **b)
+{
+  if ((*a)->type != (*b)->type)
+    return (*a)->type < (*b)->type ? -1 : 1;
+
+  return strcmp ((*a)->common_theme_dir, (*b)->common_theme_dir);
+}
+
+static guint32
+add_string (GString     *strings,
+            GHashTable  *offsets,
+            const gchar *str)
+{
+  gpointer offset;
+
+  if (str == NULL)
+    return THEME_CACHE_NO_STRING;
+
+  if (g_hash_table_lookup_extended (offsets, str, NULL, &offset))
+    return GPOINTER_TO_UINT (offset);
+
+  offset = GUINT_TO_POINTER (strings->len);
+  g_string_append_len (strings, str, strlen (str) + 1);
+  g_hash_table_insert (offsets, (gpointer) str, offset);
+
+  return GPOINTER_TO_UINT (offset);
+}
+
+/* Write the themes seen in this session to disk, if anything changed since
+ * the cache was loaded.  Directories which were not looked at in this
+ * session are dropped.
+ */
+gboolean
+mate_theme_cache_save (MateThemeCache  *cache,
+                       GError         **error)
+{
+  ThemeCacheHeader header;
+  GPtrArray *sorted;
+  GArray *records;
+  GArray *values;
+  GString *strings;
+  GString *contents;
+  GHashTable *offsets;
+  GHashTableIter iter;
+  gpointer entry;
+  gchar *dirname;
+  gboolean retval;
+  guint i, j;
+
+  if (!cache->dirty && cache->header != NULL &&
+      cache->header->n_records == g_hash_table_size (cache->entries))
+    return TRUE;
+
+  sorted = g_ptr_array_sized_new (g_hash_table_size (cache->entries));
+  g_hash_table_iter_init (&iter, cache->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &entry))
+    g_ptr_array_add (sorted, entry);
+  g_ptr_array_sort (sorted, (GCompareFunc) entry_compare);
+
+  records = g_array_sized_new (FALSE, TRUE, sizeof (ThemeCacheRecord), sorted->len);
+  values = g_array_new (FALSE, FALSE, sizeof (guint32));
+  strings = g_string_new (NULL);
+  offsets = g_hash_table_new (g_str_hash, g_str_equal);
+
+  memset (&header, 0, sizeof (ThemeCacheHeader));
+  memcpy (header.magic, THEME_CACHE_MAGIC, sizeof (header.magic));
+  header.version = THEME_CACHE_VERSION;
+  header.byte_order = THEME_CACHE_BYTE_ORDER;
+  header.locale = add_string (strings, offsets, cache->locale);
+
+  for (i = 0; i < sorted->len; i++) {
+    ThemeCacheEntry *e = g_ptr_array_index (sorted, i);
+    ThemeCacheRecord record;
+
+    memset (&record, 0, sizeof (ThemeCacheRecord));
+    record.type = e->type;
+    record.common_theme_dir = add_string (strings, offsets, e->common_theme_dir);
+    record.stamp = e->stamp;
+    record.present = e->present;
+    record.n_strings = e->strings->len;
+    record.n_ints = e->ints->len;
+    record.values = values->len;
+
+    for (j = 0; j < e->strings->len; j++) {
+      guint32 offset = add_string (strings, offsets, g_ptr_array_index (e->strings, j));
+      g_array_append_val (values, offset);
+    }
+    g_array_append_vals (values, e->ints->data, e->ints->len);
+
+    g_array_append_val (records, record);
+  }
+
+  header.n_records = records->len;
+  header.records_offset = sizeof (ThemeCacheHeader);
+  header.n_values = values->len;
+  header.values_offset = header.records_offset + records->len * sizeof (ThemeCacheRecord);
+  header.strings_size = strings->len;
+  header.strings_offset = header.values_offset + values->len * sizeof (guint32);
+
+  contents = g_string_sized_new (header.strings_offset + header.strings_size);
+  g_string_append_len (contents, (const gchar *) &header, sizeof (ThemeCacheHeader));
+  g_string_append_len (contents, records->data, records->len * sizeof (ThemeCacheRecord));
+  g_string_append_len (contents, values->data, values->len * sizeof (guint32));
+  g_string_append_len (contents, strings->str, strings->len);
+
+  g_hash_table_destroy (offsets);
+  g_string_free (strings, TRUE);
+  g_array_free (values, TRUE);
+  g_array_free (records, TRUE);
+  g_ptr_array_free (sorted, TRUE);
+
+  dirname = g_path_get_dirname (cache->filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  /* g_file_set_contents renames over the old file, so a mapping of it that
+   * is still in use stays intact */
+  retval = g_file_set_contents (cache->filename, contents->str, contents->len, error);
+  g_string_free (contents, TRUE);
+
+  if (retval) {
+    cache->dirty = FALSE;
+    theme_cache_map (cache);
+  }
+
+  return retval;
+}
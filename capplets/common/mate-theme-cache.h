@@ -0,0 +1,59 @@
+/* mate-theme-cache.h - On-disk index of parsed MATE themes
+ *
+ * This file is part of the Mate Library.
+ *
+ * The Mate Library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * The Mate Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with the Mate Library; see the file COPYING.LIB.  If not,
+ * write to the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef MATE_THEME_CACHE_H
+#define MATE_THEME_CACHE_H
+
+#include <glib.h>
+#include "mate-theme-info.h"
+
+typedef struct _MateThemeCache MateThemeCache;
+
+/* What a cached record was built from.  A record is only reused when the
+ * stamp taken from the filesystem now is identical to the stored one.
+ */
+typedef struct {
+	guint64 dir_mtime;
+	guint64 dir_inode;
+	guint64 index_mtime;
+	guint64 index_size;
+	guint64 aux_mtime;
+} MateThemeCacheStamp;
+
+void            mate_theme_cache_stamp_init (MateThemeCacheStamp       *stamp,
+                                             MateThemeType              type,
+                                             const gchar               *common_theme_dir);
+
+MateThemeCache *mate_theme_cache_new        (const gchar               *filename);
+void            mate_theme_cache_free       (MateThemeCache            *cache);
+gboolean        mate_theme_cache_lookup     (MateThemeCache            *cache,
+                                             MateThemeType              type,
+                                             const gchar               *common_theme_dir,
+                                             const MateThemeCacheStamp *stamp,
+                                             MateThemeCommonInfo      **theme_info);
+void            mate_theme_cache_update     (MateThemeCache            *cache,
+                                             MateThemeType              type,
+                                             const gchar               *common_theme_dir,
+                                             const MateThemeCacheStamp *stamp,
+                                             const MateThemeCommonInfo *theme_info);
+gboolean        mate_theme_cache_save       (MateThemeCache            *cache,
+                                             GError                   **error);
+
+#endif /* MATE_THEME_CACHE_H */
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gmodule.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
@@ -37,7 +38,9 @@
 #include <string.h>
 #include <libmate-desktop/mate-desktop-item.h>
 #include "mate-theme-info.h"
+#include "mate-theme-cache.h"
 #include "gtkrc-utils.h"
+#include "capplet-util.h"
 
 #ifdef HAVE_XCURSOR
 	#include <X11/Xcursor/Xcursor.h>
@@ -120,6 +123,10 @@ static GHashTable* theme_hash_by_uri;
 static GHashTable* theme_hash_by_name;
 static gboolean initting = FALSE;
 
+/* Parsed themes from previous runs, see mate-theme-cache.c */
+static MateThemeCache* theme_cache = NULL;
+static guint theme_cache_save_id = 0;
+
 /* private functions */
 static gint safe_strcmp(const gchar* a_str, const gchar* b_str)
 {
@@ -538,44 +545,165 @@ gdk_pixbuf_from_xcursor_image (XcursorImage *cursor)
   return pixbuf;
 }
 
+static const gint cursor_filter_sizes[] = { 12, 16, 24, 32, 36, 40, 48, 64 };
+
+/* See Xcursor(3) for the file format */
+#define XCURSOR_FILE_MAGIC "Xcur"
+#define XCURSOR_FILE_MAX_TOC 0x10000
+#define XCURSOR_IMAGE_TYPE 0xfffd0002
+
+/* Returns which of cursor_filter_sizes an Xcursor file has images for,
+ * without decoding any of them, or NULL if it isn't an Xcursor file.
+ */
+static GArray *
+read_xcursor_sizes (const gchar *filename)
+{
+  FILE *file;
+  guint32 header[4];
+  guint32 *toc = NULL;
+  guint32 ntoc, i;
+  gboolean found[G_N_ELEMENTS (cursor_filter_sizes)] = { FALSE };
+  GArray *sizes = NULL;
+  guint j;
+
+  file = g_fopen (filename, "rb");
+  if (file == NULL)
+    return NULL;
+
+  /* magic, header size, file version, number of toc entries */
+  if (fread (header, sizeof (guint32), 4, file) != 4 ||
+      memcmp (header, XCURSOR_FILE_MAGIC, 4) != 0)
+    goto out;
+
+  ntoc = GUINT32_FROM_LE (header[3]);
+  if (ntoc > XCURSOR_FILE_MAX_TOC ||
+      fseek (file, GUINT32_FROM_LE (header[1]), SEEK_SET) != 0)
+    goto out;
+
+  /* each entry is type, subtype (the nominal size for images), position */
+  toc = g_new (guint32, ntoc * 3);
+  if (fread (toc, sizeof (guint32) * 3, ntoc, file) != ntoc)
+    goto out;
+
+  for (i = 0; i < ntoc; ++i) {
+    if (GUINT32_FROM_LE (toc[i * 3]) != XCURSOR_IMAGE_TYPE)
+      continue;
+
+    for (j = 0; j < G_N_ELEMENTS (cursor_filter_sizes); ++j) {
+      if (GUINT32_FROM_LE (toc[i * 3 + 1]) == cursor_filter_sizes[j])
+        found[j] = TRUE;
+    }
+  }
+
+  sizes = g_array_sized_new (FALSE, FALSE, sizeof (gint), G_N_ELEMENTS (cursor_filter_sizes));
+  for (j = 0; j < G_N_ELEMENTS (cursor_filter_sizes); ++j) {
+    if (found[j])
+      g_array_append_val (sizes, cursor_filter_sizes[j]);
+  }
+
+out:
+  g_free (toc);
+  fclose (file);
+
+  return sizes;
+}
+
+/* For themes that take left_ptr from a theme they inherit from; this has
+ * Xcursor look the cursor up and decode it at every size.
+ */
+static GArray *
+probe_xcursor_sizes (const gchar *name)
+{
+  GArray *sizes;
+  XcursorImage *cursor;
+  guint i;
+
+  sizes = g_array_sized_new (FALSE, FALSE, sizeof (gint), G_N_ELEMENTS (cursor_filter_sizes));
+
+  for (i = 0; i < G_N_ELEMENTS (cursor_filter_sizes); ++i) {
+    cursor = XcursorLibraryLoadImage ("left_ptr", name, cursor_filter_sizes[i]);
+
+    if (cursor) {
+      if (cursor->size == cursor_filter_sizes[i])
+        g_array_append_val (sizes, cursor_filter_sizes[i]);
+
+      XcursorImageDestroy (cursor);
+    }
+  }
+
+  return sizes;
+}
+
+/* The thumbnail is the smallest size above the tiny first one, if the
+ * theme has any.
+ */
+static GdkPixbuf *
+load_cursor_thumbnail (const gchar *name,
+                       GArray      *sizes)
+{
+  XcursorImage *cursor;
+  GdkPixbuf *thumbnail = NULL;
+  gint size;
+  guint i;
+
+  if (sizes == NULL || sizes->len == 0)
+    return NULL;
+
+  size = g_array_index (sizes, gint, 0);
+  for (i = 0; i < sizes->len; ++i) {
+    if (g_array_index (sizes, gint, i) != cursor_filter_sizes[0]) {
+      size = g_array_index (sizes, gint, i);
+      break;
+    }
+  }
+
+  cursor = XcursorLibraryLoadImage ("left_ptr", name, size);
+  if (cursor) {
+    thumbnail = gdk_pixbuf_from_xcursor_image (cursor);
+    XcursorImageDestroy (cursor);
+  }
+
+  return thumbnail;
+}
+
 static MateThemeCursorInfo *
 read_cursor_theme (GFile *cursor_theme_uri)
 {
   MateThemeCursorInfo *cursor_theme_info = NULL;
   GFile *parent_uri, *cursors_uri;
 
-  const gint filter_sizes[] = { 12, 16, 24, 32, 36, 40, 48, 64 };
-  const gint num_sizes = G_N_ELEMENTS (filter_sizes);
-
   parent_uri = g_file_get_parent (cursor_theme_uri);
   cursors_uri = g_file_get_child (parent_uri, "cursors");
 
   if (get_file_type (cursors_uri) == G_FILE_TYPE_DIRECTORY) {
     GArray *sizes;
-    XcursorImage *cursor;
-    GdkPixbuf *thumbnail = NULL;
     gchar *name;
-    gint i;
+    gchar *cursors_dir;
+    gchar *left_ptr;
 
     name = g_file_get_basename (parent_uri);
 
-    sizes = g_array_sized_new (FALSE, FALSE, sizeof (gint), num_sizes);
-
-    for (i = 0; i < num_sizes; ++i) {
-      cursor = XcursorLibraryLoadImage ("left_ptr", name, filter_sizes[i]);
+    cursors_dir = g_file_get_path (cursors_uri);
+    left_ptr = g_build_filename (cursors_dir, "left_ptr", NULL);
+    sizes = read_xcursor_sizes (left_ptr);
+    g_free (left_ptr);
+    g_free (cursors_dir);
 
-      if (cursor) {
-        if (cursor->size == filter_sizes[i]) {
-          g_array_append_val (sizes, filter_sizes[i]);
-
-          if (thumbnail == NULL && i >= 1)
-            thumbnail = gdk_pixbuf_from_xcursor_image (cursor);
-        }
+    /* Xcursor must still be able to resolve the theme by name, which
+     * reading the file directly doesn't tell us; one image is enough */
+    if (sizes != NULL && sizes->len > 0) {
+      XcursorImage *cursor;
 
+      cursor = XcursorLibraryLoadImage ("left_ptr", name, g_array_index (sizes, gint, 0));
+      if (cursor)
         XcursorImageDestroy (cursor);
-      }
+      else
+        g_array_set_size (sizes, 0);
     }
 
+    if (sizes == NULL)
+      sizes = probe_xcursor_sizes (name);
+
     if (sizes->len == 0) {
       g_array_free (sizes, TRUE);
       g_free (name);
@@ -583,20 +711,11 @@ read_cursor_theme (GFile *cursor_theme_uri)
       MateDesktopItem *cursor_theme_ditem;
       gchar *cursor_theme_file;
 
-      if (!thumbnail) {
-        cursor = XcursorLibraryLoadImage ("left_ptr", name,
-                                          g_array_index (sizes, gint, 0));
-        if (cursor) {
-          thumbnail = gdk_pixbuf_from_xcursor_image (cursor);
-          XcursorImageDestroy (cursor);
-        }
-      }
-
+      /* the thumbnail is loaded by mate_theme_cursor_info_get_thumbnail */
       cursor_theme_info = mate_theme_cursor_info_new ();
       cursor_theme_info->path = g_file_get_path (parent_uri);
       cursor_theme_info->name = name;
       cursor_theme_info->sizes = sizes;
-      cursor_theme_info->thumbnail = thumbnail;
 
       cursor_theme_file = g_file_get_path (cursor_theme_uri);
       cursor_theme_ditem = mate_desktop_item_new_from_file (cursor_theme_file, 0, NULL);
@@ -801,21 +920,17 @@ handle_change_signal (gpointer             data,
 
 /* index_uri should point to the gtkrc file that was modified */
 static void
-update_theme_index (GFile            *index_uri,
-                    MateThemeElement key_element,
-                    gint              priority)
+apply_theme_index (GFile            *index_uri,
+                   MateThemeElement key_element,
+                   gint              priority,
+                   gboolean          theme_exists)
 {
-  gboolean theme_exists;
   MateThemeInfo *theme_info;
   GFile *parent;
   GFile *common_theme_dir_uri;
   gchar *common_theme_dir;
 
-  /* First, we determine the new state of the file.  We do no more
-   * sophisticated a test than "files exists and is a file" */
-  theme_exists = (get_file_type (index_uri) == G_FILE_TYPE_REGULAR);
-
-  /* Next, we see what currently exists */
+  /* See what currently exists */
   parent = g_file_get_parent (index_uri);
   common_theme_dir_uri = g_file_get_parent (parent);
   common_theme_dir = g_file_get_path (common_theme_dir_uri);
@@ -876,6 +991,16 @@ update_theme_index (GFile            *index_uri,
   g_object_unref (common_theme_dir_uri);
 }
 
+static void
+update_theme_index (GFile            *index_uri,
+                    MateThemeElement key_element,
+                    gint              priority)
+{
+  /* We do no more sophisticated a test than "files exists and is a file" */
+  apply_theme_index (index_uri, key_element, priority,
+                     get_file_type (index_uri) == G_FILE_TYPE_REGULAR);
+}
+
 static void
 update_gtk2_index (GFile *gtk2_index_uri,
                    gint   priority)
@@ -898,28 +1023,38 @@ update_marco_index (GFile *marco_index_uri,
 }
 
 static void
-update_common_theme_dir_index (GFile         *theme_index_uri,
-                               MateThemeType type,
-                               gint           priority)
+save_theme_cache (void)
 {
-  gboolean theme_exists;
-  MateThemeCommonInfo *theme_info = NULL;
-  MateThemeCommonInfo *old_theme_info;
-  GFile *common_theme_dir_uri;
-  gchar *common_theme_dir;
-  GHashTable *hash_by_uri;
-  GHashTable *hash_by_name;
+  GError *error = NULL;
 
-  if (type == MATE_THEME_TYPE_ICON) {
-    hash_by_uri = icon_theme_hash_by_uri;
-    hash_by_name = icon_theme_hash_by_name;
-  } else if (type == MATE_THEME_TYPE_CURSOR) {
-    hash_by_uri = cursor_theme_hash_by_uri;
-    hash_by_name = cursor_theme_hash_by_name;
-  } else {
-    hash_by_uri = meta_theme_hash_by_uri;
-    hash_by_name = meta_theme_hash_by_name;
+  if (!mate_theme_cache_save (theme_cache, &error)) {
+    g_warning ("Could not write the theme cache: %s", error->message);
+    g_error_free (error);
   }
+}
+
+static gboolean
+save_theme_cache_timeout (gpointer data)
+{
+  theme_cache_save_id = 0;
+  save_theme_cache ();
+
+  return FALSE;
+}
+
+static void
+schedule_theme_cache_save (void)
+{
+  /* theme packages change many dirs at once, write them out together */
+  if (theme_cache_save_id == 0)
+    theme_cache_save_id = g_timeout_add_seconds (2, save_theme_cache_timeout, NULL);
+}
+
+static MateThemeCommonInfo *
+read_common_theme (GFile         *theme_index_uri,
+                   MateThemeType  type)
+{
+  MateThemeCommonInfo *theme_info = NULL;
 
   if (type != MATE_THEME_TYPE_CURSOR) {
     /* First, we determine the new state of the file. */
@@ -929,10 +1064,7 @@ update_common_theme_dir_index (GFile         *theme_index_uri,
         theme_info = (MateThemeCommonInfo *) read_icon_theme (theme_index_uri);
       else
         theme_info = (MateThemeCommonInfo *) mate_theme_read_meta_theme (theme_index_uri);
-    } else {
-      theme_info = NULL;
     }
-
   }
 #ifdef HAVE_XCURSOR
   /* cursor themes don't necessarily have an index file, so try those in any case */
@@ -941,6 +1073,68 @@ update_common_theme_dir_index (GFile         *theme_index_uri,
   }
 #endif
 
+  return theme_info;
+}
+
+/* What was read for one common_theme_dir; see read_common_theme_dir_index */
+typedef struct {
+  MateThemeType type;
+  gchar *common_theme_dir;
+  MateThemeCacheStamp stamp;
+  MateThemeCommonInfo *theme_info;
+} CommonThemeDirIndex;
+
+/* Doesn't touch any of the hashes, so it can be run from a scan thread */
+static void
+read_common_theme_dir_index (CommonThemeDirIndex *index,
+                             GFile               *theme_index_uri,
+                             MateThemeType        type)
+{
+  GFile *common_theme_dir_uri;
+
+  index->type = type;
+  index->theme_info = NULL;
+
+  common_theme_dir_uri = g_file_get_parent (theme_index_uri);
+  index->common_theme_dir = g_file_get_path (common_theme_dir_uri);
+  g_object_unref (common_theme_dir_uri);
+
+  /* The cache is only trusted while populating the hashes; a monitor
+   * event means something really changed, so reread the theme. */
+  mate_theme_cache_stamp_init (&index->stamp, type, index->common_theme_dir);
+
+  if (!initting ||
+      !mate_theme_cache_lookup (theme_cache, type, index->common_theme_dir, &index->stamp, &index->theme_info))
+    index->theme_info = read_common_theme (theme_index_uri, type);
+}
+
+static void
+apply_common_theme_dir_index (CommonThemeDirIndex *index,
+                              gint                 priority)
+{
+  gboolean theme_exists;
+  MateThemeCommonInfo *theme_info = index->theme_info;
+  MateThemeCommonInfo *old_theme_info;
+  const gchar *common_theme_dir = index->common_theme_dir;
+  GHashTable *hash_by_uri;
+  GHashTable *hash_by_name;
+
+  if (index->type == MATE_THEME_TYPE_ICON) {
+    hash_by_uri = icon_theme_hash_by_uri;
+    hash_by_name = icon_theme_hash_by_name;
+  } else if (index->type == MATE_THEME_TYPE_CURSOR) {
+    hash_by_uri = cursor_theme_hash_by_uri;
+    hash_by_name = cursor_theme_hash_by_name;
+  } else {
+    hash_by_uri = meta_theme_hash_by_uri;
+    hash_by_name = meta_theme_hash_by_name;
+  }
+
+  mate_theme_cache_update (theme_cache, index->type, common_theme_dir, &index->stamp, theme_info);
+
+  if (!initting)
+    schedule_theme_cache_save ();
+
   if (theme_info) {
     theme_info->priority = priority;
     theme_exists = TRUE;
@@ -949,10 +1143,6 @@ update_common_theme_dir_index (GFile         *theme_index_uri,
   }
 
   /* Next, we see what currently exists */
-  common_theme_dir_uri = g_file_get_parent (theme_index_uri);
-  common_theme_dir = g_file_get_path (common_theme_dir_uri);
-  g_object_unref (common_theme_dir_uri);
-
   old_theme_info = (MateThemeCommonInfo *) g_hash_table_lookup (hash_by_uri, common_theme_dir);
 
   if (old_theme_info == NULL) {
@@ -983,7 +1173,20 @@ update_common_theme_dir_index (GFile         *theme_index_uri,
     }
   }
 
-  g_free (common_theme_dir);
+  g_free (index->common_theme_dir);
+  index->common_theme_dir = NULL;
+  index->theme_info = NULL;
+}
+
+static void
+update_common_theme_dir_index (GFile         *theme_index_uri,
+                               MateThemeType type,
+                               gint           priority)
+{
+  CommonThemeDirIndex index;
+
+  read_common_theme_dir_index (&index, theme_index_uri, type);
+  apply_common_theme_dir_index (&index, priority);
 }
 
 static void
@@ -1118,18 +1321,165 @@ common_icon_theme_dir_changed (GFileMonitor                  *monitor,
   g_free (affected_file);
 }
 
+/* Everything read from one dir below a top theme dir.  While initting,
+ * this is filled in by theme_scan_pool and merged into the hashes by
+ * finish_theme_dir_scans, in the order the dirs were found.
+ */
+typedef struct {
+  GFile *theme_dir_uri;
+  gboolean icon_theme;
+  gint priority;
+
+  CommonThemeDirIndex index;
+  CommonThemeDirIndex cursor_index;
+  GFile *gtk2_index_uri;
+  GFile *keybinding_index_uri;
+  GFile *marco_index_uri;
+} ThemeDirScan;
+
+static GThreadPool *theme_scan_pool = NULL;
+static GPtrArray *theme_scans = NULL;
+
+static GFile *
+get_regular_file (GFile       *theme_dir_uri,
+                  const gchar *subdir,
+                  const gchar *name)
+{
+  GFile *parent, *file;
+
+  parent = g_file_get_child (theme_dir_uri, subdir);
+  file = g_file_get_child (parent, name);
+  g_object_unref (parent);
+
+  if (get_file_type (file) != G_FILE_TYPE_REGULAR) {
+    g_object_unref (file);
+    return NULL;
+  }
+
+  return file;
+}
+
+static void
+read_theme_dir (ThemeDirScan *scan,
+                gpointer      user_data)
+{
+  GFile *index_uri;
+
+  index_uri = g_file_get_child (scan->theme_dir_uri, "index.theme");
+
+  if (scan->icon_theme) {
+    read_common_theme_dir_index (&scan->index, index_uri, MATE_THEME_TYPE_ICON);
+#ifdef HAVE_XCURSOR
+    read_common_theme_dir_index (&scan->cursor_index, index_uri, MATE_THEME_TYPE_CURSOR);
+#endif
+  } else {
+    read_common_theme_dir_index (&scan->index, index_uri, MATE_THEME_TYPE_METATHEME);
+
+    scan->gtk2_index_uri = get_regular_file (scan->theme_dir_uri, "gtk-2.0", "gtkrc");
+    scan->keybinding_index_uri = get_regular_file (scan->theme_dir_uri, "gtk-2.0-key", "gtkrc");
+    scan->marco_index_uri = get_regular_file (scan->theme_dir_uri, "metacity-1", "metacity-theme-2.xml");
+    if (scan->marco_index_uri == NULL)
+      scan->marco_index_uri = get_regular_file (scan->theme_dir_uri, "metacity-1", "metacity-theme-1.xml");
+  }
+
+  g_object_unref (index_uri);
+}
+
+static void
+apply_theme_dir (ThemeDirScan *scan)
+{
+  if (scan->icon_theme) {
+    apply_common_theme_dir_index (&scan->index, scan->priority);
+#ifdef HAVE_XCURSOR
+    apply_common_theme_dir_index (&scan->cursor_index, scan->priority);
+#endif
+  } else {
+    apply_common_theme_dir_index (&scan->index, scan->priority);
+
+    if (scan->gtk2_index_uri != NULL)
+      apply_theme_index (scan->gtk2_index_uri, MATE_THEME_GTK_2, scan->priority, TRUE);
+    if (scan->keybinding_index_uri != NULL)
+      apply_theme_index (scan->keybinding_index_uri, MATE_THEME_GTK_2_KEYBINDING, scan->priority, TRUE);
+    if (scan->marco_index_uri != NULL)
+      apply_theme_index (scan->marco_index_uri, MATE_THEME_MARCO, scan->priority, TRUE);
+  }
+}
+
+static void
+theme_dir_scan_free (ThemeDirScan *scan)
+{
+  g_object_unref (scan->theme_dir_uri);
+  if (scan->gtk2_index_uri != NULL)
+    g_object_unref (scan->gtk2_index_uri);
+  if (scan->keybinding_index_uri != NULL)
+    g_object_unref (scan->keybinding_index_uri);
+  if (scan->marco_index_uri != NULL)
+    g_object_unref (scan->marco_index_uri);
+  g_free (scan);
+}
+
+static void
+update_theme_dir (GFile    *theme_dir_uri,
+                  gboolean  icon_theme,
+                  gint      priority)
+{
+  ThemeDirScan *scan;
+
+  scan = g_new0 (ThemeDirScan, 1);
+  scan->theme_dir_uri = g_object_ref (theme_dir_uri);
+  scan->icon_theme = icon_theme;
+  scan->priority = priority;
+
+  if (theme_scan_pool != NULL) {
+    g_ptr_array_add (theme_scans, scan);
+    g_thread_pool_push (theme_scan_pool, scan, NULL);
+  } else {
+    read_theme_dir (scan, NULL);
+    apply_theme_dir (scan);
+    theme_dir_scan_free (scan);
+  }
+}
+
+static void
+start_theme_dir_scans (void)
+{
+  theme_scans = g_ptr_array_new ();
+  theme_scan_pool = g_thread_pool_new ((GFunc) read_theme_dir, NULL,
+                                       g_get_num_processors (), FALSE, NULL);
+}
+
+static void
+finish_theme_dir_scans (void)
+{
+  guint i;
+
+  if (theme_scan_pool != NULL) {
+    /* waits for all the dirs to be read */
+    g_thread_pool_free (theme_scan_pool, FALSE, TRUE);
+    theme_scan_pool = NULL;
+  }
+
+  for (i = 0; i < theme_scans->len; i++) {
+    ThemeDirScan *scan = g_ptr_array_index (theme_scans, i);
+
+    apply_theme_dir (scan);
+    theme_dir_scan_free (scan);
+  }
+
+  g_ptr_array_free (theme_scans, TRUE);
+  theme_scans = NULL;
+}
+
 /* Add a monitor to a common_theme_dir. */
 static gboolean
 add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
                               CommonThemeDirMonitorData  *monitor_data,
                               GError                    **error)
 {
-  GFile *uri, *subdir;
+  GFile *subdir;
   GFileMonitor *monitor;
 
-  uri = g_file_get_child (theme_dir_uri, "index.theme");
-  update_meta_theme_index (uri, monitor_data->priority);
-  g_object_unref (uri);
+  update_theme_dir (theme_dir_uri, FALSE, monitor_data->priority);
 
   /* Add the handle for this directory */
   monitor = g_file_monitor_file (theme_dir_uri, G_FILE_MONITOR_NONE, NULL, NULL);
@@ -1144,11 +1494,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* gtk-2 theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "gtk-2.0");
-  uri = g_file_get_child (subdir, "gtkrc");
-  if (g_file_query_exists (uri, NULL)) {
-    update_gtk2_index (uri, monitor_data->priority);
-  }
-  g_object_unref (uri);
 
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
@@ -1160,11 +1505,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* keybinding theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "gtk-2.0-key");
-  uri = g_file_get_child (subdir, "gtkrc");
-  if (g_file_query_exists (uri, NULL)) {
-    update_keybinding_index (uri, monitor_data->priority);
-  }
-  g_object_unref (uri);
 
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
@@ -1176,18 +1516,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* marco theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "metacity-1");
-  uri = g_file_get_child (subdir, "metacity-theme-2.xml");
-  if (g_file_query_exists (uri, NULL)) {
-    update_marco_index (uri, monitor_data->priority);
-  }
-  else {
-    g_object_unref (uri);
-    uri = g_file_get_child (subdir, "metacity-theme-1.xml");
-    if (g_file_query_exists (uri, NULL)) {
-      update_marco_index (uri, monitor_data->priority);
-    }
-  }
-  g_object_unref (uri);
 
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
@@ -1205,15 +1533,11 @@ add_common_icon_theme_dir_monitor (GFile                          *theme_dir_uri
                                    CommonIconThemeDirMonitorData  *monitor_data,
                                    GError                        **error)
 {
-  GFile *index_uri;
   GFileMonitor *monitor;
 
-  /* Add the handle for this directory */
-  index_uri = g_file_get_child (theme_dir_uri, "index.theme");
-  update_icon_theme_index (index_uri, monitor_data->priority);
-  update_cursor_theme_index (index_uri, monitor_data->priority);
-  g_object_unref (index_uri);
+  update_theme_dir (theme_dir_uri, TRUE, monitor_data->priority);
 
+  /* Add the handle for this directory */
   monitor = g_file_monitor_file (theme_dir_uri, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor == NULL)
     return FALSE;
@@ -1639,6 +1963,25 @@ mate_theme_cursor_info_find_all (void)
   return list;
 }
 
+/* The thumbnail is only decoded the first time it is asked for, so that
+ * listing cursor themes doesn't have to load any cursor images.
+ */
+GdkPixbuf *
+mate_theme_cursor_info_get_thumbnail (MateThemeCursorInfo *cursor_theme_info)
+{
+  g_return_val_if_fail (cursor_theme_info != NULL, NULL);
+
+#ifdef HAVE_XCURSOR
+  if (cursor_theme_info->thumbnail == NULL && !cursor_theme_info->thumbnail_loaded) {
+    cursor_theme_info->thumbnail = load_cursor_thumbnail (cursor_theme_info->name,
+                                                          cursor_theme_info->sizes);
+    cursor_theme_info->thumbnail_loaded = TRUE;
+  }
+#endif
+
+  return cursor_theme_info->thumbnail;
+}
+
 gint
 mate_theme_cursor_info_compare (MateThemeCursorInfo *a,
                                  MateThemeCursorInfo *b)
@@ -1898,6 +2241,7 @@ mate_theme_init ()
 {
   GFile *top_theme_dir;
   gchar *top_theme_dir_string;
+  gchar *cache_file;
   static gboolean initted = FALSE;
   gchar **search_path;
   gint i, n;
@@ -1905,8 +2249,14 @@ mate_theme_init ()
   if (initted)
     return;
 
+  capplet_trace_begin ("mate_theme_init");
+
   initting = TRUE;
 
+  cache_file = g_build_filename (g_get_user_cache_dir (), "mate-control-center", "theme-index.cache", NULL);
+  theme_cache = mate_theme_cache_new (cache_file);
+  g_free (cache_file);
+
   meta_theme_hash_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   meta_theme_hash_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   icon_theme_hash_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -1916,6 +2266,9 @@ mate_theme_init ()
   theme_hash_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   theme_hash_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
+  /* The dirs found below the toplevel dirs are read in parallel */
+  start_theme_dir_scans ();
+
   /* Add all the toplevel theme dirs. */
   /* $datadir/themes */
   top_theme_dir_string = gtk_rc_get_theme_dir ();
@@ -1960,6 +2313,8 @@ mate_theme_init ()
   }
 #endif
 
+  finish_theme_dir_scans ();
+
 #ifdef HAVE_XCURSOR
   /* make sure we have the default theme */
   if (!mate_theme_cursor_info_find ("default"))
@@ -1969,7 +2324,11 @@ mate_theme_init ()
   read_cursor_fonts ();
 #endif
 
+  save_theme_cache ();
+
   /* done */
   initted = TRUE;
   initting = FALSE;
+
+  capplet_trace_end ("mate_theme_init");
 }
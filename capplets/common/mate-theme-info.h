@@ -85,6 +85,7 @@ struct _MateThemeCursorInfo {
 
 	GArray* sizes;
 	GdkPixbuf* thumbnail;
+	gboolean thumbnail_loaded;
 };
 
 typedef struct _MateThemeMetaInfo MateThemeMetaInfo;
@@ -163,6 +164,7 @@ MateThemeCursorInfo *mate_theme_cursor_info_new	   (void);
 void                  mate_theme_cursor_info_free	   (MateThemeCursorInfo *info);
 MateThemeCursorInfo *mate_theme_cursor_info_find	   (const gchar          *name);
 GList                *mate_theme_cursor_info_find_all	   (void);
+GdkPixbuf            *mate_theme_cursor_info_get_thumbnail (MateThemeCursorInfo *info);
 gint                  mate_theme_cursor_info_compare      (MateThemeCursorInfo *a,
 							    MateThemeCursorInfo *b);
 
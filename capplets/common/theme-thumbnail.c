@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* memfd_create */
 #include <config.h>
 #include <unistd.h>
 #include <string.h>
@@ -8,85 +9,151 @@
 #include <signal.h>
 #include <errno.h>
 #include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 /* We have to #undef this as marco #defines these. */
 #undef _
 #undef N_
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "theme-thumbnail.h"
 #include "gtkrc-utils.h"
 #include "capplet-util.h"
 
-typedef struct {
-	gboolean set;
-	gint thumbnail_width;
-	gint thumbnail_height;
-	GByteArray* data;
-	gchar* theme_name;
-	ThemeThumbnailFunc func;
-	gpointer user_data;
-	GDestroyNotify destroy;
-	GIOChannel* channel;
-	guint watch_id;
-} ThemeThumbnailAsyncData;
+/* Protocol */
 
+/* Every message is a ThemeThumbnailHeader followed by header.length bytes of
+ * payload, in host byte order, as both ends are the same program.
+ *
+ * The payload of a request is the widget theme, the gtk color scheme, the wm
+ * theme, the icon theme and the application font, in that order, each as a
+ * guint32 length followed by that many bytes.  The capplet may write several
+ * requests at once.
+ *
+ * The factory answers every request with a header carrying the request's id
+ * and a ThemeThumbnailStatus.  With THUMBNAIL_STATUS_OK, the payload is a
+ * ThemeThumbnailSize, and the descriptor of a shared memory file holding the
+ * pixels is passed along (SCM_RIGHTS), so they never go through the socket.
+ *
+ * There are several factories; each of them answers its requests in the order
+ * they were sent, but requests sent to different factories complete in any
+ * order, so the capplet matches the replies to requests by their id.
+ */
 
-static ThemeThumbnailAsyncData async_data;
+#define THUMBNAIL_PROTOCOL_VERSION 1
 
-/* Protocol */
+/* No theme or font name comes close to this */
+#define THUMBNAIL_MAX_PAYLOAD 65536
 
-/* Our protocol is pretty simple.  The parent process will write several strings
- * (separated by a '\000'). They are the widget theme, the wm theme, the icon
- * theme, etc.  Then, it will wait for the child to write back the data.  The
- * parent expects ICON_SIZE_WIDTH * ICON_SIZE_HEIGHT * 4 bytes of information.
- * After that, the child is ready for the next theme to render.
- */
+typedef enum {
+	THUMBNAIL_TYPE_META = 1,
+	THUMBNAIL_TYPE_GTK,
+	THUMBNAIL_TYPE_MARCO,
+	THUMBNAIL_TYPE_ICON
+} ThemeThumbnailType;
 
-enum {
-	READY_FOR_THEME,
-	READING_TYPE,
-	READING_CONTROL_THEME_NAME,
-	READING_GTK_COLOR_SCHEME,
-	READING_WM_THEME_NAME,
-	READING_ICON_THEME_NAME,
-	READING_APPLICATION_FONT,
-	WRITING_PIXBUF_DATA
-};
+typedef enum {
+	THUMBNAIL_STATUS_OK,
+	/* the theme couldn't be loaded */
+	THUMBNAIL_STATUS_NO_THUMBNAIL,
+	/* the request couldn't be parsed */
+	THUMBNAIL_STATUS_BAD_REQUEST,
+	/* the thumbnail couldn't be handed over */
+	THUMBNAIL_STATUS_FAILED
+} ThemeThumbnailStatus;
+
+typedef struct {
+	guint16 version;
+	guint16 type;
+	guint32 id;
+	guint32 status;
+	guint32 length;
+} ThemeThumbnailHeader;
+
+typedef struct {
+	gint32 width;
+	gint32 height;
+	gint32 rowstride;
+} ThemeThumbnailSize;
+
+#define THUMBNAIL_N_STRINGS 5
 
+/* A request, as the factory sees it */
 typedef struct {
-	gint status;
-	GByteArray* type;
-	GByteArray* control_theme_name;
-	GByteArray* gtk_color_scheme;
-	GByteArray* wm_theme_name;
-	GByteArray* icon_theme_name;
-	GByteArray* application_font;
+	guint32 id;
+	guint16 type;
+	gchar* control_theme_name;
+	gchar* gtk_color_scheme;
+	gchar* wm_theme_name;
+	gchar* icon_theme_name;
+	gchar* application_font;
 } ThemeThumbnailData;
 
+/* The factory's end of the connection */
+typedef struct {
+	gint fd;
+	GByteArray* data;
+} ThemeThumbnailCapplet;
+
 typedef struct {
-	gchar* thumbnail_type;
-	gpointer theme_info;
+	guint id;
+	gint priority;
+	/* completes without calling func */
+	gboolean cancelled;
+	ThemeThumbnailType thumbnail_type;
+	gchar* theme_name;
+	gchar* gtk_theme_name;
+	gchar* gtk_color_scheme;
+	gchar* marco_theme_name;
+	gchar* icon_theme_name;
+	gchar* application_font;
+	/* where the thumbnail is cached, if it is */
+	gchar* cache_filename;
 	ThemeThumbnailFunc func;
 	gpointer user_data;
 	GDestroyNotify destroy;
-} ThemeQueueItem;
+} ThemeThumbnailRequest;
+
+/* The capplet's end of one factory process */
+typedef struct {
+	gint fd;
+	GIOChannel* channel;
+	guint watch_id;
+
+	/* replies and shared memory descriptors received so far */
+	GByteArray* data;
+	GQueue fds;
 
-static GList* theme_queue = NULL;
+	/* sent to this factory and not answered yet, oldest first */
+	GList* requests;
+} ThemeThumbnailFactory;
 
-static int pipe_to_factory_fd[2];
-static int pipe_from_factory_fd[2];
+/* How many requests are written to a factory before it answered them, so
+ * that it has the next one at hand as soon as it finished a thumbnail. */
+#define MAX_REQUESTS_PER_FACTORY 2
 
-#define THUMBNAIL_TYPE_META     "meta"
-#define THUMBNAIL_TYPE_GTK      "gtk"
-#define THUMBNAIL_TYPE_MARCO    "marco"
-#define THUMBNAIL_TYPE_ICON     "icon"
+/* The factories are full GTK+ processes with their own X connections */
+#define MAX_FACTORIES 8
+
+static ThemeThumbnailFactory* factories = NULL;
+static guint n_factories = 0;
+
+/* requests which haven't been sent to a factory yet, most urgent first */
+static GQueue theme_queue = G_QUEUE_INIT;
+static guint next_request_id = 1;
 
 #define META_THUMBNAIL_SIZE       128
 #define GTK_THUMBNAIL_SIZE         96
 #define MARCO_THUMBNAIL_WIDTH  120
 #define MARCO_THUMBNAIL_HEIGHT  60
+#define ICON_THUMBNAIL_SIZE        48
 
 /* This draw the thumbnail of gtk
  */
@@ -211,7 +278,7 @@ create_folder_icon (char *icon_theme_name)
   icon_names[i++] = "folder";
   icon_names[i++] = NULL;
 
-  folder_icon_info = gtk_icon_theme_choose_icon (icon_theme, icon_names, 48, GTK_ICON_LOOKUP_FORCE_SIZE);
+  folder_icon_info = gtk_icon_theme_choose_icon (icon_theme, icon_names, ICON_THUMBNAIL_SIZE, GTK_ICON_LOOKUP_FORCE_SIZE);
   if (folder_icon_info != NULL)
   {
     folder_icon = gtk_icon_info_load_icon (folder_icon_info, NULL);
@@ -263,18 +330,18 @@ create_meta_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
   GdkRegion *region;
 
   g_object_set (gtk_settings_get_default (),
-    "gtk-theme-name", (char *) theme_thumbnail_data->control_theme_name->data,
-    "gtk-font-name", (char *) theme_thumbnail_data->application_font->data,
-    "gtk-icon-theme-name", (char *) theme_thumbnail_data->icon_theme_name->data,
-    "gtk-color-scheme", (char *) theme_thumbnail_data->gtk_color_scheme->data,
+    "gtk-theme-name", theme_thumbnail_data->control_theme_name,
+    "gtk-font-name", theme_thumbnail_data->application_font,
+    "gtk-icon-theme-name", theme_thumbnail_data->icon_theme_name,
+    "gtk-color-scheme", theme_thumbnail_data->gtk_color_scheme,
     NULL);
 
-  theme = meta_theme_load ((char *) theme_thumbnail_data->wm_theme_name->data, NULL);
+  theme = meta_theme_load (theme_thumbnail_data->wm_theme_name, NULL);
   if (theme == NULL)
     return NULL;
 
   /* Represent the icon theme */
-  icon = create_folder_icon ((char *) theme_thumbnail_data->icon_theme_name->data);
+  icon = create_folder_icon (theme_thumbnail_data->icon_theme_name);
   icon_width = gdk_pixbuf_get_width (icon);
   icon_height = gdk_pixbuf_get_height (icon);
 
@@ -374,8 +441,8 @@ create_gtk_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
   gint width, height;
 
   settings = gtk_settings_get_default ();
-  g_object_set (settings, "gtk-theme-name", (char *) theme_thumbnail_data->control_theme_name->data,
-			  "gtk-color-scheme", (char *) theme_thumbnail_data->gtk_color_scheme->data,
+  g_object_set (settings, "gtk-theme-name", theme_thumbnail_data->control_theme_name,
+			  "gtk-color-scheme", theme_thumbnail_data->gtk_color_scheme,
  			  NULL);
 
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
@@ -450,7 +517,7 @@ create_marco_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
   GdkPixbuf *pixbuf, *retval;
   GdkRegion *region;
 
-  theme = meta_theme_load ((char *) theme_thumbnail_data->wm_theme_name->data, NULL);
+  theme = meta_theme_load (theme_thumbnail_data->wm_theme_name, NULL);
   if (theme == NULL)
     return NULL;
 
@@ -524,127 +591,207 @@ create_marco_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
 static GdkPixbuf *
 create_icon_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
 {
-  return create_folder_icon ((char *) theme_thumbnail_data->icon_theme_name->data);
+  return create_folder_icon (theme_thumbnail_data->icon_theme_name);
 }
 
 
-static void
-handle_bytes (const gchar        *buffer,
-              gint                bytes_read,
-              ThemeThumbnailData *theme_thumbnail_data)
+/* A descriptor for an anonymous shared memory file of the given size */
+static gint
+create_shm_file (gsize size)
 {
-  const gchar *ptr;
-  ptr = buffer;
+  gint fd;
 
-  while (bytes_read > 0)
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("mate-theme-thumbnail", MFD_CLOEXEC);
+  if (fd < 0)
+#endif
   {
-    char *nil;
+    gchar *filename;
 
-    switch (theme_thumbnail_data->status)
-    {
-      case READY_FOR_THEME:
-        theme_thumbnail_data->status = READING_TYPE;
-        /* fall through */
-      case READING_TYPE:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->type, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->type, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = READING_CONTROL_THEME_NAME;
-        }
-        break;
+    fd = g_file_open_tmp ("mate-theme-thumbnail-XXXXXX", &filename, NULL);
+    if (fd < 0)
+      return -1;
 
-      case READING_CONTROL_THEME_NAME:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->control_theme_name, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->control_theme_name, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = READING_GTK_COLOR_SCHEME;
-        }
-        break;
+    unlink (filename);
+    g_free (filename);
+  }
 
-      case READING_GTK_COLOR_SCHEME:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->gtk_color_scheme, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->gtk_color_scheme, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = READING_WM_THEME_NAME;
-        }
-        break;
+  if (ftruncate (fd, size) != 0)
+  {
+    close (fd);
+    return -1;
+  }
 
-      case READING_WM_THEME_NAME:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->wm_theme_name, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->wm_theme_name, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = READING_ICON_THEME_NAME;
-        }
-        break;
+  return fd;
+}
 
-      case READING_ICON_THEME_NAME:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->icon_theme_name, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->icon_theme_name, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = READING_APPLICATION_FONT;
-        }
-        break;
+static void
+send_reply (gint                        fd,
+            const ThemeThumbnailHeader *request,
+            ThemeThumbnailStatus        status,
+            const ThemeThumbnailSize   *size,
+            gint                        shm_fd)
+{
+  ThemeThumbnailHeader header;
+  struct msghdr msg = { 0, };
+  struct iovec iov[2];
+  union {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (sizeof (gint))];
+  } control;
+
+  header.version = THUMBNAIL_PROTOCOL_VERSION;
+  header.type = request->type;
+  header.id = request->id;
+  header.status = status;
+  header.length = status == THUMBNAIL_STATUS_OK ? sizeof (ThemeThumbnailSize) : 0;
+
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof (header);
+  iov[1].iov_base = (gpointer) size;
+  iov[1].iov_len = header.length;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = header.length > 0 ? 2 : 1;
+
+  if (status == THUMBNAIL_STATUS_OK)
+  {
+    struct cmsghdr *cmsg;
+
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (gint));
+    memcpy (CMSG_DATA (cmsg), &shm_fd, sizeof (gint));
+  }
 
-      case READING_APPLICATION_FONT:
-        nil = memchr (ptr, '\000', bytes_read);
-        if (nil == NULL)
-        {
-          g_byte_array_append (theme_thumbnail_data->application_font, ptr, bytes_read);
-          bytes_read = 0;
-        }
-        else
-        {
-          g_byte_array_append (theme_thumbnail_data->application_font, ptr, nil - ptr + 1);
-          bytes_read -= (nil - ptr + 1);
-          ptr = nil + 1;
-          theme_thumbnail_data->status = WRITING_PIXBUF_DATA;
-        }
-        break;
+  if (sendmsg (fd, &msg, MSG_NOSIGNAL) < 0)
+  {
+    g_warning ("Theme thumbnail factory could not reply: %s", g_strerror (errno));
+    _exit (1);
+  }
+}
 
-      default:
-        g_assert_not_reached ();
-    }
+static void
+render_thumbnail (gint                        fd,
+                  const ThemeThumbnailHeader *header,
+                  ThemeThumbnailData         *theme_thumbnail_data)
+{
+  GdkPixbuf *pixbuf = NULL;
+  ThemeThumbnailSize size;
+  ThemeThumbnailStatus status;
+  gint shm_fd = -1;
+
+  capplet_trace_begin ("theme thumbnail");
+
+  switch (header->type)
+  {
+    case THUMBNAIL_TYPE_META:
+      pixbuf = create_meta_theme_pixbuf (theme_thumbnail_data);
+      break;
+    case THUMBNAIL_TYPE_GTK:
+      pixbuf = create_gtk_theme_pixbuf (theme_thumbnail_data);
+      break;
+    case THUMBNAIL_TYPE_MARCO:
+      pixbuf = create_marco_theme_pixbuf (theme_thumbnail_data);
+      break;
+    case THUMBNAIL_TYPE_ICON:
+      pixbuf = create_icon_theme_pixbuf (theme_thumbnail_data);
+      break;
+    default:
+      send_reply (fd, header, THUMBNAIL_STATUS_BAD_REQUEST, NULL, -1);
+      capplet_trace_end ("theme thumbnail");
+      return;
   }
+
+  /* the capplet always gets RGBA */
+  if (pixbuf != NULL && !gdk_pixbuf_get_has_alpha (pixbuf))
+  {
+    GdkPixbuf *rgba = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+
+    g_object_unref (pixbuf);
+    pixbuf = rgba;
+  }
+
+  if (pixbuf == NULL)
+  {
+    status = THUMBNAIL_STATUS_NO_THUMBNAIL;
+  }
+  else
+  {
+    size.width = gdk_pixbuf_get_width (pixbuf);
+    size.height = gdk_pixbuf_get_height (pixbuf);
+    size.rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+    /* the last row of a pixbuf may be shorter than the rowstride */
+    shm_fd = create_shm_file ((gsize) size.rowstride * size.height);
+    if (shm_fd >= 0 &&
+        pwrite (shm_fd, gdk_pixbuf_get_pixels (pixbuf),
+                (gsize) size.rowstride * (size.height - 1) + size.width * 4, 0) > 0)
+      status = THUMBNAIL_STATUS_OK;
+    else
+      status = THUMBNAIL_STATUS_FAILED;
+
+    g_object_unref (pixbuf);
+  }
+
+  send_reply (fd, header, status, &size, shm_fd);
+
+  if (shm_fd >= 0)
+    close (shm_fd);
+
+  capplet_trace_end ("theme thumbnail");
+}
+
+static gboolean
+read_string (const guchar **ptr,
+             const guchar  *end,
+             gchar        **str)
+{
+  guint32 len;
+
+  if (end - *ptr < (gssize) sizeof (len))
+    return FALSE;
+
+  memcpy (&len, *ptr, sizeof (len));
+  *ptr += sizeof (len);
+
+  if (end - *ptr < (gssize) len)
+    return FALSE;
+
+  *str = g_strndup ((const gchar *) *ptr, len);
+  *ptr += len;
+
+  return TRUE;
+}
+
+static void
+handle_request (gint                        fd,
+                const ThemeThumbnailHeader *header,
+                const guchar               *payload)
+{
+  ThemeThumbnailData theme_thumbnail_data = { 0, };
+  const guchar *end = payload + header->length;
+
+  theme_thumbnail_data.id = header->id;
+  theme_thumbnail_data.type = header->type;
+
+  if (read_string (&payload, end, &theme_thumbnail_data.control_theme_name) &&
+      read_string (&payload, end, &theme_thumbnail_data.gtk_color_scheme) &&
+      read_string (&payload, end, &theme_thumbnail_data.wm_theme_name) &&
+      read_string (&payload, end, &theme_thumbnail_data.icon_theme_name) &&
+      read_string (&payload, end, &theme_thumbnail_data.application_font) &&
+      payload == end)
+    render_thumbnail (fd, header, &theme_thumbnail_data);
+  else
+    send_reply (fd, header, THUMBNAIL_STATUS_BAD_REQUEST, NULL, -1);
+
+  g_free (theme_thumbnail_data.control_theme_name);
+  g_free (theme_thumbnail_data.gtk_color_scheme);
+  g_free (theme_thumbnail_data.wm_theme_name);
+  g_free (theme_thumbnail_data.icon_theme_name);
+  g_free (theme_thumbnail_data.application_font);
 }
 
 static gboolean
@@ -652,324 +799,940 @@ message_from_capplet (GIOChannel   *source,
                       GIOCondition  condition,
                       gpointer      data)
 {
-  gchar buffer[1024];
-  GIOStatus status;
-  gsize bytes_read;
-  ThemeThumbnailData *theme_thumbnail_data;
-
-  theme_thumbnail_data = (ThemeThumbnailData *) data;
-  status = g_io_channel_read_chars (source,
-                                    buffer,
-                                    1024,
-                                    &bytes_read,
-                                    NULL);
-
-  switch (status)
-  {
-    case G_IO_STATUS_NORMAL:
-      handle_bytes (buffer, bytes_read, theme_thumbnail_data);
+  ThemeThumbnailCapplet *capplet = data;
+  guchar buffer[4096];
+  gssize bytes_read;
 
-      if (theme_thumbnail_data->status == WRITING_PIXBUF_DATA)
-      {
-        GdkPixbuf *pixbuf = NULL;
-        gint i, rowstride;
-        guchar *pixels;
-        gint width, height;
-        const gchar *type = (const gchar *) theme_thumbnail_data->type->data;
-
-        if (!strcmp (type, THUMBNAIL_TYPE_META))
-          pixbuf = create_meta_theme_pixbuf (theme_thumbnail_data);
-        else if (!strcmp (type, THUMBNAIL_TYPE_GTK))
-          pixbuf = create_gtk_theme_pixbuf (theme_thumbnail_data);
-        else if (!strcmp (type, THUMBNAIL_TYPE_MARCO))
-          pixbuf = create_marco_theme_pixbuf (theme_thumbnail_data);
-        else if (!strcmp (type, THUMBNAIL_TYPE_ICON))
-          pixbuf = create_icon_theme_pixbuf (theme_thumbnail_data);
-        else
-          g_assert_not_reached ();
-
-        if (pixbuf == NULL) {
-          width = height = rowstride = 0;
-          pixels = NULL;
-        } else {
-          width = gdk_pixbuf_get_width (pixbuf);
-          height = gdk_pixbuf_get_height (pixbuf);
-          rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-          pixels = gdk_pixbuf_get_pixels (pixbuf);
-        }
-
-        /* Write the pixbuf's size */
-        write (pipe_from_factory_fd[1], &width, sizeof (width));
-        write (pipe_from_factory_fd[1], &height, sizeof (height));
-
-        for (i = 0; i < height; i++)
-        {
-          write (pipe_from_factory_fd[1], pixels + rowstride * i, width * gdk_pixbuf_get_n_channels (pixbuf));
-        }
-
-        if (pixbuf)
-          g_object_unref (pixbuf);
-        g_byte_array_set_size (theme_thumbnail_data->type, 0);
-        g_byte_array_set_size (theme_thumbnail_data->control_theme_name, 0);
-        g_byte_array_set_size (theme_thumbnail_data->gtk_color_scheme, 0);
-        g_byte_array_set_size (theme_thumbnail_data->wm_theme_name, 0);
-        g_byte_array_set_size (theme_thumbnail_data->icon_theme_name, 0);
-        g_byte_array_set_size (theme_thumbnail_data->application_font, 0);
-        theme_thumbnail_data->status = READY_FOR_THEME;
-      }
-      return TRUE;
+  bytes_read = read (capplet->fd, buffer, sizeof (buffer));
 
-    case G_IO_STATUS_AGAIN:
+  if (bytes_read == 0)
+  {
+    /* the capplet is gone */
+    _exit (0);
+  }
+  else if (bytes_read < 0)
+  {
+    if (errno == EAGAIN || errno == EINTR)
       return TRUE;
 
-    case G_IO_STATUS_EOF:
-    case G_IO_STATUS_ERROR:
-      _exit (0);
+    g_warning ("Theme thumbnail factory could not read a request: %s", g_strerror (errno));
+    _exit (1);
+  }
 
-    default:
-      g_assert_not_reached ();
+  g_byte_array_append (capplet->data, buffer, bytes_read);
+
+  /* the capplet may have sent several requests at once */
+  while (capplet->data->len >= sizeof (ThemeThumbnailHeader))
+  {
+    ThemeThumbnailHeader header;
+
+    memcpy (&header, capplet->data->data, sizeof (header));
+
+    if (header.version != THUMBNAIL_PROTOCOL_VERSION ||
+        header.length > THUMBNAIL_MAX_PAYLOAD)
+    {
+      /* we can't tell where the next request starts any more */
+      send_reply (capplet->fd, &header, THUMBNAIL_STATUS_BAD_REQUEST, NULL, -1);
+      g_warning ("Theme thumbnail factory received a malformed request");
+      _exit (1);
     }
 
+    if (capplet->data->len < sizeof (header) + header.length)
+      break;
+
+    handle_request (capplet->fd, &header, capplet->data->data + sizeof (header));
+    g_byte_array_remove_range (capplet->data, 0, sizeof (header) + header.length);
+  }
+
   return TRUE;
 }
 
 static void
-generate_next_in_queue (void)
+theme_thumbnail_request_free (ThemeThumbnailRequest *request)
 {
-  ThemeQueueItem *item;
+  g_free (request->theme_name);
+  g_free (request->gtk_theme_name);
+  g_free (request->gtk_color_scheme);
+  g_free (request->marco_theme_name);
+  g_free (request->icon_theme_name);
+  g_free (request->application_font);
+  g_free (request->cache_filename);
+  g_free (request);
+}
 
-  if (theme_queue == NULL)
-    return;
+static void
+complete_request (ThemeThumbnailRequest *request,
+                  GdkPixbuf             *pixbuf)
+{
+  /* callback function needs to ref the pixbuf if it wants to keep it */
+  if (!request->cancelled)
+    (* request->func) (pixbuf, request->theme_name, request->user_data);
 
-  item = theme_queue->data;
-  theme_queue = g_list_delete_link (theme_queue, g_list_first (theme_queue));
-
-  if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_META))
-    generate_meta_theme_thumbnail_async ((MateThemeMetaInfo *) item->theme_info,
-                                         item->func,
-                                         item->user_data,
-                                         item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_GTK))
-    generate_gtk_theme_thumbnail_async ((MateThemeInfo *) item->theme_info,
-                                        item->func,
-                                        item->user_data,
-                                        item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_MARCO))
-    generate_marco_theme_thumbnail_async ((MateThemeInfo *) item->theme_info,
-                                             item->func,
-                                             item->user_data,
-                                             item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_ICON))
-    generate_icon_theme_thumbnail_async ((MateThemeIconInfo *) item->theme_info,
-                                         item->func,
-                                         item->user_data,
-                                         item->destroy);
-
-  g_free (item);
+  if (request->destroy)
+    (* request->destroy) (request->user_data);
+
+  theme_thumbnail_request_free (request);
+}
+
+/* Lower priorities first, like GLib's; then the order they were made in */
+static gint
+compare_requests (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+  const ThemeThumbnailRequest *request_a = a;
+  const ThemeThumbnailRequest *request_b = b;
+
+  if (request_a->priority != request_b->priority)
+    return request_a->priority < request_b->priority ? -1 : 1;
+
+  return request_a->id < request_b->id ? -1 : request_a->id > request_b->id;
+}
+
+static gint
+request_has_id (gconstpointer request,
+                gconstpointer id)
+{
+  return ((const ThemeThumbnailRequest *) request)->id != GPOINTER_TO_UINT (id);
 }
 
 static gboolean
-message_from_child (GIOChannel   *source,
-                    GIOCondition  condition,
-                    gpointer      data)
+factory_is_alive (ThemeThumbnailFactory *factory)
 {
-  gchar buffer[1024];
-  GIOStatus status;
-  gsize bytes_read;
+  return factory->fd >= 0;
+}
 
-  if (async_data.set == FALSE)
-    return TRUE;
+static void close_factory (ThemeThumbnailFactory *factory);
 
-  if (condition == G_IO_HUP)
-    return FALSE;
+/* Writes all of iov, however often the socket takes only part of it */
+static gboolean
+send_all (gint          fd,
+          struct iovec *iov,
+          gint          n_iov)
+{
+  while (n_iov > 0)
+  {
+    struct msghdr msg = { 0, };
+    gssize sent;
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = MIN (n_iov, IOV_MAX);
+
+    sent = sendmsg (fd, &msg, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+      struct pollfd pfd = { fd, POLLOUT, 0 };
+
+      if (errno == EAGAIN)
+        poll (&pfd, 1, -1);
+      else if (errno != EINTR)
+        return FALSE;
+
+      continue;
+    }
+
+    while (n_iov > 0 && (gsize) sent >= iov->iov_len)
+    {
+      sent -= iov->iov_len;
+      iov++;
+      n_iov--;
+    }
+
+    if (n_iov > 0)
+    {
+      iov->iov_base = (guchar *) iov->iov_base + sent;
+      iov->iov_len -= sent;
+    }
+  }
+
+  return TRUE;
+}
 
-  status = g_io_channel_read_chars (source,
-                                    buffer,
-                                    1024,
-                                    &bytes_read,
-                                    NULL);
-  switch (status)
+/* Writes all requests in one go */
+static gboolean
+send_thumbnail_requests (ThemeThumbnailFactory *factory,
+                         GList                 *requests)
+{
+  guint n_requests = g_list_length (requests);
+  ThemeThumbnailHeader *headers;
+  guint32 *lengths;
+  struct iovec *iov;
+  gint n_iov = 0;
+  gboolean retval;
+  GList *l;
+  guint i;
+
+  headers = g_new (ThemeThumbnailHeader, n_requests);
+  lengths = g_new (guint32, n_requests * THUMBNAIL_N_STRINGS);
+  iov = g_new (struct iovec, n_requests * (1 + 2 * THUMBNAIL_N_STRINGS));
+
+  for (l = requests, i = 0; l != NULL; l = l->next, i++)
   {
-    case G_IO_STATUS_NORMAL:
-      g_byte_array_append (async_data.data, (guchar *) buffer, bytes_read);
+    ThemeThumbnailRequest *request = l->data;
+    ThemeThumbnailHeader *header = &headers[i];
+    const gchar *strings[THUMBNAIL_N_STRINGS];
+    guint j;
+
+    strings[0] = request->gtk_theme_name ? request->gtk_theme_name : "";
+    strings[1] = request->gtk_color_scheme ? request->gtk_color_scheme : "";
+    strings[2] = request->marco_theme_name ? request->marco_theme_name : "";
+    strings[3] = request->icon_theme_name ? request->icon_theme_name : "";
+    strings[4] = request->application_font ? request->application_font : "Sans 10";
+
+    header->version = THUMBNAIL_PROTOCOL_VERSION;
+    header->type = request->thumbnail_type;
+    header->id = request->id;
+    header->status = THUMBNAIL_STATUS_OK;
+    header->length = 0;
+
+    iov[n_iov].iov_base = header;
+    iov[n_iov].iov_len = sizeof (ThemeThumbnailHeader);
+    n_iov++;
+
+    for (j = 0; j < THUMBNAIL_N_STRINGS; j++)
+    {
+      guint32 *length = &lengths[i * THUMBNAIL_N_STRINGS + j];
 
-      if (async_data.thumbnail_width == -1 && async_data.data->len >= 2 * sizeof (gint))
-      {
-        async_data.thumbnail_width = *((gint *) async_data.data->data);
-        async_data.thumbnail_height = *(((gint *) async_data.data->data) + 1);
-        g_byte_array_remove_range (async_data.data, 0, 2 * sizeof (gint));
-      }
+      *length = strlen (strings[j]);
+      header->length += sizeof (guint32) + *length;
 
-      if (async_data.thumbnail_width >= 0 && async_data.data->len == async_data.thumbnail_width * async_data.thumbnail_height * 4)
+      iov[n_iov].iov_base = length;
+      iov[n_iov].iov_len = sizeof (guint32);
+      n_iov++;
+      iov[n_iov].iov_base = (gpointer) strings[j];
+      iov[n_iov].iov_len = *length;
+      n_iov++;
+    }
+  }
+
+  retval = send_all (factory->fd, iov, n_iov);
+
+  g_free (iov);
+  g_free (lengths);
+  g_free (headers);
+
+  return retval;
+}
+
+static void
+dispatch_requests (void)
+{
+  GList *batches[MAX_FACTORIES] = { NULL, };
+  guint i;
+
+  while (!g_queue_is_empty (&theme_queue))
+  {
+    ThemeThumbnailFactory *factory = NULL;
+    ThemeThumbnailRequest *request;
+    guint busy = MAX_REQUESTS_PER_FACTORY;
+    gboolean any_alive = FALSE;
+
+    /* the least busy factory */
+    for (i = 0; i < n_factories; i++)
+    {
+      guint n;
+
+      if (!factory_is_alive (&factories[i]))
+        continue;
+
+      any_alive = TRUE;
+      n = g_list_length (factories[i].requests);
+      if (n < busy)
       {
-        GdkPixbuf *pixbuf = NULL;
-
-        if (async_data.thumbnail_width > 0) {
-          gchar *pixels;
-          gint i, rowstride;
-
-          pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, async_data.thumbnail_width, async_data.thumbnail_height);
-          pixels = (gchar *) gdk_pixbuf_get_pixels (pixbuf);
-          rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-
-          for (i = 0; i < async_data.thumbnail_height; ++i)
-            memcpy (pixels + rowstride * i, async_data.data->data + 4 * async_data.thumbnail_width * i, async_data.thumbnail_width * 4);
-        }
-
-        /* callback function needs to ref the pixbuf if it wants to keep it */
-        (* async_data.func) (pixbuf, async_data.theme_name, async_data.user_data);
-
-        if (async_data.destroy)
-          (* async_data.destroy) (async_data.user_data);
-
-        if (pixbuf)
-          g_object_unref (pixbuf);
-
-        /* Clean up async_data */
-        g_free (async_data.theme_name);
-        g_source_remove (async_data.watch_id);
-        g_io_channel_unref (async_data.channel);
-
-        /* reset async_data */
-        async_data.thumbnail_width = -1;
-        async_data.thumbnail_height = -1;
-        async_data.theme_name = NULL;
-        async_data.channel = NULL;
-        async_data.func = NULL;
-        async_data.user_data = NULL;
-        async_data.destroy = NULL;
-        async_data.set = FALSE;
-        g_byte_array_set_size (async_data.data, 0);
-
-        generate_next_in_queue ();
+        factory = &factories[i];
+        busy = n;
       }
-      return TRUE;
+    }
 
-    case G_IO_STATUS_AGAIN:
-      return TRUE;
+    if (factory == NULL && any_alive)
+      break;
 
-    case G_IO_STATUS_EOF:
-    case G_IO_STATUS_ERROR:
-      return FALSE;
+    request = g_queue_pop_head (&theme_queue);
 
-    default:
-      g_assert_not_reached ();
+    if (factory == NULL)
+    {
+      complete_request (request, NULL);
+      continue;
+    }
+
+    factory->requests = g_list_append (factory->requests, request);
+    batches[factory - factories] = g_list_append (batches[factory - factories], request);
   }
 
-  return TRUE;
+  /* each factory gets everything meant for it in one write */
+  for (i = 0; i < n_factories; i++)
+  {
+    if (batches[i] == NULL)
+      continue;
+
+    if (factory_is_alive (&factories[i]) &&
+        !send_thumbnail_requests (&factories[i], batches[i]))
+    {
+      g_warning ("Could not send requests to a theme thumbnail factory: %s", g_strerror (errno));
+      close_factory (&factories[i]);
+    }
+
+    g_list_free (batches[i]);
+  }
 }
 
 static void
-send_thumbnail_request (gchar *thumbnail_type,
-                        gchar *gtk_theme_name,
-                        gchar *gtk_color_scheme,
-                        gchar *marco_theme_name,
-                        gchar *icon_theme_name,
-                        gchar *application_font)
+close_factory (ThemeThumbnailFactory *factory)
 {
-  write (pipe_to_factory_fd[1], thumbnail_type, strlen (thumbnail_type) + 1);
+  GList *requests;
 
-  if (gtk_theme_name)
-    write (pipe_to_factory_fd[1], gtk_theme_name, strlen (gtk_theme_name) + 1);
-  else
-    write (pipe_to_factory_fd[1], "", 1);
+  if (factory->watch_id != 0)
+    g_source_remove (factory->watch_id);
+  factory->watch_id = 0;
 
-  if (gtk_color_scheme)
-    write (pipe_to_factory_fd[1], gtk_color_scheme, strlen (gtk_color_scheme) + 1);
-  else
-    write (pipe_to_factory_fd[1], "", 1);
+  if (factory->channel != NULL)
+    g_io_channel_unref (factory->channel);
+  factory->channel = NULL;
 
-  if (marco_theme_name)
-    write (pipe_to_factory_fd[1], marco_theme_name, strlen (marco_theme_name) + 1);
-  else
-    write (pipe_to_factory_fd[1], "", 1);
+  if (factory->fd >= 0)
+    close (factory->fd);
+  factory->fd = -1;
 
-  if (icon_theme_name)
-    write (pipe_to_factory_fd[1], icon_theme_name, strlen (icon_theme_name) + 1);
-  else
-    write (pipe_to_factory_fd[1], "", 1);
+  g_byte_array_set_size (factory->data, 0);
 
-  if (application_font)
-    write (pipe_to_factory_fd[1], application_font, strlen (application_font) + 1);
-  else
-     write (pipe_to_factory_fd[1], "Sans 10", strlen ("Sans 10") + 1);
+  while (!g_queue_is_empty (&factory->fds))
+    close (GPOINTER_TO_INT (g_queue_pop_head (&factory->fds)));
+
+  /* whatever was sent to it won't be answered any more */
+  requests = factory->requests;
+  factory->requests = NULL;
+
+  while (requests != NULL)
+  {
+    complete_request (requests->data, NULL);
+    requests = g_list_delete_link (requests, requests);
+  }
+}
 
+static void
+unmap_pixels (guchar   *pixels,
+              gpointer  size)
+{
+  munmap (pixels, GPOINTER_TO_SIZE (size));
 }
 
+/* Wraps the factory's shared memory file without copying it */
 static GdkPixbuf *
-read_pixbuf (void)
+pixbuf_from_shm (gint shm_fd,
+                 gint width,
+                 gint height,
+                 gint rowstride)
 {
-  gint bytes_read, i, j = 0;
-  gint size[2];
   GdkPixbuf *pixbuf;
-  gint rowstride;
-  guchar *pixels;
+  gpointer pixels;
+  gsize size;
+
+  if (width <= 0 || height <= 0 || rowstride < width * 4)
+    return NULL;
+
+  size = (gsize) rowstride * height;
+  pixels = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, shm_fd, 0);
+  if (pixels == MAP_FAILED)
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new_from_data (pixels, GDK_COLORSPACE_RGB, TRUE, 8,
+                                     width, height, rowstride,
+                                     unmap_pixels, GSIZE_TO_POINTER (size));
+  if (pixbuf == NULL)
+    munmap (pixels, size);
+
+  return pixbuf;
+}
+
+/* Thumbnail cache
+ *
+ * Thumbnails are kept in $XDG_CACHE_HOME/mate-control-center/theme-thumbnails,
+ * named after a checksum of everything that goes into rendering them: the
+ * request, the thumbnail size and the modification times of the theme files
+ * involved.  A theme which changed on disk thus simply misses the cache.
+ * Every hit touches the file, and at startup all but the most recently
+ * used THUMBNAIL_CACHE_MAX_FILES are removed, so the thumbnails of old
+ * versions of a theme don't pile up.
+ */
+
+#define THUMBNAIL_CACHE_VERSION 1
+#define THUMBNAIL_CACHE_MAX_FILES 512
+
+/* relative to the theme dir */
+static const gchar* gtk_theme_files[] = {
+	".",
+	"index.theme",
+#if GTK_CHECK_VERSION (3, 0, 0)
+	"gtk-3.0",
+	"gtk-3.0/gtk.css",
+#else
+	"gtk-2.0",
+	"gtk-2.0/gtkrc",
+#endif
+	NULL
+};
+
+static const gchar* marco_theme_files[] = {
+	"metacity-1",
+	"metacity-1/metacity-theme-1.xml",
+	"metacity-1/metacity-theme-2.xml",
+	"metacity-1/metacity-theme-3.xml",
+	NULL
+};
+
+static const gchar* icon_theme_files[] = {
+	".",
+	"index.theme",
+	"icon-theme.cache",
+	NULL
+};
+
+/* requests which are answered from the cache */
+static GQueue cached_queue = G_QUEUE_INIT;
+static guint cached_idle_id = 0;
+
+static gint
+thumbnail_size (ThemeThumbnailType type)
+{
+  switch (type)
+  {
+    case THUMBNAIL_TYPE_META:
+      return META_THUMBNAIL_SIZE;
+    case THUMBNAIL_TYPE_GTK:
+      return GTK_THUMBNAIL_SIZE;
+    case THUMBNAIL_TYPE_MARCO:
+      return MARCO_THUMBNAIL_WIDTH;
+    default:
+      return ICON_THUMBNAIL_SIZE;
+  }
+}
+
+static void
+checksum_add_string (GChecksum   *checksum,
+                     const gchar *str)
+{
+  if (str != NULL)
+    g_checksum_update (checksum, (const guchar *) str, -1);
 
-  do
+  /* keeps "ab", "c" apart from "a", "bc" */
+  g_checksum_update (checksum, (const guchar *) "", 1);
+}
+
+static void
+checksum_add_theme_files (GChecksum    *checksum,
+                          const gchar  *theme_dir,
+                          const gchar **files)
+{
+  for (; *files != NULL; files++)
   {
-    bytes_read = read (pipe_from_factory_fd[0], ((guint8*) size) + j, 2 * sizeof (gint));
-    if (bytes_read == 0)
-      goto eof;
-    j += bytes_read;
+    gchar *filename = g_build_filename (theme_dir, *files, NULL);
+    GStatBuf buf;
+    guint64 stamp[2] = { 0, 0 };
+
+    if (g_stat (filename, &buf) == 0)
+    {
+      stamp[0] = buf.st_mtime;
+      stamp[1] = buf.st_size;
+    }
+
+    g_checksum_update (checksum, (const guchar *) stamp, sizeof (stamp));
+    g_free (filename);
   }
-  while (j < 2 * sizeof (gint));
+}
 
-  if (size[0] <= 0 || size[1] <= 0)
-    return NULL;
+/* Icons the theme doesn't have come from the themes it inherits from, and
+ * in the end from hicolor, so those are stamped as well.
+ */
+static void
+checksum_add_icon_theme (GChecksum   *checksum,
+                         const gchar *icon_theme_name,
+                         GHashTable  *visited)
+{
+  MateThemeIconInfo *icon_theme_info;
+  GKeyFile *key_file;
+  gchar **inherits = NULL;
+  gchar *dirname;
+  gint i;
 
-  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, size[0], size[1]);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  if (g_hash_table_contains (visited, icon_theme_name))
+    return;
+  g_hash_table_add (visited, g_strdup (icon_theme_name));
+
+  icon_theme_info = mate_theme_icon_info_find (icon_theme_name);
+  if (icon_theme_info == NULL)
+    return;
+
+  /* the path of an icon theme is its index.theme */
+  dirname = g_path_get_dirname (icon_theme_info->path);
+  checksum_add_theme_files (checksum, dirname, icon_theme_files);
+  g_free (dirname);
+
+  key_file = g_key_file_new ();
+  if (g_key_file_load_from_file (key_file, icon_theme_info->path, G_KEY_FILE_NONE, NULL))
+    inherits = g_key_file_get_string_list (key_file, "Icon Theme", "Inherits", NULL, NULL);
+  g_key_file_free (key_file);
+
+  for (i = 0; inherits != NULL && inherits[i] != NULL; i++)
+  {
+    g_strstrip (inherits[i]);
+    checksum_add_string (checksum, inherits[i]);
+    checksum_add_icon_theme (checksum, inherits[i], visited);
+  }
+
+  g_strfreev (inherits);
+}
+
+static gchar *
+get_cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "mate-control-center",
+                           "theme-thumbnails", NULL);
+}
+
+typedef struct {
+  gchar *filename;
+  time_t mtime;
+} CachedThumbnail;
+
+static gint
+compare_cached_thumbnails (gconstpointer a,
+                           gconstpointer b)
+{
+  const CachedThumbnail *thumb_a = *(CachedThumbnail * const *) a;
+  const CachedThumbnail *thumb_b = *(CachedThumbnail * const *) b;
+
+  /* most recently used first */
+  if (thumb_a->mtime != thumb_b->mtime)
+    return thumb_a->mtime > thumb_b->mtime ? -1 : 1;
+
+  return 0;
+}
+
+static void
+cached_thumbnail_free (CachedThumbnail *thumb)
+{
+  g_free (thumb->filename);
+  g_free (thumb);
+}
+
+static void
+prune_thumbnail_cache (void)
+{
+  GPtrArray *thumbs;
+  GDir *dir;
+  const gchar *name;
+  gchar *dirname;
+  guint i;
+
+  dirname = get_cache_dir ();
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+  {
+    g_free (dirname);
+    return;
+  }
+
+  thumbs = g_ptr_array_new_with_free_func ((GDestroyNotify) cached_thumbnail_free);
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    CachedThumbnail *thumb;
+    GStatBuf buf;
+
+    if (!g_str_has_suffix (name, ".png"))
+      continue;
+
+    thumb = g_new (CachedThumbnail, 1);
+    thumb->filename = g_build_filename (dirname, name, NULL);
+    thumb->mtime = g_stat (thumb->filename, &buf) == 0 ? buf.st_mtime : 0;
+    g_ptr_array_add (thumbs, thumb);
+  }
+
+  g_dir_close (dir);
+  g_free (dirname);
+
+  if (thumbs->len > THUMBNAIL_CACHE_MAX_FILES)
+  {
+    g_ptr_array_sort (thumbs, compare_cached_thumbnails);
+
+    for (i = THUMBNAIL_CACHE_MAX_FILES; i < thumbs->len; i++)
+      g_unlink (((CachedThumbnail *) g_ptr_array_index (thumbs, i))->filename);
+  }
+
+  g_ptr_array_free (thumbs, TRUE);
+}
+
+static gchar *
+get_cache_filename (ThemeThumbnailRequest *request)
+{
+  GChecksum *checksum;
+  MateThemeInfo *theme_info;
+  guint32 header[3];
+  gchar *basename, *dirname, *filename;
+
+  header[0] = THUMBNAIL_CACHE_VERSION;
+  header[1] = request->thumbnail_type;
+  header[2] = thumbnail_size (request->thumbnail_type);
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *) header, sizeof (header));
+
+  checksum_add_string (checksum, request->gtk_theme_name);
+  checksum_add_string (checksum, request->gtk_color_scheme);
+  checksum_add_string (checksum, request->marco_theme_name);
+  checksum_add_string (checksum, request->icon_theme_name);
+  checksum_add_string (checksum, request->application_font);
+
+  if (request->gtk_theme_name != NULL &&
+      (theme_info = mate_theme_info_find (request->gtk_theme_name)) != NULL)
+    checksum_add_theme_files (checksum, theme_info->path, gtk_theme_files);
+
+  if (request->marco_theme_name != NULL &&
+      (theme_info = mate_theme_info_find (request->marco_theme_name)) != NULL)
+    checksum_add_theme_files (checksum, theme_info->path, marco_theme_files);
+
+  if (request->icon_theme_name != NULL)
+  {
+    GHashTable *visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    checksum_add_icon_theme (checksum, request->icon_theme_name, visited);
+    checksum_add_icon_theme (checksum, "hicolor", visited);
+    g_hash_table_destroy (visited);
+  }
+
+  basename = g_strconcat (g_checksum_get_string (checksum), ".png", NULL);
+  dirname = get_cache_dir ();
+  filename = g_build_filename (dirname, basename, NULL);
+
+  g_free (basename);
+  g_free (dirname);
+  g_checksum_free (checksum);
+
+  return filename;
+}
+
+static void
+save_cached_thumbnail (const gchar *filename,
+                       GdkPixbuf   *pixbuf)
+{
+  GError *error = NULL;
+  gchar *dirname, *buffer;
+  gsize size;
+
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  /* never leave a truncated thumbnail behind */
+  if (gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", &error, NULL))
+  {
+    g_file_set_contents (filename, buffer, size, &error);
+    g_free (buffer);
+  }
+
+  if (error != NULL)
+  {
+    g_warning ("Could not cache a theme thumbnail: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+/* Answers the cached requests one at a time, so that a long theme list
+ * doesn't block the capplet */
+static gboolean
+load_cached_thumbnails (gpointer user_data)
+{
+  ThemeThumbnailRequest *request;
+  GdkPixbuf *pixbuf;
+
+  /* the queue may have been emptied by theme_thumbnail_cancel() */
+  request = g_queue_pop_head (&cached_queue);
+  if (request == NULL)
+  {
+    cached_idle_id = 0;
+    return FALSE;
+  }
+
+  pixbuf = gdk_pixbuf_new_from_file (request->cache_filename, NULL);
 
-  for (i = 0; i < size[1]; i++)
+  if (pixbuf != NULL)
   {
-    j = 0;
+    /* keeps it from being pruned */
+    g_utime (request->cache_filename, NULL);
+    complete_request (request, pixbuf);
+    g_object_unref (pixbuf);
+  }
+  else
+  {
+    /* unreadable; render it again */
+    g_queue_insert_sorted (&theme_queue, request, compare_requests, NULL);
+    dispatch_requests ();
+  }
+
+  if (g_queue_is_empty (&cached_queue))
+  {
+    cached_idle_id = 0;
+    return FALSE;
+  }
 
-    do
+  return TRUE;
+}
+
+/* Reads what the factory sent so far into factory->data and factory->fds.
+ * Returns the number of bytes read, 0 on EOF or -1 on error (EAGAIN
+ * included) */
+static gssize
+receive_replies (ThemeThumbnailFactory *factory)
+{
+  guchar buffer[16 * (sizeof (ThemeThumbnailHeader) + sizeof (ThemeThumbnailSize))];
+  union {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (16 * sizeof (gint))];
+  } control;
+  struct msghdr msg = { 0, };
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  gssize bytes_read;
+
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof (buffer);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  bytes_read = recvmsg (factory->fd, &msg, MSG_CMSG_CLOEXEC);
+  if (bytes_read <= 0)
+    return bytes_read;
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
     {
-      bytes_read = read (pipe_from_factory_fd[0], pixels + rowstride * i + j, size[0] * gdk_pixbuf_get_n_channels (pixbuf) - j);
+      gint *fds = (gint *) CMSG_DATA (cmsg);
+      gsize i, n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (gint);
+
+      for (i = 0; i < n; i++)
+        g_queue_push_tail (&factory->fds, GINT_TO_POINTER (fds[i]));
+    }
+  }
 
-      if (bytes_read > 0)
-        j += bytes_read;
-      else if (bytes_read == 0)
+  g_byte_array_append (factory->data, buffer, bytes_read);
+
+  return bytes_read;
+}
+
+typedef enum {
+  REPLY_INCOMPLETE,
+  REPLY_TAKEN,
+  REPLY_MALFORMED
+} ReplyResult;
+
+/* Takes the next complete reply out of factory->data */
+static ReplyResult
+take_reply (ThemeThumbnailFactory *factory,
+            guint                 *id,
+            GdkPixbuf            **pixbuf)
+{
+  ThemeThumbnailHeader header;
+  ThemeThumbnailSize size;
+
+  if (factory->data->len < sizeof (header))
+    return REPLY_INCOMPLETE;
+
+  memcpy (&header, factory->data->data, sizeof (header));
+
+  if (header.version != THUMBNAIL_PROTOCOL_VERSION)
+  {
+    g_warning ("Theme thumbnail factory speaks protocol version %u instead of %u",
+               header.version, THUMBNAIL_PROTOCOL_VERSION);
+    return REPLY_MALFORMED;
+  }
+
+  if (header.status == THUMBNAIL_STATUS_OK ?
+      header.length != sizeof (size) : header.length != 0)
+  {
+    g_warning ("Theme thumbnail factory sent a malformed reply");
+    return REPLY_MALFORMED;
+  }
+
+  if (factory->data->len < sizeof (header) + header.length)
+    return REPLY_INCOMPLETE;
+
+  *id = header.id;
+  *pixbuf = NULL;
+
+  switch (header.status)
+  {
+    case THUMBNAIL_STATUS_OK:
+    {
+      gint shm_fd;
+
+      /* the descriptor arrives with the first byte of the reply */
+      if (g_queue_is_empty (&factory->fds))
       {
-        g_object_unref (pixbuf);
-        goto eof;
+        g_warning ("Theme thumbnail factory sent a thumbnail without its pixels");
+        return REPLY_MALFORMED;
       }
+
+      memcpy (&size, factory->data->data + sizeof (header), sizeof (size));
+      shm_fd = GPOINTER_TO_INT (g_queue_pop_head (&factory->fds));
+      *pixbuf = pixbuf_from_shm (shm_fd, size.width, size.height, size.rowstride);
+      close (shm_fd);
+      break;
     }
-    while (j < size[0] * gdk_pixbuf_get_n_channels (pixbuf));
+    case THUMBNAIL_STATUS_NO_THUMBNAIL:
+      break;
+    case THUMBNAIL_STATUS_BAD_REQUEST:
+      g_warning ("Theme thumbnail factory could not parse request %u", header.id);
+      break;
+    default:
+      g_warning ("Theme thumbnail factory failed on request %u", header.id);
+      break;
   }
 
-  return pixbuf;
+  g_byte_array_remove_range (factory->data, 0, sizeof (header) + header.length);
 
-eof:
-  g_warning ("Received EOF while reading thumbnail");
-  close (pipe_to_factory_fd[1]);
-  pipe_to_factory_fd[1] = 0;
-  close (pipe_from_factory_fd[0]);
-  pipe_from_factory_fd[0] = 0;
-  return NULL;
+  return REPLY_TAKEN;
+}
+
+/* Hands out all the complete replies in factory->data */
+static void
+handle_replies (ThemeThumbnailFactory *factory)
+{
+  GdkPixbuf *pixbuf;
+  ReplyResult result;
+  guint id;
+
+  while ((result = take_reply (factory, &id, &pixbuf)) == REPLY_TAKEN)
+  {
+    ThemeThumbnailRequest *request = NULL;
+    GList *l;
+
+    for (l = factory->requests; l != NULL; l = l->next)
+    {
+      if (((ThemeThumbnailRequest *) l->data)->id == id)
+      {
+        request = l->data;
+        factory->requests = g_list_delete_link (factory->requests, l);
+        break;
+      }
+    }
+
+    if (request != NULL)
+    {
+      if (pixbuf != NULL && request->cache_filename != NULL)
+        save_cached_thumbnail (request->cache_filename, pixbuf);
+
+      complete_request (request, pixbuf);
+    }
+    else
+      g_warning ("Received a thumbnail nobody asked for");
+
+    if (pixbuf)
+      g_object_unref (pixbuf);
+  }
+
+  /* there's no telling where the next reply starts */
+  if (result == REPLY_MALFORMED)
+    close_factory (factory);
+}
+
+static gboolean
+message_from_child (GIOChannel   *source,
+                    GIOCondition  condition,
+                    gpointer      data)
+{
+  ThemeThumbnailFactory *factory = data;
+  gssize bytes_read;
+
+  bytes_read = receive_replies (factory);
+
+  if (bytes_read > 0)
+  {
+    handle_replies (factory);
+    dispatch_requests ();
+    return factory_is_alive (factory);
+  }
+
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+    return TRUE;
+
+  g_warning ("Lost a theme thumbnail factory");
+  factory->watch_id = 0;
+  close_factory (factory);
+  dispatch_requests ();
+  return FALSE;
 }
 
 static GdkPixbuf *
-generate_theme_thumbnail (gchar *thumbnail_type,
-                          gchar *gtk_theme_name,
-                          gchar *gtk_color_scheme,
-                          gchar *marco_theme_name,
-                          gchar *icon_theme_name,
-                          gchar *application_font)
+generate_theme_thumbnail (ThemeThumbnailType thumbnail_type,
+                          gchar       *gtk_theme_name,
+                          gchar       *gtk_color_scheme,
+                          gchar       *marco_theme_name,
+                          gchar       *icon_theme_name,
+                          gchar       *application_font)
 {
-  if (async_data.set || !pipe_to_factory_fd[1] || !pipe_from_factory_fd[0])
+  ThemeThumbnailFactory *factory = NULL;
+  ThemeThumbnailRequest request = { 0, };
+  GdkPixbuf *pixbuf = NULL;
+  ReplyResult result;
+  GList *requests;
+  gboolean sent;
+  guint i, id;
+
+  /* needs a factory which isn't busy with asynchronous requests */
+  for (i = 0; i < n_factories && factory == NULL; i++)
+  {
+    if (factory_is_alive (&factories[i]) && factories[i].requests == NULL)
+      factory = &factories[i];
+  }
+
+  if (factory == NULL)
+    return NULL;
+
+  request.id = next_request_id++;
+  request.thumbnail_type = thumbnail_type;
+  request.gtk_theme_name = gtk_theme_name;
+  request.gtk_color_scheme = gtk_color_scheme;
+  request.marco_theme_name = marco_theme_name;
+  request.icon_theme_name = icon_theme_name;
+  request.application_font = application_font;
+
+  requests = g_list_prepend (NULL, &request);
+  sent = send_thumbnail_requests (factory, requests);
+  g_list_free (requests);
+
+  if (!sent)
+  {
+    g_warning ("Could not send a request to a theme thumbnail factory: %s", g_strerror (errno));
+    close_factory (factory);
     return NULL;
+  }
+
+  while ((result = take_reply (factory, &id, &pixbuf)) != REPLY_TAKEN)
+  {
+    if (result == REPLY_MALFORMED)
+    {
+      close_factory (factory);
+      return NULL;
+    }
+
+    struct pollfd pfd = { factory->fd, POLLIN, 0 };
+    gssize bytes_read;
 
-  send_thumbnail_request (thumbnail_type,
-                          gtk_theme_name,
-                          gtk_color_scheme,
-                          marco_theme_name,
-                          icon_theme_name,
-                          application_font);
+    poll (&pfd, 1, -1);
 
-  return read_pixbuf ();
+    bytes_read = receive_replies (factory);
+    if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EINTR))
+    {
+      g_warning ("Received EOF while reading thumbnail");
+      close_factory (factory);
+      return NULL;
+    }
+  }
+
+  return pixbuf;
 }
 
 GdkPixbuf *
@@ -986,17 +1749,20 @@ generate_meta_theme_thumbnail (MateThemeMetaInfo *theme_info)
 GdkPixbuf *
 generate_gtk_theme_thumbnail (MateThemeInfo *theme_info)
 {
+  GdkPixbuf *pixbuf;
   gchar *scheme;
 
   scheme = gtkrc_get_color_scheme_for_theme (theme_info->name);
 
-  return generate_theme_thumbnail (THUMBNAIL_TYPE_GTK,
-                                   theme_info->name,
-                                   scheme,
-                                   NULL,
-                                   NULL,
-                                   NULL);
+  pixbuf = generate_theme_thumbnail (THUMBNAIL_TYPE_GTK,
+                                     theme_info->name,
+                                     scheme,
+                                     NULL,
+                                     NULL,
+                                     NULL);
   g_free (scheme);
+
+  return pixbuf;
 }
 
 GdkPixbuf *
@@ -1021,173 +1787,283 @@ generate_icon_theme_thumbnail (MateThemeIconInfo *theme_info)
                                    NULL);
 }
 
-static void generate_theme_thumbnail_async(gpointer theme_info, gchar* theme_name, gchar* thumbnail_type, gchar* gtk_theme_name, gchar* gtk_color_scheme, gchar* marco_theme_name, gchar* icon_theme_name, gchar* application_font, ThemeThumbnailFunc func, gpointer user_data, GDestroyNotify destroy)
+static guint generate_theme_thumbnail_async(const gchar* theme_name, ThemeThumbnailType thumbnail_type, const gchar* gtk_theme_name, const gchar* gtk_color_scheme, const gchar* marco_theme_name, const gchar* icon_theme_name, const gchar* application_font, gint priority, ThemeThumbnailFunc func, gpointer user_data, GDestroyNotify destroy)
 {
-	if (async_data.set)
+	ThemeThumbnailRequest* request = g_new0(ThemeThumbnailRequest, 1);
+	guint request_id;
+
+	/* the theme info may be gone by the time the request is sent */
+	request->id = next_request_id++;
+	/* set before dispatching, or a background request could take a
+	 * factory ahead of the ones on screen */
+	request->priority = priority;
+	request->thumbnail_type = thumbnail_type;
+	request->theme_name = g_strdup(theme_name);
+	request->gtk_theme_name = g_strdup(gtk_theme_name);
+	request->gtk_color_scheme = g_strdup(gtk_color_scheme);
+	request->marco_theme_name = g_strdup(marco_theme_name);
+	request->icon_theme_name = g_strdup(icon_theme_name);
+	request->application_font = g_strdup(application_font);
+	request->func = func;
+	request->user_data = user_data;
+	request->destroy = destroy;
+	request->cache_filename = get_cache_filename(request);
+	request_id = request->id;
+
+	if (g_file_test(request->cache_filename, G_FILE_TEST_IS_REGULAR))
 	{
-		ThemeQueueItem* item = g_new0 (ThemeQueueItem, 1);
+		g_queue_insert_sorted(&cached_queue, request, compare_requests, NULL);
 
-		item->thumbnail_type = thumbnail_type;
-		item->theme_info = theme_info;
-		item->func = func;
-		item->user_data = user_data;
-		item->destroy = destroy;
+		if (cached_idle_id == 0)
+			cached_idle_id = g_idle_add(load_cached_thumbnails, NULL);
 
-		theme_queue = g_list_append(theme_queue, item);
-
-		return;
+		return request->id;
 	}
 
-	if (!pipe_to_factory_fd[1] || !pipe_from_factory_fd[0])
-	{
-		(*func)(NULL, theme_name, user_data);
-
-		if (destroy)
-		{
-			(*destroy)(user_data);
-		}
-
-		return;
-	}
+	g_queue_insert_sorted(&theme_queue, request, compare_requests, NULL);
 
-	if (async_data.channel == NULL)
-	{
-		async_data.channel = g_io_channel_unix_new(pipe_from_factory_fd[0]);
+	dispatch_requests();
 
-		g_io_channel_set_flags(async_data.channel, g_io_channel_get_flags (async_data.channel) | G_IO_FLAG_NONBLOCK, NULL);
-		g_io_channel_set_encoding(async_data.channel, NULL, NULL);
-
-		async_data.watch_id = g_io_add_watch(async_data.channel, G_IO_IN | G_IO_HUP, message_from_child, NULL);
-	}
-
-	async_data.set = TRUE;
-	async_data.thumbnail_width = -1;
-	async_data.thumbnail_height = -1;
-	async_data.theme_name = g_strdup(theme_name);
-	async_data.func = func;
-	async_data.user_data = user_data;
-	async_data.destroy = destroy;
-
-	send_thumbnail_request(thumbnail_type, gtk_theme_name, gtk_color_scheme, marco_theme_name, icon_theme_name, application_font);
+	/* the request may be complete already, in which case the id simply
+	 * isn't found any more */
+	return request_id;
 }
 
-void
+guint
 generate_meta_theme_thumbnail_async (MateThemeMetaInfo *theme_info,
+                                     gint                priority,
                                      ThemeThumbnailFunc  func,
                                      gpointer            user_data,
                                      GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  return generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_META,
                                          theme_info->gtk_theme_name,
                                          theme_info->gtk_color_scheme,
                                          theme_info->marco_theme_name,
                                          theme_info->icon_theme_name,
                                          theme_info->application_font,
-                                         func, user_data, destroy);
+                                         priority, func, user_data, destroy);
 }
 
-void generate_gtk_theme_thumbnail_async (MateThemeInfo* theme_info, ThemeThumbnailFunc  func, gpointer user_data, GDestroyNotify destroy)
+guint generate_gtk_theme_thumbnail_async (MateThemeInfo* theme_info, gint priority, ThemeThumbnailFunc  func, gpointer user_data, GDestroyNotify destroy)
 {
 	gchar* scheme = gtkrc_get_color_scheme_for_theme(theme_info->name);
+	guint request_id;
 
-	generate_theme_thumbnail_async(theme_info, theme_info->name, THUMBNAIL_TYPE_GTK, theme_info->name, scheme,  NULL, NULL, NULL, func, user_data, destroy);
+	request_id = generate_theme_thumbnail_async(theme_info->name, THUMBNAIL_TYPE_GTK, theme_info->name, scheme,  NULL, NULL, NULL, priority, func, user_data, destroy);
 
 	g_free(scheme);
+
+	return request_id;
 }
 
-void
+guint
 generate_marco_theme_thumbnail_async (MateThemeInfo *theme_info,
+                                         gint                priority,
                                          ThemeThumbnailFunc  func,
                                          gpointer            user_data,
                                          GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  return generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_MARCO,
                                          NULL,
                                          NULL,
                                          theme_info->name,
                                          NULL,
                                          NULL,
-                                         func, user_data, destroy);
+                                         priority, func, user_data, destroy);
 }
 
-void
+guint
 generate_icon_theme_thumbnail_async (MateThemeIconInfo *theme_info,
+                                     gint                priority,
                                      ThemeThumbnailFunc  func,
                                      gpointer            user_data,
                                      GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  return generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_ICON,
                                          NULL,
                                          NULL,
                                          NULL,
                                          theme_info->name,
                                          NULL,
-                                         func, user_data, destroy);
+                                         priority, func, user_data, destroy);
 }
 
+/* Drops a request made by one of the generate_*_theme_thumbnail_async
+ * functions; its callback won't be called any more, but its destroy notify
+ * will.  A thumbnail which is being rendered already is still cached.
+ */
 void
-theme_thumbnail_factory_init (int argc, char *argv[])
+theme_thumbnail_cancel (guint request_id)
 {
-#ifndef __APPLE__
-  gint child_pid;
-#endif
+  GQueue *queues[] = { &theme_queue, &cached_queue };
+  gpointer id = GUINT_TO_POINTER (request_id);
+  guint i;
 
-  pipe (pipe_to_factory_fd);
-  pipe (pipe_from_factory_fd);
+  for (i = 0; i < G_N_ELEMENTS (queues); i++)
+  {
+    GList *link = g_queue_find_custom (queues[i], id, request_has_id);
+
+    if (link != NULL)
+    {
+      ThemeThumbnailRequest *request = link->data;
+
+      g_queue_delete_link (queues[i], link);
+      request->cancelled = TRUE;
+      complete_request (request, NULL);
+      return;
+    }
+  }
+
+  /* sent to a factory already; it is answered anyway */
+  for (i = 0; i < n_factories; i++)
+  {
+    GList *link = g_list_find_custom (factories[i].requests, id, request_has_id);
+
+    if (link != NULL)
+    {
+      ThemeThumbnailRequest *request = link->data;
+
+      request->cancelled = TRUE;
+      if (request->destroy)
+        (* request->destroy) (request->user_data);
+      request->destroy = NULL;
+      return;
+    }
+  }
+}
+
+/* Moves a request which hasn't been sent to a factory yet ahead of (or
+ * behind) the others.  Lower values go first, as with GLib's priorities;
+ * requests start with G_PRIORITY_DEFAULT.
+ */
+void
+theme_thumbnail_set_priority (guint request_id,
+                              gint  priority)
+{
+  GQueue *queues[] = { &theme_queue, &cached_queue };
+  gpointer id = GUINT_TO_POINTER (request_id);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (queues); i++)
+  {
+    GList *link = g_queue_find_custom (queues[i], id, request_has_id);
+
+    if (link != NULL)
+    {
+      ThemeThumbnailRequest *request = link->data;
+
+      if (request->priority != priority)
+      {
+        g_queue_delete_link (queues[i], link);
+        request->priority = priority;
+        g_queue_insert_sorted (queues[i], request, compare_requests, NULL);
+      }
+      return;
+    }
+  }
+}
+
+static void
+run_factory (gint   fd,
+             int    argc,
+             char  *argv[])
+{
+  ThemeThumbnailCapplet capplet;
+  GIOChannel *channel;
 
+  gtk_init (&argc, &argv);
+
+  capplet.fd = fd;
+  capplet.data = g_byte_array_new ();
+
+  channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_flags (channel, g_io_channel_get_flags (channel) |
+        G_IO_FLAG_NONBLOCK, NULL);
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_add_watch (channel, G_IO_IN | G_IO_HUP, message_from_capplet, &capplet);
+  g_io_channel_unref (channel);
+
+  gtk_main ();
+  _exit (0);
+}
+
+/* Starts the processes rendering the thumbnails.  There is one per core
+ * by default; MATE_THEME_THUMBNAIL_FACTORIES overrides that.
+ */
+void
+theme_thumbnail_factory_init (int argc, char *argv[])
+{
 /* Apple's CoreFoundation classes must not be used from forked
  * processes. Since freetype (and thus GTK) uses them, we simply
  * disable the thumbnailer on MacOS for now. That means no thumbs
  * until the thumbnailing process is rewritten, but at least we won't
  * make apps crash. */
 #ifndef __APPLE__
-  child_pid = fork ();
-  if (child_pid == 0)
+  const gchar *env;
+  guint i, n;
+
+  env = g_getenv ("MATE_THEME_THUMBNAIL_FACTORIES");
+  if (env != NULL)
+    n = CLAMP (atoi (env), 1, MAX_FACTORIES);
+  else
+    n = CLAMP (g_get_num_processors (), 1, MAX_FACTORIES);
+
+  factories = g_new0 (ThemeThumbnailFactory, n);
+
+  prune_thumbnail_cache ();
+
+  for (i = 0; i < n; i++)
   {
-    ThemeThumbnailData data;
-    GIOChannel *channel;
-
-    /* Child */
-    gtk_init (&argc, &argv);
-
-    close (pipe_to_factory_fd[1]);
-    pipe_to_factory_fd[1] = 0;
-    close (pipe_from_factory_fd[0]);
-    pipe_from_factory_fd[0] = 0;
-
-    data.status = READY_FOR_THEME;
-    data.type = g_byte_array_new ();
-    data.control_theme_name = g_byte_array_new ();
-    data.gtk_color_scheme = g_byte_array_new ();
-    data.wm_theme_name = g_byte_array_new ();
-    data.icon_theme_name = g_byte_array_new ();
-    data.application_font = g_byte_array_new ();
-
-    channel = g_io_channel_unix_new (pipe_to_factory_fd[0]);
-    g_io_channel_set_flags (channel, g_io_channel_get_flags (channel) |
-          G_IO_FLAG_NONBLOCK, NULL);
-    g_io_channel_set_encoding (channel, NULL, NULL);
-    g_io_add_watch (channel, G_IO_IN | G_IO_HUP, message_from_capplet, &data);
-    g_io_channel_unref (channel);
-
-    gtk_main ();
-    _exit (0);
-  }
+    ThemeThumbnailFactory *factory = &factories[n_factories];
+    int fds[2];
+    gint child_pid;
 
-  g_assert (child_pid > 0);
+    /* a socket rather than pipes, to pass descriptors */
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      break;
 
-  /* Parent */
-  close (pipe_to_factory_fd[0]);
-  close (pipe_from_factory_fd[1]);
-#endif /* __APPLE__ */
+    child_pid = fork ();
+    if (child_pid == 0)
+    {
+      guint j;
+
+      /* Child; it only talks to the capplet through its own socket.
+       * The watches on the earlier sockets have to go too, or they
+       * would end up reading whatever reuses their descriptors. */
+      for (j = 0; j < n_factories; j++)
+      {
+        g_source_remove (factories[j].watch_id);
+        g_io_channel_unref (factories[j].channel);
+        close (factories[j].fd);
+      }
+      close (fds[0]);
+
+      run_factory (fds[1], argc, argv);
+    }
+
+    /* Parent */
+    close (fds[1]);
 
-  async_data.set = FALSE;
-  async_data.theme_name = NULL;
-  async_data.data = g_byte_array_new ();
+    if (child_pid < 0)
+    {
+      close (fds[0]);
+      break;
+    }
+
+    factory->fd = fds[0];
+    factory->data = g_byte_array_new ();
+    g_queue_init (&factory->fds);
+
+    factory->channel = g_io_channel_unix_new (factory->fd);
+    g_io_channel_set_flags (factory->channel, g_io_channel_get_flags (factory->channel) | G_IO_FLAG_NONBLOCK, NULL);
+    g_io_channel_set_encoding (factory->channel, NULL, NULL);
+    factory->watch_id = g_io_add_watch (factory->channel, G_IO_IN | G_IO_HUP, message_from_child, factory);
+
+    n_factories++;
+  }
+#endif /* __APPLE__ */
 }
@@ -14,23 +14,34 @@ GdkPixbuf *generate_gtk_theme_thumbnail      (MateThemeInfo     *theme_info);
 GdkPixbuf *generate_marco_theme_thumbnail (MateThemeInfo     *theme_info);
 GdkPixbuf *generate_icon_theme_thumbnail     (MateThemeIconInfo *theme_info);
 
-void generate_meta_theme_thumbnail_async     (MateThemeMetaInfo *theme_info,
+/* These return an id for theme_thumbnail_cancel() and
+ * theme_thumbnail_set_priority(); requests with a lower priority value are
+ * rendered first */
+guint generate_meta_theme_thumbnail_async    (MateThemeMetaInfo *theme_info,
+                                              gint                priority,
                                               ThemeThumbnailFunc  func,
                                               gpointer            data,
                                               GDestroyNotify      destroy);
-void generate_gtk_theme_thumbnail_async      (MateThemeInfo     *theme_info,
+guint generate_gtk_theme_thumbnail_async     (MateThemeInfo     *theme_info,
+                                              gint                priority,
                                               ThemeThumbnailFunc  func,
                                               gpointer            data,
                                               GDestroyNotify      destroy);
-void generate_marco_theme_thumbnail_async (MateThemeInfo     *theme_info,
+guint generate_marco_theme_thumbnail_async (MateThemeInfo     *theme_info,
+                                              gint                priority,
                                               ThemeThumbnailFunc  func,
                                               gpointer            data,
                                               GDestroyNotify      destroy);
-void generate_icon_theme_thumbnail_async     (MateThemeIconInfo *theme_info,
+guint generate_icon_theme_thumbnail_async    (MateThemeIconInfo *theme_info,
+                                              gint                priority,
                                               ThemeThumbnailFunc  func,
                                               gpointer            data,
                                               GDestroyNotify      destroy);
 
+void theme_thumbnail_cancel                  (guint               request_id);
+void theme_thumbnail_set_priority            (guint               request_id,
+                                              gint                priority);
+
 void theme_thumbnail_factory_init            (int                 argc,
                                               char               *argv[]);
 
@@ -0,0 +1,154 @@
+/* trace-event.h - startup tracing in the Chrome trace event format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/* Tracing is enabled by pointing $MATECC_TRACE at a directory; every
+ * process then writes its events there, in <prgname>-<pid>.json.  The
+ * array is never closed, which chrome://tracing and Perfetto accept, so
+ * that a trace survives the process being killed.
+ *
+ * This header is the only implementation.  It is compiled into libcommon and
+ * libslab rather than linked from one of them, so that libslab doesn't need
+ * the capplets' private library; each passes its own category.  The
+ * functions are inline so that a library using only some of them still
+ * builds without warnings.
+ */
+
+#ifndef __TRACE_EVENT_H__
+#define __TRACE_EVENT_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <glib.h>
+
+#define TRACE_EVENT_ENV_VAR "MATECC_TRACE"
+
+static FILE     *trace_event_file;
+static pid_t     trace_event_pid;
+static gboolean  trace_event_opened;
+static GMutex    trace_event_lock;
+
+static inline gint
+trace_event_thread_id (void)
+{
+	static GPrivate thread_id = G_PRIVATE_INIT (NULL);
+	static gint last_thread_id;
+	gint id;
+
+	id = GPOINTER_TO_INT (g_private_get (&thread_id));
+	if (id == 0) {
+		id = g_atomic_int_add (&last_thread_id, 1) + 1;
+		g_private_set (&thread_id, GINT_TO_POINTER (id));
+	}
+
+	return id;
+}
+
+/* Called with trace_event_lock held.  Forked helpers, like the theme
+ * thumbnailer, get a file of their own instead of writing into their
+ * parent's.
+ */
+static inline void
+trace_event_open (const gchar *category)
+{
+	const gchar *directory;
+	gchar *basename, *filename;
+
+	if (trace_event_opened && trace_event_pid == getpid ())
+		return;
+
+	if (trace_event_file != NULL) {
+		fclose (trace_event_file);
+		trace_event_file = NULL;
+	}
+
+	trace_event_opened = TRUE;
+	trace_event_pid = getpid ();
+
+	directory = g_getenv (TRACE_EVENT_ENV_VAR);
+	if (directory == NULL || *directory == '\0')
+		return;
+
+	basename = g_strdup_printf ("%s-%d.json",
+				    g_get_prgname () ? g_get_prgname () : category,
+				    (int) trace_event_pid);
+	filename = g_build_filename (directory, basename, NULL);
+
+	trace_event_file = fopen (filename, "w");
+	if (trace_event_file != NULL)
+		fputs ("[\n", trace_event_file);
+	else
+		g_warning ("Could not open trace file %s", filename);
+
+	g_free (basename);
+	g_free (filename);
+}
+
+static inline gboolean
+trace_event_enabled (const gchar *category)
+{
+	gboolean enabled;
+
+	g_mutex_lock (&trace_event_lock);
+	trace_event_open (category);
+	enabled = (trace_event_file != NULL);
+	g_mutex_unlock (&trace_event_lock);
+
+	return enabled;
+}
+
+/* phase is "B" or "E" for the start and the end of a span, "i" for an
+ * instant event */
+static inline void
+trace_event (const gchar *category, const gchar *name, const gchar *phase)
+{
+	GString *event;
+	const gchar *p;
+
+	g_mutex_lock (&trace_event_lock);
+
+	trace_event_open (category);
+
+	if (trace_event_file == NULL) {
+		g_mutex_unlock (&trace_event_lock);
+		return;
+	}
+
+	event = g_string_new ("{\"name\":\"");
+	for (p = name; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\')
+			g_string_append_printf (event, "\\%c", *p);
+		else if ((guchar) *p < 0x20)
+			g_string_append_printf (event, "\\u%04x", (guint) *p);
+		else
+			g_string_append_c (event, *p);
+	}
+	g_string_append_printf (event,
+				"\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%" G_GINT64_FORMAT
+				",\"pid\":%d,\"tid\":%d},\n",
+				category, phase, g_get_monotonic_time (),
+				(int) trace_event_pid, trace_event_thread_id ());
+
+	fputs (event->str, trace_event_file);
+	fflush (trace_event_file);
+
+	g_mutex_unlock (&trace_event_lock);
+	g_string_free (event, TRUE);
+}
+
+#endif /* __TRACE_EVENT_H__ */
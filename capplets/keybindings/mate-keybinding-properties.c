@@ -11,6 +11,7 @@
 #include <gdk/gdkx.h>
 #include <X11/Xatom.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gdk/gdkkeysyms.h>
 
 #include "wm-common.h"
@@ -40,6 +41,13 @@ typedef struct {
   GArray *entries;
 } KeyList;
 
+typedef struct {
+  time_t mtime;
+  goffset size;
+  /* NULL if the file didn't parse */
+  KeyList *keylist;
+} CachedKeyList;
+
 typedef enum {
   COMPARISON_NONE = 0,
   COMPARISON_GT,
@@ -87,9 +95,27 @@ typedef struct
   gulong gsettings_cnxn;
   gulong gsettings_cnxn_desc;
   gulong gsettings_cnxn_cmd;
+  char *id;
 } KeyEntry;
 
+typedef struct
+{
+  guint keyval;
+  guint keycode;
+  EggVirtualModifierType mask;
+} KeyBinding;
+
 static gboolean block_accels = FALSE;
+/* The keys in the model, indexed by binding for the conflict checks
+ * and by schema, path and key to skip keys listed twice */
+static GHashTable *keys_by_binding = NULL;
+static GHashTable *keys_by_id = NULL;
+/* Kept across reloads: the parsed key files, checked against their
+ * mtime, and the GSettings of each schema and path */
+static GHashTable *keylist_cache = NULL;
+static GList *keylist_files = NULL;
+static time_t keylist_dir_mtime = 0;
+static GHashTable *settings_cache = NULL;
 static GtkWidget *custom_shortcut_dialog = NULL;
 static GtkWidget *custom_shortcut_name_entry = NULL;
 static GtkWidget *custom_shortcut_command_entry = NULL;
@@ -135,6 +161,141 @@ static char* binding_name(guint keyval, guint keycode, EggVirtualModifierType ma
     }
 }
 
+static void
+key_binding_init (KeyBinding             *binding,
+                  guint                   keyval,
+                  guint                   keycode,
+                  EggVirtualModifierType  mask)
+{
+  /* a keyval matches whatever keycode it is typed with */
+  binding->keyval = keyval;
+  binding->keycode = keyval != 0 ? 0 : keycode;
+  binding->mask = mask;
+}
+
+static guint
+key_binding_hash (gconstpointer v)
+{
+  const KeyBinding *binding = v;
+
+  return binding->keyval ^ (binding->keycode << 16) ^ (binding->mask * 31);
+}
+
+static gboolean
+key_binding_equal (gconstpointer a, gconstpointer b)
+{
+  const KeyBinding *binding_a = a;
+  const KeyBinding *binding_b = b;
+
+  return binding_a->keyval == binding_b->keyval &&
+         binding_a->keycode == binding_b->keycode &&
+         binding_a->mask == binding_b->mask;
+}
+
+static char *
+key_entry_id (const char *schema, const char *path, const char *key)
+{
+  return g_strdup_printf ("%s:%s:%s", schema, path ? path : "", key);
+}
+
+static void
+ensure_key_index (void)
+{
+  if (keys_by_binding != NULL)
+    return;
+
+  keys_by_binding = g_hash_table_new_full (key_binding_hash, key_binding_equal,
+                                           g_free, (GDestroyNotify) g_list_free);
+  keys_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+static void
+index_key_binding (KeyEntry *key_entry)
+{
+  KeyBinding binding;
+  KeyBinding *new_binding;
+  GList *list;
+
+  if (key_entry->keyval == 0 && key_entry->keycode == 0)
+    return;
+
+  key_binding_init (&binding, key_entry->keyval, key_entry->keycode, key_entry->mask);
+
+  /* the first key of a binding is the one reported as the conflict */
+  list = g_hash_table_lookup (keys_by_binding, &binding);
+  if (list != NULL)
+    list = g_list_append (list, key_entry); /* keeps the same head */
+  else
+    {
+      new_binding = g_new (KeyBinding, 1);
+      *new_binding = binding;
+      g_hash_table_insert (keys_by_binding, new_binding, g_list_append (NULL, key_entry));
+    }
+}
+
+static void
+unindex_key_binding (KeyEntry *key_entry)
+{
+  KeyBinding binding;
+  gpointer orig_binding;
+  gpointer list;
+
+  key_binding_init (&binding, key_entry->keyval, key_entry->keycode, key_entry->mask);
+
+  if (!g_hash_table_lookup_extended (keys_by_binding, &binding, &orig_binding, &list))
+    return;
+
+  g_hash_table_steal (keys_by_binding, orig_binding);
+
+  list = g_list_remove (list, key_entry);
+  if (list != NULL)
+    g_hash_table_insert (keys_by_binding, orig_binding, list);
+  else
+    g_free (orig_binding);
+}
+
+static void
+index_key_entry (KeyEntry *key_entry)
+{
+  ensure_key_index ();
+
+  g_hash_table_insert (keys_by_id, key_entry->id, key_entry);
+  index_key_binding (key_entry);
+}
+
+static void
+unindex_key_entry (KeyEntry *key_entry)
+{
+  unindex_key_binding (key_entry);
+  g_hash_table_remove (keys_by_id, key_entry->id);
+}
+
+static KeyEntry *
+find_conflicting_key (KeyEntry               *key_entry,
+                      guint                   keyval,
+                      guint                   keycode,
+                      EggVirtualModifierType  mask)
+{
+  KeyBinding binding;
+  GList *l;
+
+  if (keys_by_binding == NULL)
+    return NULL;
+
+  key_binding_init (&binding, keyval, keycode, mask);
+
+  for (l = g_hash_table_lookup (keys_by_binding, &binding); l != NULL; l = l->next)
+    {
+      KeyEntry *element = l->data;
+
+      /* no conflict with ourselves */
+      if (strcmp (element->id, key_entry->id) != 0)
+        return element;
+    }
+
+  return NULL;
+}
+
 static gboolean
 binding_from_string (const char             *str,
                      guint                  *accelerator_key,
@@ -251,7 +412,9 @@ keybinding_key_changed (GSettings *settings,
 
   key_value = g_settings_get_string (settings, key);
 
+  unindex_key_binding (key_entry);
   binding_from_string (key_value, &key_entry->keyval, &key_entry->keycode, &key_entry->mask);
+  index_key_binding (key_entry);
   key_entry->editable = g_settings_is_writable (settings, key);
 
   /* update the model */
@@ -385,6 +548,12 @@ clear_old_model (GtkBuilder *builder)
       GtkTreeIter iter;
       KeyEntry *key_entry;
 
+      if (keys_by_binding != NULL)
+        {
+          g_hash_table_remove_all (keys_by_binding);
+          g_hash_table_remove_all (keys_by_id);
+        }
+
       for (valid = gtk_tree_model_get_iter_first (model, &iter);
            valid;
            valid = gtk_tree_model_iter_next (model, &iter))
@@ -409,6 +578,7 @@ clear_old_model (GtkBuilder *builder)
               g_free (key_entry->desc_gsettings_key);
               g_free (key_entry->command);
               g_free (key_entry->cmd_gsettings_key);
+              g_free (key_entry->id);
               g_free (key_entry);
             }
         }
@@ -422,57 +592,53 @@ clear_old_model (GtkBuilder *builder)
   gtk_widget_set_size_request (actions_swindow, -1, -1);
 }
 
-typedef struct {
-  const char *key;
-  const char *path;
-  const char *schema;
-  gboolean found;
-} KeyMatchData;
-
-static gboolean key_match(GtkTreeModel* model, GtkTreePath* path, GtkTreeIter* iter, gpointer data)
+static gboolean key_is_already_shown(const char* schema, const KeyListEntry* entry)
 {
-    KeyMatchData* match_data = data;
-    KeyEntry* element = NULL;
-    gchar *element_schema = NULL;
-    gchar *element_path = NULL;
-
-    gtk_tree_model_get(model, iter,
-        KEYENTRY_COLUMN, &element,
-        -1);
+    char* id;
+    gboolean found;
 
-    if (element && element->settings && G_IS_SETTINGS(element->settings))
+    if (keys_by_id == NULL)
     {
-            g_object_get (element->settings, "schema-id", &element_schema, NULL);
-        g_object_get (element->settings, "path", &element_path, NULL);
+        return FALSE;
     }
 
-    if (element && g_strcmp0(element->gsettings_key, match_data->key) == 0
-            && g_strcmp0(element_schema, match_data->schema) == 0
-            && g_strcmp0(element_path, match_data->path) == 0)
-    {
-        match_data->found = TRUE;
-        return TRUE;
-    }
+    id = key_entry_id (schema, entry->gsettings_path, entry->name);
+    found = g_hash_table_lookup (keys_by_id, id) != NULL;
+    g_free (id);
 
-    return FALSE;
+    return found;
 }
 
-static gboolean key_is_already_shown(GtkTreeModel* model, const KeyListEntry* entry)
+static GSettings *
+get_shared_settings (const char *schema, const char *path)
 {
-    KeyMatchData data;
+  GSettings *settings;
+  char *key;
+
+  if (settings_cache == NULL)
+    settings_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, g_object_unref);
+
+  key = g_strdup_printf ("%s:%s", schema, path ? path : "");
+  settings = g_hash_table_lookup (settings_cache, key);
+
+  if (settings == NULL)
+    {
+      if (path != NULL)
+        settings = g_settings_new_with_path (schema, path);
+      else
+        settings = g_settings_new (schema);
 
-    data.key = entry->name;
-    data.schema = entry->schema;
-    data.path = entry->gsettings_path;
-    data.found = FALSE;
-    gtk_tree_model_foreach(model, key_match, &data);
+      g_hash_table_insert (settings_cache, key, settings);
+    }
+  else
+    g_free (key);
 
-    return data.found;
+  return settings;
 }
 
 static gboolean should_show_key(const KeyListEntry* entry)
 {
-    GSettings *settings;
     int value;
 
     if (entry->comparison == COMPARISON_NONE)
@@ -483,9 +649,8 @@ static gboolean should_show_key(const KeyListEntry* entry)
     g_return_val_if_fail(entry->value_key != NULL, FALSE);
     g_return_val_if_fail(entry->value_schema != NULL, FALSE);
 
-    settings = g_settings_new (entry->value_schema);
-    value = g_settings_get_int (settings, entry->value_key);
-    g_object_unref (settings);
+    value = g_settings_get_int (get_shared_settings (entry->value_schema, NULL),
+                                entry->value_key);
 
     switch (entry->comparison)
     {
@@ -527,7 +692,7 @@ count_rows_foreach (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, g
 }
 
 static void
-ensure_scrollbar (GtkBuilder *builder, int i)
+ensure_scrollbar (GtkBuilder *builder, GtkTreeModel *model, int i)
 {
   if (i == MAX_ELEMENTS_BEFORE_SCROLLING)
     {
@@ -536,8 +701,23 @@ ensure_scrollbar (GtkBuilder *builder, int i)
                                                          "actions_swindow");
       GtkWidget *treeview = _gtk_builder_get_widget (builder,
                                                      "shortcut_treeview");
+      gboolean detached;
+
+      /* the model is filled while detached from the view; show it just
+       * long enough to measure the first rows */
+      detached = gtk_tree_view_get_model (GTK_TREE_VIEW (treeview)) == NULL;
+      if (detached)
+        {
+          gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), model);
+          gtk_tree_view_expand_all (GTK_TREE_VIEW (treeview));
+        }
+
       gtk_widget_ensure_style (treeview);
       gtk_widget_size_request (treeview, &rectangle);
+
+      if (detached)
+        gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), NULL);
+
       gtk_widget_set_size_request (treeview, -1, rectangle.height);
       gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (actions_swindow),
                       GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
@@ -573,17 +753,15 @@ find_section (GtkTreeModel *model,
 
 static void
 append_keys_to_tree (GtkBuilder         *builder,
+                     GtkTreeModel       *model,
                      const gchar        *title,
                      const gchar        *schema,
                      const gchar        *package,
                      const KeyListEntry *keys_list)
 {
   GtkTreeIter parent_iter, iter;
-  GtkTreeModel *model;
   gint i, j;
 
-  model = gtk_tree_view_get_model (GTK_TREE_VIEW (gtk_builder_get_object (builder, "shortcut_treeview")));
-
   /* Try to find a section parent iter, if it already exists */
   find_section (model, &iter, title);
   parent_iter = iter;
@@ -593,7 +771,7 @@ append_keys_to_tree (GtkBuilder         *builder,
 
   /* If the header we just added is the MAX_ELEMENTS_BEFORE_SCROLLING th,
    * then we need to scroll now */
-  ensure_scrollbar (builder, i - 1);
+  ensure_scrollbar (builder, model, i - 1);
 
   for (j = 0; keys_list[j].name != NULL; j++)
     {
@@ -608,21 +786,13 @@ append_keys_to_tree (GtkBuilder         *builder,
       if (!should_show_key (&keys_list[j]))
         continue;
 
-      if (key_is_already_shown (model, &keys_list[j]))
+      if (key_is_already_shown (schema, &keys_list[j]))
         continue;
 
       key_string = keys_list[j].name;
 
-      if (keys_list[j].gsettings_path != NULL)
-        {
-          settings = g_settings_new_with_path (schema, keys_list[j].gsettings_path);
-          settings_path = g_strdup(keys_list[j].gsettings_path);
-        }
-      else
-        {
-          settings = g_settings_new (schema);
-          settings_path = NULL;
-        }
+      settings = g_object_ref (get_shared_settings (schema, keys_list[j].gsettings_path));
+      settings_path = g_strdup (keys_list[j].gsettings_path);
 
       if (keys_list[j].description_key != NULL)
         {
@@ -631,16 +801,16 @@ append_keys_to_tree (GtkBuilder         *builder,
         }
       else
         {
-          /* it's from keyfile, so description need to be translated */
-          description = keys_list[j].description;
+          /* it's from keyfile, so description need to be translated;
+           * the key list is cached, so the entry gets a copy */
           if (package)
             {
               bind_textdomain_codeset (package, "UTF-8");
-              description = dgettext (package, description);
+              description = g_strdup (dgettext (package, keys_list[j].description));
             }
           else
             {
-              description = _(description);
+              description = g_strdup (_(keys_list[j].description));
             }
         }
 
@@ -704,7 +874,10 @@ append_keys_to_tree (GtkBuilder         *builder,
       binding_from_string (key_value, &key_entry->keyval, &key_entry->keycode, &key_entry->mask);
       g_free (key_value);
 
-      ensure_scrollbar (builder, i);
+      key_entry->id = key_entry_id (schema, keys_list[j].gsettings_path, key_string);
+      index_key_entry (key_entry);
+
+      ensure_scrollbar (builder, model, i);
 
       ++i;
       gtk_tree_store_append (GTK_TREE_STORE (model), &iter, &parent_iter);
@@ -712,7 +885,6 @@ append_keys_to_tree (GtkBuilder         *builder,
       gtk_tree_store_set (GTK_TREE_STORE (model), &iter,
               KEYENTRY_COLUMN, key_entry,
               -1);
-      gtk_tree_view_expand_all (GTK_TREE_VIEW (gtk_builder_get_object (builder, "shortcut_treeview")));
     }
 
   /* Don't show an empty section */
@@ -890,71 +1062,121 @@ strv_contains (char **strv,
 }
 
 static void
-append_keys_to_tree_from_file (GtkBuilder *builder,
-                   const char *filename,
-                   char      **wm_keybindings)
+key_list_free (KeyList *keylist)
+{
+  guint i;
+
+  for (i = 0; i < keylist->entries->len; i++)
+    {
+      KeyListEntry *entry = &g_array_index (keylist->entries, KeyListEntry, i);
+
+      g_free (entry->name);
+      g_free (entry->schema);
+      g_free (entry->description);
+      g_free (entry->value_key);
+      g_free (entry->value_schema);
+    }
+
+  g_array_free (keylist->entries, TRUE);
+  g_free (keylist->name);
+  g_free (keylist->package);
+  g_free (keylist->wm_name);
+  g_free (keylist->schema);
+  g_free (keylist);
+}
+
+static void
+cached_key_list_free (CachedKeyList *cached)
+{
+  if (cached->keylist != NULL)
+    key_list_free (cached->keylist);
+  g_free (cached);
+}
+
+/* Returns the parsed file, which stays owned by the cache */
+static const KeyList *
+load_key_list (const char *filename)
 {
   GMarkupParseContext *ctx;
   GMarkupParser parser = { parse_start_tag, NULL, NULL, NULL, NULL };
+  CachedKeyList *cached;
   KeyList *keylist;
-  KeyListEntry key, *keys;
+  KeyListEntry key;
+  GStatBuf st;
   GError *err = NULL;
   char *buf;
-  const char *title;
   gsize buf_len;
-  guint i;
+
+  if (g_stat (filename, &st) != 0)
+    return NULL;
+
+  if (keylist_cache == NULL)
+    keylist_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, (GDestroyNotify) cached_key_list_free);
+
+  cached = g_hash_table_lookup (keylist_cache, filename);
+  if (cached != NULL && cached->mtime == st.st_mtime && cached->size == st.st_size)
+    return cached->keylist;
 
   if (!g_file_get_contents (filename, &buf, &buf_len, &err))
-    return;
+    {
+      g_error_free (err);
+      return NULL;
+    }
 
   keylist = g_new0 (KeyList, 1);
   keylist->entries = g_array_new (FALSE, TRUE, sizeof (KeyListEntry));
   ctx = g_markup_parse_context_new (&parser, 0, keylist, NULL);
 
-  if (!g_markup_parse_context_parse (ctx, buf, buf_len, &err))
+  if (g_markup_parse_context_parse (ctx, buf, buf_len, &err))
+    {
+      /* Empty KeyListEntry to end the array */
+      memset (&key, 0, sizeof (KeyListEntry));
+      key.comparison = COMPARISON_NONE;
+      g_array_append_val (keylist->entries, key);
+    }
+  else
     {
       g_warning ("Failed to parse '%s': '%s'", filename, err->message);
       g_error_free (err);
-      g_free (keylist->name);
-      g_free (keylist->package);
-      g_free (keylist->wm_name);
-      g_free (keylist->schema);
-      for (i = 0; i < keylist->entries->len; i++)
-        g_free (((KeyListEntry *) &(keylist->entries->data[i]))->name);
-      g_array_free (keylist->entries, TRUE);
-      g_free (keylist);
+      key_list_free (keylist);
       keylist = NULL;
     }
   g_markup_parse_context_free (ctx);
   g_free (buf);
 
+  cached = g_new0 (CachedKeyList, 1);
+  cached->mtime = st.st_mtime;
+  cached->size = st.st_size;
+  cached->keylist = keylist;
+  g_hash_table_replace (keylist_cache, g_strdup (filename), cached);
+
+  return keylist;
+}
+
+static void
+append_keys_to_tree_from_file (GtkBuilder   *builder,
+                               GtkTreeModel *model,
+                               const char   *filename,
+                               char        **wm_keybindings)
+{
+  const KeyList *keylist;
+  const KeyListEntry *keys;
+  const char *title;
+
+  keylist = load_key_list (filename);
   if (keylist == NULL)
     return;
 
+  keys = (const KeyListEntry *) keylist->entries->data;
+
   /* If there's no keys to add, or the settings apply to a window manager
    * that's not the one we're running */
-  if (keylist->entries->len == 0
+  if (keys[0].name == NULL
       || (keylist->wm_name != NULL && !strv_contains (wm_keybindings, keylist->wm_name))
       || keylist->name == NULL)
-    {
-      g_free (keylist->name);
-      g_free (keylist->package);
-      g_free (keylist->wm_name);
-      g_free (keylist->schema);
-      g_array_free (keylist->entries, TRUE);
-      g_free (keylist);
-      return;
-    }
-
-  /* Empty KeyListEntry to end the array */
-  key.name = NULL;
-  key.description_key = NULL;
-  key.value_key = NULL;
-  key.value = 0;
-  key.comparison = COMPARISON_NONE;
-  g_array_append_val (keylist->entries, key);
+    return;
 
-  keys = (KeyListEntry *) g_array_free (keylist->entries, FALSE);
   if (keylist->package)
     {
       bind_textdomain_codeset (keylist->package, "UTF-8");
@@ -963,17 +1185,11 @@ append_keys_to_tree_from_file (GtkBuilder *builder,
       title = _(keylist->name);
     }
 
-  append_keys_to_tree (builder, title, keylist->schema, keylist->package, keys);
-
-  g_free (keylist->name);
-  g_free (keylist->package);
-  for (i = 0; keys[i].name != NULL; i++)
-    g_free (keys[i].name);
-  g_free (keylist);
+  append_keys_to_tree (builder, model, title, keylist->schema, keylist->package, keys);
 }
 
 static void
-append_keys_to_tree_from_gsettings (GtkBuilder *builder, const gchar *gsettings_path)
+append_keys_to_tree_from_gsettings (GtkBuilder *builder, GtkTreeModel *model, const gchar *gsettings_path)
 {
   gchar **custom_list;
   GArray *entries;
@@ -1017,7 +1233,7 @@ append_keys_to_tree_from_gsettings (GtkBuilder *builder, const gchar *gsettings_
       g_array_append_val (entries, key);
 
       keys = (KeyListEntry *) entries->data;
-      append_keys_to_tree (builder, _("Custom Shortcuts"), CUSTOM_KEYBINDING_SCHEMA, NULL, keys);
+      append_keys_to_tree (builder, model, _("Custom Shortcuts"), CUSTOM_KEYBINDING_SCHEMA, NULL, keys);
       for (i = 0; i < entries->len; ++i)
         {
           g_free (keys[i].name);
@@ -1030,50 +1246,72 @@ append_keys_to_tree_from_gsettings (GtkBuilder *builder, const gchar *gsettings_
   g_array_free (entries, TRUE);
 }
 
-static void
-reload_key_entries (GtkBuilder *builder)
+/* The sorted names of the key files, read again when the directory changes */
+static GList *
+get_key_list_files (void)
 {
-  gchar **wm_keybindings;
+  GStatBuf st;
   GDir *dir;
   const char *name;
-  GList *list, *l;
 
-  wm_keybindings = wm_common_get_current_keybindings();
+  if (g_stat (MATECC_KEYBINDINGS_DIR, &st) != 0)
+    return NULL;
 
-  clear_old_model (builder);
+  if (keylist_files != NULL && st.st_mtime == keylist_dir_mtime)
+    return keylist_files;
+
+  g_list_free_full (keylist_files, g_free);
+  keylist_files = NULL;
+  keylist_dir_mtime = st.st_mtime;
 
   dir = g_dir_open (MATECC_KEYBINDINGS_DIR, 0, NULL);
   if (!dir)
-      return;
+      return NULL;
 
-  list = NULL;
   for (name = g_dir_read_name (dir) ; name ; name = g_dir_read_name (dir))
     {
       if (g_str_has_suffix (name, ".xml"))
         {
-      list = g_list_insert_sorted (list, g_strdup (name),
-                       (GCompareFunc) g_ascii_strcasecmp);
-    }
+          keylist_files = g_list_insert_sorted (keylist_files,
+                                                g_build_filename (MATECC_KEYBINDINGS_DIR, name, NULL),
+                                                (GCompareFunc) g_ascii_strcasecmp);
+        }
     }
   g_dir_close (dir);
 
-  for (l = list; l != NULL; l = l->next)
-    {
-        gchar *path;
+  return keylist_files;
+}
 
-    path = g_build_filename (MATECC_KEYBINDINGS_DIR, l->data, NULL);
-        append_keys_to_tree_from_file (builder, path, wm_keybindings);
-    g_free (l->data);
-    g_free (path);
-    }
-  g_list_free (list);
+static void
+reload_key_entries (GtkBuilder *builder)
+{
+  GtkTreeView *tree_view;
+  GtkTreeModel *model;
+  gchar **wm_keybindings;
+  GList *l;
+
+  wm_keybindings = wm_common_get_current_keybindings();
+
+  clear_old_model (builder);
+
+  /* Fill the model in one go while the view isn't watching it */
+  tree_view = GTK_TREE_VIEW (gtk_builder_get_object (builder, "shortcut_treeview"));
+  model = g_object_ref (gtk_tree_view_get_model (tree_view));
+  gtk_tree_view_set_model (tree_view, NULL);
+
+  for (l = get_key_list_files (); l != NULL; l = l->next)
+    append_keys_to_tree_from_file (builder, model, l->data, wm_keybindings);
 
   /* Load custom shortcuts _after_ system-provided ones,
    * since some of the custom shortcuts may also be listed
    * in a file. Loading the custom shortcuts last makes
    * such keys not show up in the custom section.
    */
-  append_keys_to_tree_from_gsettings (builder, GSETTINGS_KEYBINDINGS_DIR);
+  append_keys_to_tree_from_gsettings (builder, model, GSETTINGS_KEYBINDINGS_DIR);
+
+  gtk_tree_view_set_model (tree_view, model);
+  gtk_tree_view_expand_all (tree_view);
+  g_object_unref (model);
 
   g_strfreev (wm_keybindings);
 }
@@ -1084,66 +1322,6 @@ key_entry_controlling_key_changed (GSettings *settings, gchar *key, gpointer use
   reload_key_entries (user_data);
 }
 
-static gboolean cb_check_for_uniqueness(GtkTreeModel* model, GtkTreePath* path, GtkTreeIter* iter, KeyEntry* new_key)
-{
-    KeyEntry* element;
-
-    gtk_tree_model_get (new_key->model, iter,
-        KEYENTRY_COLUMN, &element,
-        -1);
-
-    /* no conflict for : blanks, different modifiers, or ourselves */
-    if (element == NULL || new_key->mask != element->mask)
-    {
-        return FALSE;
-    }
-    
-    gchar *new_key_schema = NULL;
-    gchar *element_schema = NULL;
-    gchar *new_key_path = NULL;
-    gchar *element_path = NULL;
-
-    if (new_key && new_key->settings)
-    {
-            g_object_get (new_key->settings, "schema-id", &new_key_schema, NULL);
-        g_object_get (new_key->settings, "path", &new_key_path, NULL);
-    }
-    
-    if (element->settings)
-    {
-            g_object_get (element->settings, "schema-id", &element_schema, NULL);
-        g_object_get (element->settings, "path", &element_path, NULL);
-    }
-
-    if (!g_strcmp0 (new_key->gsettings_key, element->gsettings_key) &&
-        !g_strcmp0 (new_key_schema, element_schema) &&
-        !g_strcmp0 (new_key_path, element_path))
-    {
-        return FALSE;
-    }
-
-    if (new_key->keyval != 0)
-    {
-        if (new_key->keyval != element->keyval)
-        {
-            return FALSE;
-        }
-    }
-    else if (element->keyval != 0 || new_key->keycode != element->keycode)
-    {
-        return FALSE;
-    }
-
-    new_key->editable = FALSE;
-    new_key->settings = element->settings;
-    new_key->gsettings_key = element->gsettings_key;
-    new_key->description = element->description;
-    new_key->desc_gsettings_key = element->desc_gsettings_key;
-    new_key->desc_editable = element->desc_editable;
-
-    return TRUE;
-}
-
 static const guint forbidden_keyvals[] = {
     /* Navigation keys */
     GDK_KEY_Home,
@@ -1201,7 +1379,7 @@ static void accel_edited_callback(GtkCellRendererText* cell, const char* path_st
     GtkTreeModel* model;
     GtkTreePath* path = gtk_tree_path_new_from_string (path_string);
     GtkTreeIter iter;
-    KeyEntry* key_entry, tmp_key;
+    KeyEntry* key_entry, *conflict, tmp_key;
     char* str;
 
     block_accels = FALSE;
@@ -1231,9 +1409,21 @@ static void accel_edited_callback(GtkCellRendererText* cell, const char* path_st
     tmp_key.description = NULL;
     tmp_key.editable = TRUE; /* kludge to stuff in a return flag */
 
-    if (keyval != 0 || keycode != 0) /* any number of keys can be disabled */
+    /* any number of keys can be disabled */
+    conflict = NULL;
+    if (keyval != 0 || keycode != 0)
+    {
+        conflict = find_conflicting_key (key_entry, keyval, keycode, mask);
+    }
+
+    if (conflict != NULL)
     {
-        gtk_tree_model_foreach(model, (GtkTreeModelForeachFunc) cb_check_for_uniqueness, &tmp_key);
+        tmp_key.editable = FALSE;
+        tmp_key.settings = conflict->settings;
+        tmp_key.gsettings_key = conflict->gsettings_key;
+        tmp_key.description = conflict->description;
+        tmp_key.desc_gsettings_key = conflict->desc_gsettings_key;
+        tmp_key.desc_editable = conflict->desc_editable;
     }
 
     /* Check for unmodified keys */
@@ -1482,6 +1672,8 @@ remove_custom_shortcut (GtkTreeModel *model, GtkTreeIter *iter)
   if (key->gsettings_cnxn_cmd != 0)
     g_signal_handler_disconnect (key->settings, key->gsettings_cnxn_cmd);
 
+  unindex_key_entry (key);
+
   dconf_util_recursive_reset (key->gsettings_path, NULL);
   g_object_unref (key->settings);
 
@@ -1491,6 +1683,7 @@ remove_custom_shortcut (GtkTreeModel *model, GtkTreeIter *iter)
   g_free (key->desc_gsettings_key);
   g_free (key->command);
   g_free (key->cmd_gsettings_key);
+  g_free (key->id);
   g_free (key);
 
   gtk_tree_model_iter_parent (model, &parent, iter);
@@ -1612,6 +1805,9 @@ add_custom_shortcut (GtkTreeView  *tree_view,
       gtk_tree_store_append (GTK_TREE_STORE (model), &iter, &parent_iter);
       gtk_tree_store_set (GTK_TREE_STORE (model), &iter, KEYENTRY_COLUMN, key_entry, -1);
 
+      key_entry->id = key_entry_id (CUSTOM_KEYBINDING_SCHEMA, key_entry->gsettings_path, key_entry->gsettings_key);
+      index_key_entry (key_entry);
+
       /* store in gsettings */
       key_entry->settings = g_settings_new_with_path (CUSTOM_KEYBINDING_SCHEMA, key_entry->gsettings_path);
       g_settings_set_string (key_entry->settings, key_entry->gsettings_key, "disabled");
@@ -24,6 +24,7 @@
 
 #include <libmate-desktop/mate-desktop-item.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <sys/types.h>
@@ -38,13 +39,119 @@
 #include "app-resizer.h"
 #include "slab-section.h"
 #include "slab-mate-util.h"
+#include "libslab-utils.h"
 #include "search-bar.h"
 
 #include "application-tile.h"
 #include "themed-icon.h"
 
-#define TILE_EXEC_NAME "Tile_desktop_exec_name"
 #define SECONDS_IN_DAY 86400
+#define INITIAL_LAYOUT_LAUNCHERS 30	/* about a screenful, the rest is laid out once shown */
+
+/* The launchers parsed from the desktop files are kept in a cache, so they only need
+   to be parsed again when the directories holding them change. A launcher record is
+   what create_launcher () needs: whether it's an application, location, name,
+   generic name, exec name, search key, exec line, categories and mtime. The names
+   are localized, so the cache is only good for the languages it was written in */
+#define LAUNCHER_CACHE_VERSION 2
+#define LAUNCHER_RECORD_TYPE "(bssmsssst)"
+/* version, languages, directory -> mtime, desktop file -> record */
+#define LAUNCHER_CACHE_TYPE "(usa{st}a{s" LAUNCHER_RECORD_TYPE "})"
+
+/* What a launcher shows; its tile is only made once it is laid out */
+typedef struct _LauncherData LauncherData;
+
+struct _LauncherData
+{
+	gchar *location;	/* the desktop item the tile is made from */
+	gchar *name;
+	gchar *description;
+	gchar *exec_name;
+	gchar *search_key;	/* folded name, description, exec name and keywords */
+
+	gchar *desktop_file;	/* with mtime, to reuse it across menu reloads; may be NULL */
+	gsize mtime;
+	GVariant *record;	/* what it was made from, so a reload needn't parse it again */
+
+	GtkWidget *tile;
+};
+
+/* The state of the shell kept out of the public AppShellData, so its layout stays
+   the same. appshelldata_new () allocates this in its place */
+typedef struct
+{
+	AppShellData app_data;
+
+	GArray *search_index;	/* SearchIndexEntry for every launcher, built with the categories */
+	gchar *search_filter;	/* the folded filter search_index was last matched against */
+	GList *old_categories_list;	/* while reloading the menu, the categories not reused yet */
+	GThread *catalog_thread;	/* loading the menu, see generate_categories_async () */
+	gboolean catalog_reload_pending;
+} AppShellPrivate;
+
+#define APP_SHELL_PRIVATE(app_data) ((AppShellPrivate *) (app_data))
+
+/* The AppShellData made by appshelldata_new (), so that one allocated by the caller,
+   without the private part, is refused rather than written past */
+static GHashTable *app_shells;
+
+#define IS_APP_SHELL(app_data) (app_shells && g_hash_table_contains (app_shells, (app_data)))
+
+/* Likewise for CategoryData; every category is allocated as one of these */
+typedef struct
+{
+	CategoryData category;
+
+	GList *launchers;	/* LauncherData, sorted; the public launcher_list stays empty */
+	GList *filtered_launchers;	/* the launchers matching the filter */
+	GHashTable *old_launchers;	/* while reloading the menu, desktop file -> LauncherData not reused yet */
+} CategoryPrivate;
+
+#define CATEGORY_PRIVATE(cat_data) ((CategoryPrivate *) (cat_data))
+
+typedef struct
+{
+	CategoryData *category;
+	LauncherData *launcher;
+	const gchar *key;	/* launcher->search_key */
+	gboolean matched;
+	gint score;	/* how well it matched search_filter */
+} SearchIndexEntry;
+
+/* An entry of new_apps->garray */
+typedef struct
+{
+	long time;
+	LauncherData *launcher;
+} NewLauncherData;
+
+/* A category of the menu tree and the launchers parsed from its desktop files */
+typedef struct
+{
+	gchar *name;
+	GList *desktop_files;	/* in menu order, without duplicates */
+	GList *launchers;	/* LauncherData without tiles */
+} CatalogCategory;
+
+/* Everything generate_categories () needs from the menu and the desktop files.
+   The menu tree is walked on the main loop, since matemenu updates it from there;
+   the desktop files are then parsed by a thread which touches neither GTK nor
+   app_data, and the catalog is left alone once handed back to the main loop */
+typedef struct
+{
+	AppShellData *app_data;
+	gboolean command_line_lockdown;
+	GHashTable *programs;	/* program name -> whether it is in PATH, plus one */
+	gchar *cache_file;
+	/* on a menu reload: the records of the current launchers, desktop file -> record,
+	   and whether each desktop file is checked for changes itself, since a file
+	   changed in place doesn't change the mtime of its directory */
+	GHashTable *known_records;
+	gboolean check_files;
+
+	GList *categories;	/* CatalogCategory, in menu order */
+	gboolean failed;	/* no menu, or an empty one */
+} LauncherCatalog;
 #define CC_SCHEMA "org.mate.control-center"
 #define EXIT_SHELL_ON_ACTION_START "cc-exit-shell-on-action-start"
 #define EXIT_SHELL_ON_ACTION_HELP "cc-exit-shell-on-action-help"
@@ -57,12 +164,15 @@ static GtkWidget *create_groups_section (AppShellData * app_data, const gchar *
 static GtkWidget *create_actions_section (AppShellData * app_data, const gchar * title,
 	void (*actions_handler) (Tile *, TileEvent *, gpointer));
 
-static void generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data, gboolean recursive);
-static void generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data,
-	CategoryData * cat_data, gboolean recursive);
+static void generate_category (CatalogCategory * category, AppShellData * app_data);
 static void generate_new_apps (AppShellData * app_data);
-static void insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * desktop_item,
-	AppShellData * app_data);
+static GVariant *create_launcher_record (MateDesktopItem * desktop_item, gsize mtime);
+static LauncherData *create_launcher (LauncherCatalog * catalog, GVariant * record);
+static void add_launcher_to_category (CategoryData * cat_data, LauncherData * launcher);
+static gboolean check_specific_apps_hack (LauncherCatalog * catalog, const gchar * exec,
+	const gchar * categories);
+static gsize get_desktop_file_mtime (const gchar * desktop_file);
+static gboolean catalog_loaded_idle (gpointer user_data);
 
 static gboolean main_keypress_callback (GtkWidget * widget, GdkEventKey * event,
 	AppShellData * app_data);
@@ -78,8 +188,11 @@ static gboolean handle_filter_changed (NldSearchBar * search_bar, int context, c
 static void handle_group_clicked (Tile * tile, TileEvent * event, gpointer user_data);
 static void set_state (AppShellData * app_data, GtkWidget * widget);
 static void populate_groups_section (AppShellData * app_data);
-static void generate_filtered_lists (gpointer catdata, gpointer user_data);
+static void generate_search_index (AppShellData * app_data);
+static void generate_filtered_lists (AppShellData * app_data);
 static void show_no_results_message (AppShellData * app_data, GtkWidget * containing_vbox);
+static void populate_application_category_sections_initial (AppShellData * app_data,
+	GtkWidget * containing_vbox);
 static void populate_application_category_sections (AppShellData * app_data,
 	GtkWidget * containing_vbox);
 static void populate_application_category_section (AppShellData * app_data, SlabSection * section,
@@ -89,6 +202,8 @@ static void handle_launcher_single_clicked (Tile * launcher, gpointer data);
 static void handle_menu_action_performed (Tile * launcher, TileEvent * event, TileAction * action,
 	gpointer data);
 static gint application_launcher_compare (gconstpointer a, gconstpointer b);
+static GtkWidget *get_launcher_tile (AppShellData * app_data, LauncherData * launcher);
+static LauncherData *copy_launcher (LauncherData * launcher);
 static void matemenu_tree_changed_callback (MateMenuTree * tree, gpointer user_data);
 gboolean regenerate_categories (AppShellData * app_data);
 
@@ -152,11 +267,11 @@ generate_potential_apps (gpointer catdata, gpointer user_data)
 	CategoryData *data = (CategoryData *) catdata;
 	gchar *uri;
 
-	GList *launcher_list = data->filtered_launcher_list;
+	GList *launcher_list = CATEGORY_PRIVATE (data)->filtered_launchers;
 
 	while (launcher_list)
 	{
-		g_object_get (launcher_list->data, "tile-uri", &uri, NULL);
+		uri = g_strdup (((LauncherData *) launcher_list->data)->location);
 		/* eliminate dups of same app in multiple categories */
 		if (!g_hash_table_lookup (app_hash, uri))
 			g_hash_table_insert (app_hash, uri, launcher_list->data);
@@ -182,10 +297,11 @@ launch_selected_app (AppShellData * app_data)
 	num_apps = g_hash_table_size (app_hash);
 	if (num_apps == 1)
 	{
-		ApplicationTile *launcher =
-			APPLICATION_TILE (g_hash_table_find (app_hash, return_first_entry, NULL));
+		LauncherData *launcher = g_hash_table_find (app_hash, return_first_entry, NULL);
+		GtkWidget *tile = get_launcher_tile (app_data, launcher);
 		g_hash_table_destroy (app_hash);
-		handle_launcher_single_clicked (TILE (launcher), app_data);
+		if (tile)
+			handle_launcher_single_clicked (TILE (tile), app_data);
 		return;
 	}
 
@@ -246,6 +362,8 @@ layout_shell (AppShellData * app_data, const gchar * filter_title, const gchar *
 	GtkWidget *groups_section;
 	GtkWidget *actions_section;
 
+	g_return_if_fail (IS_APP_SHELL (app_data));
+
 	GtkWidget *left_vbox;
 	GtkWidget *right_vbox;
 	gint num_cols;
@@ -277,10 +395,14 @@ layout_shell (AppShellData * app_data, const gchar * filter_title, const gchar *
 	adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (sw));
 	g_object_set (adjustment, "step-increment", (double) 20, NULL);
 
-	create_application_category_sections (app_data);
-	populate_application_category_sections (app_data, right_vbox);
-	app_resizer_set_table_cache (APP_RESIZER (app_data->category_layout),
-		app_data->cached_tables_list);
+	/* without categories yet, they are filled in once generate_categories_async () is done */
+	if (app_data->categories_list)
+	{
+		create_application_category_sections (app_data);
+		populate_application_category_sections_initial (app_data, right_vbox);
+		app_resizer_set_table_cache (APP_RESIZER (app_data->category_layout),
+			app_data->cached_tables_list);
+	}
 
 	gtk_container_set_focus_vadjustment (GTK_CONTAINER (right_vbox),
 		gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (sw)));
@@ -293,7 +415,8 @@ layout_shell (AppShellData * app_data, const gchar * filter_title, const gchar *
 
 	groups_section = create_groups_section (app_data, groups_title);
 	app_data->groups_section = groups_section;
-	populate_groups_section (app_data);
+	if (app_data->categories_list)
+		populate_groups_section (app_data);
 	gtk_box_pack_start (GTK_BOX (left_vbox), groups_section, FALSE, FALSE, 0);
 
 	actions_section = create_actions_section (app_data, actions_title, actions_handler);
@@ -313,14 +436,16 @@ relayout_shell_partial (gpointer user_data)
 	if (app_data->stop_incremental_relayout)
 		return FALSE;
 
+	libslab_trace_begin ("relayout_shell_partial");
+
 	if (app_data->incremental_relayout_cat_list != NULL)
 	{
 		/* There are still categories to layout */
 		data = (CategoryData *) app_data->incremental_relayout_cat_list->data;
-		if (data->filtered_launcher_list != NULL)
+		if (CATEGORY_PRIVATE (data)->filtered_launchers != NULL)
 		{
 			populate_application_category_section (app_data, data->section,
-				data->filtered_launcher_list);
+				CATEGORY_PRIVATE (data)->filtered_launchers);
 			gtk_box_pack_start (GTK_BOX (vbox), GTK_WIDGET (data->section), TRUE, TRUE,
 				0);
 			app_data->filtered_out_everything = FALSE;
@@ -328,6 +453,8 @@ relayout_shell_partial (gpointer user_data)
 
 		app_data->incremental_relayout_cat_list =
 			g_list_next (app_data->incremental_relayout_cat_list);
+
+		libslab_trace_end ("relayout_shell_partial");
 		return TRUE;
 	}
 
@@ -340,9 +467,12 @@ relayout_shell_partial (gpointer user_data)
 	populate_groups_section (app_data);
 
 	gtk_widget_show_all (app_data->category_layout);
-	gdk_window_set_cursor (gtk_widget_get_window (app_data->shell), NULL);
+	if (gtk_widget_get_window (app_data->shell))
+		gdk_window_set_cursor (gtk_widget_get_window (app_data->shell), NULL);
 
 	app_data->stop_incremental_relayout = TRUE;
+
+	libslab_trace_end ("relayout_shell_partial");
 	return FALSE;
 }
 
@@ -456,7 +586,7 @@ populate_groups_section (AppShellData * app_data)
 	do
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
-		if (NULL != data->filtered_launcher_list)
+		if (NULL != CATEGORY_PRIVATE (data)->filtered_launchers)
 		{
 			gtk_widget_set_state (GTK_WIDGET (data->group_launcher), GTK_STATE_NORMAL);
 			gtk_box_pack_start (GTK_BOX (vbox), GTK_WIDGET (data->group_launcher),
@@ -491,7 +621,7 @@ handle_group_clicked (Tile * tile, TileEvent * event, gpointer user_data)
 			break;
 		}
 
-		if (NULL != cat_data->filtered_launcher_list)
+		if (NULL != CATEGORY_PRIVATE (cat_data)->filtered_launchers)
 		{
 			gtk_widget_get_allocation (GTK_WIDGET (cat_data->section), &allocation);
 			total += allocation.height +
@@ -548,8 +678,14 @@ handle_filter_changed_delayed (gpointer user_data)
 {
 	AppShellData *app_data = (AppShellData *) user_data;
 
-	g_list_foreach (app_data->categories_list, generate_filtered_lists,
-		(gpointer) app_data->filter_string);
+	/* still loading, the filter is applied once the categories are in */
+	if (!app_data->categories_list)
+	{
+		app_data->filter_changed_timeout = 0;
+		return FALSE;
+	}
+
+	generate_filtered_lists (app_data);
 	app_data->last_clicked_launcher = NULL;
 
 	/*  showing the updates incremtally is very visually distracting. Much worse than just blanking until
@@ -595,63 +731,277 @@ handle_filter_changed (NldSearchBar * search_bar, int context, const char *text,
 	return FALSE;
 }
 
+static gchar *
+search_fold (const gchar * text)
+{
+	gchar *folded;
+	gchar *normalized;
+	gchar *p, *q;
+
+	if (!g_utf8_validate (text, -1, NULL))
+		return g_strdup ("");
+
+	folded = g_utf8_casefold (text, -1);
+	normalized = g_utf8_normalize (folded, -1, G_NORMALIZE_ALL);
+	g_free (folded);
+
+	/* drop the accents the decomposition split off, so that "e" finds "é" */
+	for (p = q = normalized; *p; p = g_utf8_next_char (p))
+	{
+		gunichar c = g_utf8_get_char (p);
+
+		if (!g_unichar_ismark (c))
+			q += g_unichar_to_utf8 (c, q);
+	}
+	*q = '\0';
+
+	return normalized;
+}
+
+#define SEARCH_SCORE_MATCH       16
+#define SEARCH_BONUS_WORD_START  8	/* also makes acronyms like "kb" rank well */
+#define SEARCH_BONUS_CONSECUTIVE 8
+#define SEARCH_BONUS_FIELD_START 8
+#define SEARCH_PENALTY_GAP       1
+
+/* Scores query as a subsequence of one field of a search key, -1 if it isn't one. Every
+   occurrence of the first character is tried as a start, matching the rest greedily from it. */
+static gint
+search_score_field (const gchar * field, const gchar * field_end, const gunichar * query,
+	glong query_len)
+{
+	const gchar *start;
+	gint best = -1;
+
+	for (start = field; start < field_end; start = g_utf8_next_char (start))
+	{
+		const gchar *p;
+		gunichar prev;
+		gboolean consecutive = FALSE;
+		gint score = 0;
+		glong i = 0;
+
+		if (g_utf8_get_char (start) != query[0])
+			continue;
+
+		prev = (start == field) ? 0 : g_utf8_get_char (g_utf8_prev_char (start));
+
+		for (p = start; p < field_end && i < query_len; p = g_utf8_next_char (p))
+		{
+			gunichar c = g_utf8_get_char (p);
+
+			if (c == query[i])
+			{
+				score += SEARCH_SCORE_MATCH;
+				if (!prev || !g_unichar_isalnum (prev))
+					score += SEARCH_BONUS_WORD_START;
+				if (consecutive)
+					score += SEARCH_BONUS_CONSECUTIVE;
+				consecutive = TRUE;
+				i++;
+			}
+			else
+			{
+				score -= SEARCH_PENALTY_GAP;
+				consecutive = FALSE;
+			}
+
+			prev = c;
+		}
+
+		/* starting later won't find the rest either */
+		if (i < query_len)
+			break;
+
+		if (start == field)
+			score += SEARCH_BONUS_FIELD_START;
+
+		/* a match after long gaps is still a match */
+		best = MAX (best, MAX (score, 0));
+	}
+
+	return best;
+}
+
+/* Scores query against a search key, -1 if it doesn't match. A match in the name, the
+   first field, counts twice as much as one in the description, exec name or keywords. */
+static gint
+search_score (const gchar * key, const gunichar * query, glong query_len)
+{
+	const gchar *field = key;
+	gint best = -1;
+
+	if (query_len == 0)
+		return 0;
+
+	while (TRUE)
+	{
+		const gchar *field_end = strchr (field, '\n');
+		gint score;
+
+		if (!field_end)
+			field_end = field + strlen (field);
+
+		score = search_score_field (field, field_end, query, query_len);
+		if (score >= 0)
+			best = MAX (best, field == key ? score : score / 2);
+
+		if (!*field_end)
+			break;
+		field = field_end + 1;
+	}
+
+	return best;
+}
+
+/* best first, alphabetically (the order of the index) among equals */
+static gint
+search_index_entry_compare (gconstpointer a, gconstpointer b)
+{
+	const SearchIndexEntry *entry_a = *(SearchIndexEntry * const *) a;
+	const SearchIndexEntry *entry_b = *(SearchIndexEntry * const *) b;
+
+	if (entry_a->score != entry_b->score)
+		return entry_b->score - entry_a->score;
+
+	return (entry_a > entry_b) - (entry_a < entry_b);
+}
+
 static void
-generate_filtered_lists (gpointer catdata, gpointer user_data)
+generate_search_index (AppShellData * app_data)
 {
-	CategoryData *data = (CategoryData *) catdata;
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
+	GList *cat_list;
+	GList *launcher_list;
 
-	/* Fixme - everywhere you use ascii you need to fix up for multibyte */
-	gchar *filter_string = g_ascii_strdown (user_data, -1);
-	gchar *temp1, *temp2;
-	GList *launcher_list = data->launcher_list;
+	if (priv->search_index)
+		g_array_free (priv->search_index, TRUE);
+	priv->search_index = g_array_new (FALSE, FALSE, sizeof (SearchIndexEntry));
 
-	g_list_free (data->filtered_launcher_list);
-	data->filtered_launcher_list = NULL;
+	g_free (priv->search_filter);
+	priv->search_filter = NULL;
 
-	do
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
 	{
-		ApplicationTile *launcher = APPLICATION_TILE (launcher_list->data);
-		const gchar *filename;
+		CategoryData *data = (CategoryData *) cat_list->data;
+
+		for (launcher_list = CATEGORY_PRIVATE (data)->launchers; launcher_list;
+			launcher_list = g_list_next (launcher_list))
+		{
+			SearchIndexEntry entry;
 
-		temp1 = NULL;
-		temp2 = NULL;
+			entry.category = data;
+			entry.launcher = launcher_list->data;
+			entry.key = entry.launcher->search_key;
+			entry.matched = TRUE;
+			entry.score = 0;
+
+			g_array_append_val (priv->search_index, entry);
+		}
+	}
+}
+
+static void
+generate_filtered_lists (AppShellData * app_data)
+{
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
+	gchar *filter_string;
+	gunichar *query;
+	glong query_len;
+	gboolean narrowing;
+	GPtrArray *matches;
+	GList *cat_list;
+	guint i;
+
+	filter_string = search_fold (app_data->filter_string ? app_data->filter_string : "");
+	query = g_utf8_to_ucs4_fast (filter_string, -1, &query_len);
+
+	/* Anything matching the new filter also matched the last one if it only got longer,
+	   so only what is still shown has to be looked at while typing */
+	narrowing = priv->search_filter && g_str_has_prefix (filter_string, priv->search_filter);
+
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
+	{
+		CategoryData *data = (CategoryData *) cat_list->data;
+
+		g_list_free (CATEGORY_PRIVATE (data)->filtered_launchers);
+		CATEGORY_PRIVATE (data)->filtered_launchers = NULL;
+	}
+
+	matches = g_ptr_array_sized_new (priv->search_index->len);
+
+	for (i = 0; i < priv->search_index->len; i++)
+	{
+		SearchIndexEntry *entry =
+			&g_array_index (priv->search_index, SearchIndexEntry, i);
 
 		/* Since the filter may remove this entry from the
 		   container it will not get a mouse out event */
-		gtk_widget_set_state (GTK_WIDGET (launcher), GTK_STATE_NORMAL);
-		filename = g_object_get_data (G_OBJECT (launcher), TILE_EXEC_NAME); /* do I need to free this */
-
-		temp1 = g_ascii_strdown (launcher->name, -1);
-		if (launcher->description)
-			temp2 = g_ascii_strdown (launcher->description, -1);
-		if (g_strrstr (temp1, filter_string) || (launcher->description
-				&& g_strrstr (temp2, filter_string))
-			|| g_strrstr (filename, filter_string))
+		if (entry->launcher->tile)
+			gtk_widget_set_state (entry->launcher->tile, GTK_STATE_NORMAL);
+
+		if (entry->matched || !narrowing)
 		{
-			data->filtered_launcher_list =
-				g_list_append (data->filtered_launcher_list, launcher);
+			entry->score = search_score (entry->key, query, query_len);
+			entry->matched = entry->score >= 0;
 		}
-		if (temp1)
-			g_free (temp1);
-		if (temp2)
-			g_free (temp2);
+
+		if (entry->matched)
+			g_ptr_array_add (matches, entry);
 	}
-	while (NULL != (launcher_list = g_list_next (launcher_list)));
-	g_free (filter_string);
+
+	g_ptr_array_sort (matches, search_index_entry_compare);
+
+	/* backwards, to keep that order while prepending */
+	for (i = matches->len; i-- > 0;)
+	{
+		SearchIndexEntry *entry = g_ptr_array_index (matches, i);
+
+		CATEGORY_PRIVATE (entry->category)->filtered_launchers =
+			g_list_prepend (CATEGORY_PRIVATE (entry->category)->filtered_launchers, entry->launcher);
+	}
+
+	g_ptr_array_free (matches, TRUE);
+	g_free (query);
+
+	g_free (priv->search_filter);
+	priv->search_filter = filter_string;
+}
+
+static void
+free_launcher (AppShellData * app_data, LauncherData * launcher)
+{
+	if (launcher->tile)
+	{
+		if (app_data->last_clicked_launcher == TILE (launcher->tile))
+			app_data->last_clicked_launcher = NULL;
+
+		gtk_widget_destroy (launcher->tile);
+		g_object_unref (launcher->tile);
+	}
+
+	g_free (launcher->location);
+	g_free (launcher->name);
+	g_free (launcher->description);
+	g_free (launcher->exec_name);
+	g_free (launcher->search_key);
+	g_free (launcher->desktop_file);
+	if (launcher->record)
+		g_variant_unref (launcher->record);
+	g_free (launcher);
 }
 
+/* Frees the categories a menu reload didn't reuse */
 static void
 delete_old_data (AppShellData * app_data)
 {
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
 	GList *temp;
 	GList *cat_list;
 
 	g_assert (app_data != NULL);
-	g_assert (app_data->categories_list != NULL);
 
-	cat_list = app_data->categories_list;
-
-	do
+	for (cat_list = priv->old_categories_list; cat_list; cat_list = g_list_next (cat_list))
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
 		gtk_widget_destroy (GTK_WIDGET (data->section));
@@ -660,21 +1010,64 @@ delete_old_data (AppShellData * app_data)
 		g_object_unref (data->group_launcher);
 		g_free (data->category);
 
-		for (temp = data->launcher_list; temp; temp = g_list_next (temp))
+		for (temp = CATEGORY_PRIVATE (data)->launchers; temp; temp = g_list_next (temp))
+			free_launcher (app_data, temp->data);
+
+		g_list_free (CATEGORY_PRIVATE (data)->launchers);
+		g_list_free (CATEGORY_PRIVATE (data)->filtered_launchers);
+		g_free (data);
+	}
+
+	g_list_free (priv->old_categories_list);
+	priv->old_categories_list = NULL;
+}
+
+/* While reloading the menu, takes the category of that name from the ones shown
+   before, so that its section and the launchers which didn't change are reused */
+static CategoryData *
+take_old_category (AppShellData * app_data, const gchar * category)
+{
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
+	GList *cat_list;
+	GList *temp;
+
+	for (cat_list = priv->old_categories_list; cat_list; cat_list = g_list_next (cat_list))
+	{
+		CategoryData *data = (CategoryData *) cat_list->data;
+
+		if (strcmp (data->category, category))
+			continue;
+
+		priv->old_categories_list =
+			g_list_delete_link (priv->old_categories_list, cat_list);
+
+		CATEGORY_PRIVATE (data)->old_launchers = g_hash_table_new (g_str_hash, g_str_equal);
+		for (temp = CATEGORY_PRIVATE (data)->launchers; temp; temp = g_list_next (temp))
 		{
-			g_free (g_object_get_data (G_OBJECT (temp->data), TILE_EXEC_NAME));
-			g_object_unref (temp->data);
+			const gchar *desktop_file = ((LauncherData *) temp->data)->desktop_file;
+
+			if (desktop_file)
+				g_hash_table_insert (CATEGORY_PRIVATE (data)->old_launchers, (gpointer) desktop_file,
+					temp->data);
+			else
+				free_launcher (app_data, temp->data);
 		}
 
-		g_list_free (data->launcher_list);
-		g_list_free (data->filtered_launcher_list);
-		g_free (data);
+		g_list_free (CATEGORY_PRIVATE (data)->launchers);
+		CATEGORY_PRIVATE (data)->launchers = NULL;
+		g_list_free (CATEGORY_PRIVATE (data)->filtered_launchers);
+		CATEGORY_PRIVATE (data)->filtered_launchers = NULL;
+
+		return data;
 	}
-	while (NULL != (cat_list = g_list_next (cat_list)));
 
-	g_list_free (app_data->categories_list);
-	app_data->categories_list = NULL;
-	app_data->selected_group = NULL;
+	return NULL;
+}
+
+static void
+free_old_launcher (gpointer key, gpointer value, gpointer user_data)
+{
+	free_launcher ((AppShellData *) user_data, value);
 }
 
 static void
@@ -692,11 +1085,21 @@ create_application_category_sections (AppShellData * app_data)
 	do
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
-		GtkWidget *header = gtk_label_new (data->category);
+		GtkWidget *header;
 		gchar *markup;
 		GtkWidget *hbox;
 		GtkWidget *table;
 
+		/* kept from before the menu was reloaded, only the position may have changed */
+		if (data->section)
+		{
+			g_object_set_data (G_OBJECT (data->group_launcher), GROUP_POSITION_NUMBER_KEY,
+				GINT_TO_POINTER (pos));
+			pos++;
+			continue;
+		}
+
+		header = gtk_label_new (data->category);
 		gtk_misc_set_alignment (GTK_MISC (header), 0, 0.5);
 		data->group_launcher = TILE (nameplate_tile_new (NULL, NULL, header, NULL));
 		g_object_ref (data->group_launcher);
@@ -768,6 +1171,51 @@ show_no_results_message (AppShellData * app_data, GtkWidget * containing_vbox)
 	g_free (markup);
 }
 
+/* Lays out the first categories, up to about a screenful of launchers, so the
+   shell can be shown right away; the rest follows from an idle like an
+   incremental relayout, which also makes their tiles */
+static void
+populate_application_category_sections_initial (AppShellData * app_data,
+	GtkWidget * containing_vbox)
+{
+	GList *cat_list;
+	guint n_launchers = 0;
+
+	if (app_data->cached_tables_list)
+		g_list_free (app_data->cached_tables_list);
+	app_data->cached_tables_list = NULL;
+
+	remove_container_entries (GTK_CONTAINER (containing_vbox));
+	app_data->filtered_out_everything = TRUE;
+
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
+	{
+		CategoryData *data = (CategoryData *) cat_list->data;
+
+		if (n_launchers >= INITIAL_LAYOUT_LAUNCHERS)
+			break;
+
+		if (NULL != CATEGORY_PRIVATE (data)->filtered_launchers)
+		{
+			populate_application_category_section (app_data, data->section,
+				CATEGORY_PRIVATE (data)->filtered_launchers);
+			gtk_box_pack_start (GTK_BOX (containing_vbox), GTK_WIDGET (data->section),
+				TRUE, TRUE, 0);
+			app_data->filtered_out_everything = FALSE;
+			n_launchers += g_list_length (CATEGORY_PRIVATE (data)->filtered_launchers);
+		}
+	}
+
+	if (cat_list)
+	{
+		app_data->stop_incremental_relayout = FALSE;
+		app_data->incremental_relayout_cat_list = cat_list;
+		g_idle_add ((GSourceFunc) relayout_shell_partial, app_data);
+	}
+	else if (app_data->filtered_out_everything)
+		show_no_results_message (app_data, containing_vbox);
+}
+
 static void
 populate_application_category_sections (AppShellData * app_data, GtkWidget * containing_vbox)
 {
@@ -781,10 +1229,10 @@ populate_application_category_sections (AppShellData * app_data, GtkWidget * con
 	do
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
-		if (NULL != data->filtered_launcher_list)
+		if (NULL != CATEGORY_PRIVATE (data)->filtered_launchers)
 		{
 			populate_application_category_section (app_data, data->section,
-				data->filtered_launcher_list);
+				CATEGORY_PRIVATE (data)->filtered_launchers);
 			gtk_box_pack_start (GTK_BOX (containing_vbox), GTK_WIDGET (data->section),
 				TRUE, TRUE, 0);
 			filtered_out_everything = FALSE;
@@ -803,6 +1251,7 @@ populate_application_category_section (AppShellData * app_data, SlabSection * se
 	GtkWidget *hbox;
 	GtkTable *table;
 	GList *children;
+	GList *tiles;
 
 	g_assert (GTK_IS_HBOX (section->contents));
 	hbox = GTK_WIDGET (section->contents);
@@ -814,20 +1263,34 @@ populate_application_category_section (AppShellData * app_data, SlabSection * se
 	/* Make sure our implementation has not changed and it's still a GtkTable */
 	g_assert (GTK_IS_TABLE (table));
 
+	/* the tiles are only made once they are first laid out */
+	for (tiles = NULL; launcher_list; launcher_list = g_list_next (launcher_list))
+	{
+		GtkWidget *tile = get_launcher_tile (app_data, launcher_list->data);
+
+		if (tile)
+			tiles = g_list_prepend (tiles, tile);
+	}
+	tiles = g_list_reverse (tiles);
+
+	if (!tiles)
+	{
+		/* the resizer can't lay out an empty table */
+		remove_container_entries (GTK_CONTAINER (table));
+		return;
+	}
+
 	app_data->cached_tables_list = g_list_append (app_data->cached_tables_list, table);
 
 	app_resizer_layout_table_default (APP_RESIZER (app_data->category_layout), table,
-		launcher_list);
-
+		tiles);
+	g_list_free (tiles);
 }
 
 gboolean
 regenerate_categories (AppShellData * app_data)
 {
-	delete_old_data (app_data);
-	generate_categories (app_data);
-	create_application_category_sections (app_data);
-	relayout_shell (app_data);
+	generate_categories_async (app_data);
 
 	return FALSE;	/* remove this function from the list */
 }
@@ -849,7 +1312,12 @@ matemenu_tree_changed_callback (MateMenuTree * old_tree, gpointer user_data)
 AppShellData *
 appshelldata_new (const gchar * menu_name, GtkIconSize icon_size, gboolean show_tile_generic_name, gboolean exit_on_close, gint new_apps_max_items)
 {
-	AppShellData *app_data = g_new0 (AppShellData, 1);
+	AppShellData *app_data = (AppShellData *) g_new0 (AppShellPrivate, 1);
+
+	if (!app_shells)
+		app_shells = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_add (app_shells, app_data);
+
 	app_data->settings = g_settings_new (CC_SCHEMA);
 	app_data->menu_name = menu_name;
 	app_data->icon_size = icon_size;
@@ -864,12 +1332,101 @@ appshelldata_new (const gchar * menu_name, GtkIconSize icon_size, gboolean show_
 	return app_data;
 }
 
-void
-generate_categories (AppShellData * app_data)
+static void
+collect_desktop_files (CatalogCategory * category, MateMenuTreeDirectory * root_dir,
+	GHashTable * dups, gboolean recursive)
 {
+	const gchar *desktop_file;
+	GSList *contents, *l;
+
+	contents = matemenu_tree_directory_get_contents (root_dir);
+	for (l = contents; l; l = l->next)
+	{
+		switch (matemenu_tree_item_get_type (l->data))
+		{
+		case MATEMENU_TREE_ITEM_DIRECTORY:
+			/* g_message ("Found sub-category %s", matemenu_tree_directory_get_name (l->data)); */
+			if (recursive)
+				collect_desktop_files (category, l->data, dups, TRUE);
+			break;
+		case MATEMENU_TREE_ITEM_ENTRY:
+			/* g_message ("Found item name is:%s", matemenu_tree_entry_get_name (l->data)); */
+			desktop_file = matemenu_tree_entry_get_desktop_file_path (l->data);
+			if (!desktop_file || g_hash_table_lookup (dups, desktop_file))
+				break;	/* duplicate */
+
+			category->desktop_files =
+				g_list_prepend (category->desktop_files, g_strdup (desktop_file));
+			g_hash_table_insert (dups, category->desktop_files->data,
+				category->desktop_files->data);
+			break;
+		default:
+			break;
+		}
+
+		matemenu_tree_item_unref (l->data);
+	}
+	g_slist_free (contents);
+}
+
+static void
+collect_category (LauncherCatalog * catalog, const gchar * name,
+	MateMenuTreeDirectory * root_dir, gboolean recursive)
+{
+	CatalogCategory *category = g_new0 (CatalogCategory, 1);
+	/* used to eliminate dups on a per category basis. */
+	GHashTable *dups = g_hash_table_new (g_str_hash, g_str_equal);
+
+	category->name = g_strdup (name);
+	collect_desktop_files (category, root_dir, dups, recursive);
+	category->desktop_files = g_list_reverse (category->desktop_files);
+
+	/* use the matemenu order instead of alphabetical */
+	catalog->categories = g_list_prepend (catalog->categories, category);
+
+	g_hash_table_destroy (dups);
+}
+
+/* Walks the menu tree for the categories and their desktop files; the slow
+   part, parsing those, is left to load_catalog () */
+static LauncherCatalog *
+launcher_catalog_new (AppShellData * app_data)
+{
+	LauncherCatalog *catalog = g_new0 (LauncherCatalog, 1);
 	MateMenuTreeDirectory *root_dir;
 	GSList *contents, *l;
 	gboolean need_misc = FALSE;
+	GSettings *lockdown_settings;
+	gchar *name;
+	GList *cat_list;
+	GList *temp;
+
+	catalog->app_data = app_data;
+
+	lockdown_settings = g_settings_new ("org.mate.lockdown");
+	catalog->command_line_lockdown =
+		g_settings_get_boolean (lockdown_settings, "disable-command-line");
+	g_object_unref (lockdown_settings);
+
+	catalog->programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	name = g_strdup_printf ("ab-launchers-%s.cache", app_data->menu_name);
+	catalog->cache_file = g_build_filename (g_get_user_cache_dir (), "mate", name, NULL);
+	g_free (name);
+
+	/* the thread only gets the records, it doesn't touch the launchers */
+	catalog->known_records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify) g_variant_unref);
+	catalog->check_files = (app_data->categories_list != NULL);
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
+		for (temp = CATEGORY_PRIVATE (cat_list->data)->launchers; temp; temp = g_list_next (temp))
+		{
+			LauncherData *launcher = temp->data;
+
+			if (launcher->desktop_file && launcher->record)
+				g_hash_table_replace (catalog->known_records,
+					g_strdup (launcher->desktop_file), g_variant_ref (launcher->record));
+		}
 
 	if (!app_data->tree)
 	{
@@ -883,12 +1440,10 @@ generate_categories (AppShellData * app_data)
 		contents = NULL;
 	if (!root_dir || !contents)
 	{
-		GtkWidget *dialog = gtk_message_dialog_new (NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
-			GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Failure loading - %s",
-			app_data->menu_name);
-		gtk_dialog_run (GTK_DIALOG (dialog));
-		gtk_widget_destroy (dialog);
-		exit (1);	/* Fixme - is there a MATE/GTK way to do this. */
+		catalog->failed = TRUE;
+		if (root_dir)
+			matemenu_tree_item_unref (root_dir);
+		return catalog;
 	}
 
 	for (l = contents; l; l = l->next)
@@ -900,7 +1455,7 @@ generate_categories (AppShellData * app_data)
 		{
 		case MATEMENU_TREE_ITEM_DIRECTORY:
 			category = matemenu_tree_directory_get_name ((MateMenuTreeDirectory*)item);
-			generate_category(category, (MateMenuTreeDirectory*)item, app_data, TRUE);
+			collect_category (catalog, category, (MateMenuTreeDirectory*)item, TRUE);
 			break;
 		case MATEMENU_TREE_ITEM_ENTRY:
 			need_misc = TRUE;
@@ -914,24 +1469,428 @@ generate_categories (AppShellData * app_data)
 	g_slist_free (contents);
 
 	if (need_misc)
-		generate_category (_("Other"), root_dir, app_data, FALSE);
+		collect_category (catalog, _("Other"), root_dir, FALSE);
 
-	if (app_data->hash)
+	catalog->categories = g_list_reverse (catalog->categories);
+
+	matemenu_tree_item_unref (root_dir);
+
+	return catalog;
+}
+
+static void
+launcher_catalog_free (LauncherCatalog * catalog)
+{
+	GList *cat_list;
+	GList *temp;
+
+	for (cat_list = catalog->categories; cat_list; cat_list = g_list_next (cat_list))
 	{
-		g_hash_table_destroy (app_data->hash);
-		app_data->hash = NULL;
+		CatalogCategory *category = cat_list->data;
+
+		/* what generate_category () didn't take */
+		for (temp = category->launchers; temp; temp = g_list_next (temp))
+			free_launcher (catalog->app_data, temp->data);
+
+		g_list_free (category->launchers);
+		g_list_free_full (category->desktop_files, g_free);
+		g_free (category->name);
+		g_free (category);
 	}
 
-	matemenu_tree_item_unref (root_dir);
+	g_list_free (catalog->categories);
+	g_hash_table_destroy (catalog->programs);
+	g_hash_table_destroy (catalog->known_records);
+	g_free (catalog->cache_file);
+	g_free (catalog);
+}
+
+static gboolean
+launcher_catalog_has_program (LauncherCatalog * catalog, const gchar * program)
+{
+	gpointer found = g_hash_table_lookup (catalog->programs, program);
+
+	if (!found)
+	{
+		gchar *path = g_find_program_in_path (program);
+
+		found = GINT_TO_POINTER (path ? 2 : 1);
+		g_hash_table_insert (catalog->programs, g_strdup (program), found);
+		g_free (path);
+	}
+
+	return GPOINTER_TO_INT (found) == 2;
+}
+
+/* The mtime of the desktop file a record was made from */
+static guint64
+launcher_record_get_mtime (GVariant * record)
+{
+	guint64 mtime;
+
+	g_variant_get_child (record, 8, "t", &mtime);
+
+	return mtime;
+}
+
+/* Reads the launcher records of the cache into records, desktop file -> record,
+   and the directory mtimes they are valid for into dirs, directory -> mtime */
+static GVariant *
+launcher_cache_read (LauncherCatalog * catalog, GHashTable * records, GHashTable * dirs)
+{
+	GMappedFile *mapped;
+	GBytes *bytes;
+	GVariant *cache;
+	GVariant *dir_list;
+	GVariant *record_list;
+	GVariantIter iter;
+	const gchar *path;
+	GVariant *record;
+	guint64 mtime;
+	guint32 version;
+	const gchar *languages;
+	gchar *current_languages;
+
+	mapped = g_mapped_file_new (catalog->cache_file, FALSE, NULL);
+	if (!mapped)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped);
+	g_mapped_file_unref (mapped);
+	/* not trusted, so a damaged file reads as empty rather than crashing */
+	cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (LAUNCHER_CACHE_TYPE),
+		bytes, FALSE));
+	g_bytes_unref (bytes);
+
+	g_variant_get (cache, "(u&s@a{st}@a{s" LAUNCHER_RECORD_TYPE "})", &version, &languages,
+		&dir_list, &record_list);
+	current_languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+	if (version == LAUNCHER_CACHE_VERSION && !strcmp (languages, current_languages))
+	{
+		g_variant_iter_init (&iter, dir_list);
+		while (g_variant_iter_next (&iter, "{&st}", &path, &mtime))
+			g_hash_table_insert (dirs, (gpointer) path, GSIZE_TO_POINTER (mtime));
+
+		g_variant_iter_init (&iter, record_list);
+		while (g_variant_iter_next (&iter, "{&s@" LAUNCHER_RECORD_TYPE "}", &path, &record))
+			g_hash_table_insert (records, (gpointer) path, record);
+	}
+	g_variant_unref (dir_list);
+	g_variant_unref (record_list);
+	g_free (current_languages);
+
+	return cache;
+}
+
+static void
+launcher_cache_write (LauncherCatalog * catalog, GHashTable * records, GHashTable * dirs)
+{
+	GVariantBuilder dir_list;
+	GVariantBuilder record_list;
+	GHashTableIter iter;
+	gpointer key, value;
+	GVariant *cache;
+	gchar *languages;
+	gchar *dirname;
+	GError *error = NULL;
+
+	g_variant_builder_init (&dir_list, G_VARIANT_TYPE ("a{st}"));
+	g_hash_table_iter_init (&iter, dirs);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		if (value)
+			g_variant_builder_add (&dir_list, "{st}", key,
+				(guint64) GPOINTER_TO_SIZE (value));
+
+	g_variant_builder_init (&record_list, G_VARIANT_TYPE ("a{s" LAUNCHER_RECORD_TYPE "}"));
+	g_hash_table_iter_init (&iter, records);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&record_list, "{s@" LAUNCHER_RECORD_TYPE "}", key, value);
+
+	languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+	cache = g_variant_ref_sink (g_variant_new ("(usa{st}a{s" LAUNCHER_RECORD_TYPE "})",
+		LAUNCHER_CACHE_VERSION, languages, &dir_list, &record_list));
+	g_free (languages);
+
+	dirname = g_path_get_dirname (catalog->cache_file);
+	g_mkdir_with_parents (dirname, 0700);	/* creates if does not exist */
+	g_free (dirname);
+
+	if (!g_file_set_contents (catalog->cache_file, g_variant_get_data (cache),
+		g_variant_get_size (cache), &error))
+	{
+		g_warning ("Error setting launcher cache file:%s\n", error->message);
+		g_error_free (error);
+	}
+
+	g_variant_unref (cache);
+}
+
+/* Parses the desktop files of the catalog into launchers, or takes them from the
+   cache for the directories which didn't change since; it may run in a thread */
+static void
+load_catalog (LauncherCatalog * catalog)
+{
+	MateDesktopItem *desktop_item;
+	LauncherData *launcher;
+	GVariant *cache = NULL;
+	GVariant *record;
+	GHashTable *cached_records;
+	GHashTable *cached_dirs;
+	GHashTable *records;
+	GHashTable *dirs;
+	GVariant *cached_record;
+	GList *cat_list;
+	GList *temp;
+	gboolean changed = FALSE;
+	gsize now = g_get_real_time () / G_USEC_PER_SEC;
+	gsize file_mtime;
+
+	cached_records = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+		(GDestroyNotify) g_variant_unref);
+	cached_dirs = g_hash_table_new (g_str_hash, g_str_equal);
+	cache = launcher_cache_read (catalog, cached_records, cached_dirs);
+
+	/* what goes into the new cache; dirs maps to the mtime the directory had
+	   before its files were parsed, or 0 if it can't be trusted */
+	records = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+		(GDestroyNotify) g_variant_unref);
+	dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	for (cat_list = catalog->categories; cat_list; cat_list = g_list_next (cat_list))
+	{
+		CatalogCategory *category = cat_list->data;
+
+		for (temp = category->desktop_files; temp; temp = g_list_next (temp))
+		{
+			const gchar *desktop_file = temp->data;
+			gchar *dir = g_path_get_dirname (desktop_file);
+			gpointer dir_mtime;
+
+			/* one stat per directory instead of one per desktop file */
+			if (!g_hash_table_lookup_extended (dirs, dir, NULL, &dir_mtime))
+			{
+				dir_mtime = GSIZE_TO_POINTER (get_desktop_file_mtime (dir));
+				/* it could still change within the same second unnoticed */
+				if (GPOINTER_TO_SIZE (dir_mtime) >= now)
+					dir_mtime = NULL;
+				g_hash_table_insert (dirs, g_strdup (dir), dir_mtime);
+			}
+
+			record = NULL;
+			file_mtime = 0;
+			cached_record = g_hash_table_lookup (cached_records, desktop_file);
+			if (catalog->check_files)
+			{
+				/* a record is good as long as its file has the mtime it was made at;
+				   the same second as now could still hide a change */
+				file_mtime = get_desktop_file_mtime (desktop_file);
+				if (file_mtime && file_mtime < now)
+				{
+					record = g_hash_table_lookup (catalog->known_records, desktop_file);
+					if (!record || launcher_record_get_mtime (record) != file_mtime)
+						record = cached_record;
+					if (record && launcher_record_get_mtime (record) != file_mtime)
+						record = NULL;
+				}
+				/* the cache missed it or is out of date */
+				if (record && record != cached_record &&
+				    (!cached_record || !g_variant_equal (record, cached_record)))
+					changed = TRUE;
+			}
+			else if (dir_mtime && g_hash_table_lookup (cached_dirs, dir) == dir_mtime)
+				record = cached_record;
+			g_free (dir);
+
+			if (record)
+				g_variant_ref (record);
+			else if (!g_hash_table_lookup (records, desktop_file))
+			{
+				desktop_item = mate_desktop_item_new_from_file (desktop_file, 0, NULL);
+				if (!desktop_item)
+				{
+					g_critical ("Failure - mate_desktop_item_new_from_file(%s)",
+						    desktop_file);
+					continue;
+				}
+				record = g_variant_ref_sink (create_launcher_record (desktop_item,
+					file_mtime ? file_mtime : get_desktop_file_mtime (desktop_file)));
+				mate_desktop_item_unref (desktop_item);
+				changed = TRUE;
+			}
+			else	/* in another category too */
+				record = g_variant_ref (g_hash_table_lookup (records, desktop_file));
+
+			launcher = create_launcher (catalog, record);
+			if (launcher)
+			{
+				launcher->desktop_file = g_strdup (desktop_file);
+				category->launchers = g_list_prepend (category->launchers, launcher);
+			}
+			g_hash_table_replace (records, temp->data, record);
+		}
+	}
+
+	/* also rewritten when desktop files went away */
+	if (changed || g_hash_table_size (records) != g_hash_table_size (cached_records))
+		launcher_cache_write (catalog, records, dirs);
+
+	g_hash_table_destroy (records);
+	g_hash_table_destroy (dirs);
+	g_hash_table_destroy (cached_records);
+	g_hash_table_destroy (cached_dirs);
+	if (cache)
+		g_variant_unref (cache);
+}
+
+/* Turns the loaded catalog into categories and launchers, reusing the ones
+   from before a menu reload that didn't change */
+static void
+apply_catalog (AppShellData * app_data, LauncherCatalog * catalog)
+{
+	GList *cat_list;
+
+	if (catalog->failed)
+	{
+		GtkWidget *dialog = gtk_message_dialog_new (NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Failure loading - %s",
+			app_data->menu_name);
+		gtk_dialog_run (GTK_DIALOG (dialog));
+		gtk_widget_destroy (dialog);
+		exit (1);	/* Fixme - is there a MATE/GTK way to do this. */
+	}
+
+	for (cat_list = catalog->categories; cat_list; cat_list = g_list_next (cat_list))
+		generate_category (cat_list->data, app_data);
 
 	if (app_data->new_apps && (app_data->new_apps->max_items > 0))
 		generate_new_apps (app_data);
+
+	generate_search_index (app_data);
+}
+
+void
+generate_categories (AppShellData * app_data)
+{
+	LauncherCatalog *catalog;
+
+	g_return_if_fail (IS_APP_SHELL (app_data));
+
+	libslab_trace_begin ("generate_categories");
+
+	catalog = launcher_catalog_new (app_data);
+	load_catalog (catalog);
+	apply_catalog (app_data, catalog);
+	launcher_catalog_free (catalog);
+
+	libslab_trace_end ("generate_categories");
+}
+
+static gpointer
+load_catalog_thread (gpointer user_data)
+{
+	LauncherCatalog *catalog = user_data;
+
+	libslab_trace_begin ("generate_categories: load");
+	load_catalog (catalog);
+	libslab_trace_end ("generate_categories: load");
+
+	g_idle_add (catalog_loaded_idle, catalog);
+
+	return NULL;
+}
+
+static gboolean
+catalog_loaded_idle (gpointer user_data)
+{
+	LauncherCatalog *catalog = user_data;
+	AppShellData *app_data = catalog->app_data;
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
+	gboolean first_load = (app_data->categories_list == NULL);
+
+	g_thread_join (priv->catalog_thread);
+	priv->catalog_thread = NULL;
+
+	libslab_trace_begin ("generate_categories: apply");
+
+	/* an incremental relayout still walking the old categories must not touch them
+	   once they are freed */
+	app_data->stop_incremental_relayout = TRUE;
+	app_data->incremental_relayout_cat_list = NULL;
+
+	/* generate_category () picks what didn't change from there */
+	priv->old_categories_list = app_data->categories_list;
+	app_data->categories_list = NULL;
+	app_data->selected_group = NULL;
+
+	apply_catalog (app_data, catalog);
+	launcher_catalog_free (catalog);
+	delete_old_data (app_data);
+
+	/* not laid out yet, layout_shell () will take it from here */
+	if (app_data->shell)
+	{
+		create_application_category_sections (app_data);
+
+		/* keep showing what the search bar asks for */
+		if (app_data->filter_string && *app_data->filter_string)
+			generate_filtered_lists (app_data);
+
+		if (first_load)
+		{
+			populate_application_category_sections_initial (app_data,
+				GTK_WIDGET (APP_RESIZER (app_data->category_layout)->child));
+			app_resizer_set_table_cache (APP_RESIZER (app_data->category_layout),
+				app_data->cached_tables_list);
+			populate_groups_section (app_data);
+
+			gtk_widget_show_all (app_data->shell);
+			if (!app_data->static_actions && !app_data->last_clicked_launcher)
+				gtk_widget_hide (app_data->actions_section);
+		}
+		else
+			relayout_shell (app_data);
+	}
+
+	libslab_trace_end ("generate_categories: apply");
+
+	/* the menu changed again while it was loading */
+	if (priv->catalog_reload_pending)
+	{
+		priv->catalog_reload_pending = FALSE;
+		generate_categories_async (app_data);
+	}
+
+	return FALSE;
+}
+
+void
+generate_categories_async (AppShellData * app_data)
+{
+	AppShellPrivate *priv = APP_SHELL_PRIVATE (app_data);
+
+	g_return_if_fail (IS_APP_SHELL (app_data));
+
+	if (priv->catalog_thread)
+	{
+		priv->catalog_reload_pending = TRUE;
+		return;
+	}
+
+	libslab_trace_begin ("generate_categories: walk menu");
+
+	priv->catalog_thread = g_thread_new ("app-shell-catalog", load_catalog_thread,
+		launcher_catalog_new (app_data));
+
+	libslab_trace_end ("generate_categories: walk menu");
 }
 
 static void
-generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data, gboolean recursive)
+generate_category (CatalogCategory * category, AppShellData * app_data)
 {
 	CategoryData *data;
+	LauncherData *launcher;
+	LauncherData *old_launcher;
+	GList *temp;
 	/* This is not needed. MateMenu already returns an ordered, non duplicate list
 	GList *list_entry;
 	list_entry =
@@ -940,8 +1899,12 @@ generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppS
 	if (!list_entry)
 	{
 	*/
-		data = g_new0 (CategoryData, 1);
-		data->category = g_strdup (category);
+		data = take_old_category (app_data, category->name);
+		if (!data)
+		{
+			data = (CategoryData *) g_new0 (CategoryPrivate, 1);
+			data->category = g_strdup (category->name);
+		}
 		app_data->categories_list =
 			/* use the matemenu order instead of alphabetical */
 			g_list_append (app_data->categories_list, data);
@@ -954,57 +1917,62 @@ generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppS
 	}
 	*/
 
-	if (app_data->hash)	/* used to eliminate dups on a per category basis. */
-		g_hash_table_destroy (app_data->hash);
-	app_data->hash = g_hash_table_new (g_str_hash, g_str_equal);
-	generate_launchers (root_dir, app_data, data, recursive);
+	for (temp = category->launchers; temp; temp = g_list_next (temp))
+	{
+		launcher = temp->data;
+
+		/* reuse the launcher from before the reload if the file is the same */
+		old_launcher = CATEGORY_PRIVATE (data)->old_launchers ?
+			g_hash_table_lookup (CATEGORY_PRIVATE (data)->old_launchers, launcher->desktop_file) : NULL;
+		if (old_launcher && old_launcher->mtime == launcher->mtime)
+		{
+			g_hash_table_remove (CATEGORY_PRIVATE (data)->old_launchers, launcher->desktop_file);
+			add_launcher_to_category (data, old_launcher);
+			free_launcher (app_data, launcher);
+		}
+		else
+			add_launcher_to_category (data, launcher);
+	}
+	/* taken over from the catalog */
+	g_list_free (category->launchers);
+	category->launchers = NULL;
+
+	/* gone from this category since the menu was last loaded */
+	if (CATEGORY_PRIVATE (data)->old_launchers)
+	{
+		g_hash_table_foreach (CATEGORY_PRIVATE (data)->old_launchers, free_old_launcher, app_data);
+		g_hash_table_destroy (CATEGORY_PRIVATE (data)->old_launchers);
+		CATEGORY_PRIVATE (data)->old_launchers = NULL;
+	}
 }
 
+/* Runs in the loading thread; the lockdown setting was read beforehand by
+   launcher_catalog_new () and the PATH lookups are done once per load */
 static gboolean
-check_specific_apps_hack (MateDesktopItem * item)
+check_specific_apps_hack (LauncherCatalog * catalog, const gchar * exec,
+	const gchar * categories)
 {
-	static const gchar *COMMAND_LINE_LOCKDOWN_SCHEMA = "org.mate.lockdown";
-	static const gchar *COMMAND_LINE_LOCKDOWN_KEY = "disable-command-line";
 	static const gchar *COMMAND_LINE_LOCKDOWN_DESKTOP_CATEGORY = "TerminalEmulator";
-	static gboolean got_lockdown_value = FALSE;
-	static gboolean command_line_lockdown;
-
-	gchar *path;
-	const char *exec;
-
-	if (!got_lockdown_value)
-	{
-		got_lockdown_value = TRUE;
-		GSettings *lockdown_settings;
-		lockdown_settings = g_settings_new (COMMAND_LINE_LOCKDOWN_SCHEMA);
-		command_line_lockdown = g_settings_get_boolean (lockdown_settings, COMMAND_LINE_LOCKDOWN_KEY);
-		g_object_unref (lockdown_settings);
-	}
 
 	/* This seems like an ugly hack but it's the way it's currently done in the old control center */
-	exec = mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_EXEC);
 
 	/* discard xscreensaver if mate-screensaver is installed */
 	if ((exec && !strcmp (exec, "xscreensaver-demo"))
-		&& (path = g_find_program_in_path ("mate-screensaver-preferences")))
+		&& launcher_catalog_has_program (catalog, "mate-screensaver-preferences"))
 	{
-		g_free (path);
 		return TRUE;
 	}
 
 	/* discard gnome-keyring-manager if CASA is installed */
 	if ((exec && !strcmp (exec, "gnome-keyring-manager"))
-		&& (path = g_find_program_in_path ("CASAManager.sh")))
+		&& launcher_catalog_has_program (catalog, "CASAManager.sh"))
 	{
-		g_free (path);
 		return TRUE;
 	}
 
 	/* discard terminals if lockdown key is set */
-	if (command_line_lockdown)
+	if (catalog->command_line_lockdown)
 	{
-		const gchar *categories =
-			mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_CATEGORIES);
 		if (g_strrstr (categories, COMMAND_LINE_LOCKDOWN_DESKTOP_CATEGORY))
 		{
 			/* printf ("eliminating %s\n", mate_desktop_item_get_location (item)); */
@@ -1015,57 +1983,28 @@ check_specific_apps_hack (MateDesktopItem * item)
 	return FALSE;
 }
 
-static void
-generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data, CategoryData * cat_data, gboolean recursive)
+static gsize
+get_desktop_file_mtime (const gchar * desktop_file)
 {
-	MateDesktopItem *desktop_item;
-	const gchar *desktop_file;
-	GSList *contents, *l;
+	struct stat buf;
 
-	contents = matemenu_tree_directory_get_contents (root_dir);
-	for (l = contents; l; l = l->next)
-	{
-		switch (matemenu_tree_item_get_type (l->data))
-		{
-		case MATEMENU_TREE_ITEM_DIRECTORY:
-			/* g_message ("Found sub-category %s", matemenu_tree_directory_get_name (l->data)); */
-			if (recursive)
-				generate_launchers (l->data, app_data, cat_data, TRUE);
-			break;
-		case MATEMENU_TREE_ITEM_ENTRY:
-			/* g_message ("Found item name is:%s", matemenu_tree_entry_get_name (l->data)); */
-			desktop_file = matemenu_tree_entry_get_desktop_file_path (l->data);
-			if (desktop_file)
-			{
-				if (g_hash_table_lookup (app_data->hash, desktop_file))
-				{
-					break;	/* duplicate */
-				}
-				/* Fixme - make sure it's safe to store this without duping it. As far as I can tell it is
-				   safe as long as I don't hang on to this anylonger than I hang on to the MateMenuTreeEntry*
-				   which brings up another point - am I supposed to free these or does freeing the top level recurse
-				*/
-				g_hash_table_insert (app_data->hash, (gpointer) desktop_file,
-					(gpointer) desktop_file);
-			}
-			desktop_item = mate_desktop_item_new_from_file (desktop_file, 0, NULL);
-			if (!desktop_item)
-			{
-				g_critical ("Failure - mate_desktop_item_new_from_file(%s)",
-					    desktop_file);
-				break;
-			}
-			if (!check_specific_apps_hack (desktop_item))
-				insert_launcher_into_category (cat_data, desktop_item, app_data);
-			mate_desktop_item_unref (desktop_item);
-			break;
-		default:
-			break;
-		}
+	if (!desktop_file || g_stat (desktop_file, &buf) < 0)
+		return 0;
 
-		matemenu_tree_item_unref (l->data);
-	}
-	g_slist_free (contents);
+	return buf.st_mtime;
+}
+
+static void
+add_launcher_to_category (CategoryData * cat_data, LauncherData * launcher)
+{
+	/* use alphabetical order instead of the matemenu order. We group all sub items in each top level
+	category together, ignoring sub menus, so we also ignore sub menu layout hints */
+	CATEGORY_PRIVATE (cat_data)->launchers =
+		/* g_list_insert (cat_data->launcher_list, launcher, -1); */
+		g_list_insert_sorted (CATEGORY_PRIVATE (cat_data)->launchers, launcher, application_launcher_compare);
+	CATEGORY_PRIVATE (cat_data)->filtered_launchers =
+		/* g_list_insert (cat_data->filtered_launcher_list, launcher, -1); */
+		g_list_insert_sorted (CATEGORY_PRIVATE (cat_data)->filtered_launchers, launcher, application_launcher_compare);
 }
 
 static void
@@ -1077,7 +2016,7 @@ generate_new_apps (AppShellData * app_data)
 	gchar *separator = "\n";
 
 	gchar *all_apps_file_name;
-	gchar **all_apps_split;
+	gchar *line, *next;
 	gint x;
 	gboolean got_new_apps;
 	CategoryData *new_apps_category = NULL;
@@ -1102,13 +2041,10 @@ generate_new_apps (AppShellData * app_data)
 		for (categories = app_data->categories_list; categories; categories = categories->next)
 		{
 			CategoryData *data = categories->data;
-			for (launchers = data->launcher_list; launchers; launchers = launchers->next)
+			for (launchers = CATEGORY_PRIVATE (data)->launchers; launchers; launchers = launchers->next)
 			{
-				Tile *tile = TILE (launchers->data);
-				MateDesktopItem *item =
-					application_tile_get_desktop_item (APPLICATION_TILE (tile));
-				const gchar *uri = mate_desktop_item_get_location (item);
-				g_string_append (gstr, uri);
+				LauncherData *launcher = launchers->data;
+				g_string_append (gstr, launcher->location);
 				g_string_append (gstr, separator);
 			}
 		}
@@ -1125,11 +2061,16 @@ generate_new_apps (AppShellData * app_data)
 		return;
 	}
 
+	/* split in place, the lines of all_apps are the keys */
 	all_apps_cache = g_hash_table_new (g_str_hash, g_str_equal);
-	all_apps_split = g_strsplit (all_apps, separator, -1);
-	for (x = 0; all_apps_split[x]; x++)
+	for (line = all_apps; *line; line = next)
 	{
-		g_hash_table_insert (all_apps_cache, all_apps_split[x], all_apps_split[x]);
+		next = strchr (line, *separator);
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen (line);
+		g_hash_table_insert (all_apps_cache, line, line);
 	}
 
 	got_new_apps = FALSE;
@@ -1137,12 +2078,10 @@ generate_new_apps (AppShellData * app_data)
 	for (categories = app_data->categories_list; categories; categories = categories->next)
 	{
 		CategoryData *cat_data = categories->data;
-		for (launchers = cat_data->launcher_list; launchers; launchers = launchers->next)
+		for (launchers = CATEGORY_PRIVATE (cat_data)->launchers; launchers; launchers = launchers->next)
 		{
-			Tile *tile = TILE (launchers->data);
-			MateDesktopItem *item =
-				application_tile_get_desktop_item (APPLICATION_TILE (tile));
-			const gchar *uri = mate_desktop_item_get_location (item);
+			LauncherData *launcher = launchers->data;
+			const gchar *uri = launcher->location;
 			if (!g_hash_table_lookup (all_apps_cache, uri))
 			{
 				GFile *file;
@@ -1159,12 +2098,12 @@ generate_new_apps (AppShellData * app_data)
 
 				if (!got_new_apps)
 				{
-					new_apps_category = g_new0 (CategoryData, 1);
+					new_apps_category = (CategoryData *) g_new0 (CategoryPrivate, 1);
 					new_apps_category->category =
 						g_strdup (app_data->new_apps->name);
 					app_data->new_apps->garray =
 						g_array_sized_new (FALSE, TRUE,
-						sizeof (NewAppData *),
+						sizeof (NewLauncherData *),
 						app_data->new_apps->max_items);
 
 					/* should not need this, but a bug in glib does not actually clear the elements until you call this method */
@@ -1172,37 +2111,45 @@ generate_new_apps (AppShellData * app_data)
 					got_new_apps = TRUE;
 				}
 
-				file = g_file_new_for_uri (uri);
-				info = g_file_query_info (file,
-							  G_FILE_ATTRIBUTE_TIME_MODIFIED,
-							  0, NULL, NULL);
-
-				if (!info)
+				/* known from loading the launcher, or its cache */
+				if (launcher->mtime)
+					filetime = (long) launcher->mtime;
+				else
 				{
-					g_object_unref (file);
-					g_warning ("Cant get vfs info for %s\n", uri);
-					if (new_apps_category) {
-						g_free (new_apps_category->category);
-						g_free (new_apps_category);
+					file = g_file_new_for_uri (uri);
+					info = g_file_query_info (file,
+								  G_FILE_ATTRIBUTE_TIME_MODIFIED,
+								  0, NULL, NULL);
+
+					if (!info)
+					{
+						g_object_unref (file);
+						g_warning ("Cant get vfs info for %s\n", uri);
+						if (new_apps_category) {
+							g_free (new_apps_category->category);
+							g_free (new_apps_category);
+						}
+						g_hash_table_destroy (new_apps_dups);
+						g_hash_table_destroy (all_apps_cache);
+						g_free (all_apps);
+						g_free (all_apps_file_name);
+						return;
 					}
-					g_free (all_apps_file_name);
-					g_strfreev (all_apps_split);
-					return;
+					filetime = (long) g_file_info_get_attribute_uint64 (info,
+											    G_FILE_ATTRIBUTE_TIME_MODIFIED);
+					g_object_unref (info);
+					g_object_unref (file);
 				}
-				filetime = (long) g_file_info_get_attribute_uint64 (info,
-										    G_FILE_ATTRIBUTE_TIME_MODIFIED);
-				g_object_unref (info);
-				g_object_unref (file);
 
 				for (x = 0; x < app_data->new_apps->max_items; x++)
 				{
-					NewAppData *temp_data = (NewAppData *)
-						g_array_index (app_data->new_apps->garray, NewAppData *, x);
+					NewLauncherData *temp_data = (NewLauncherData *)
+						g_array_index (app_data->new_apps->garray, NewLauncherData *, x);
 					if (!temp_data || filetime > temp_data->time)	/* if this slot is empty or we are newer than this slot */
 					{
-						NewAppData *temp = g_new0 (NewAppData, 1);
+						NewLauncherData *temp = g_new0 (NewLauncherData, 1);
 						temp->time = filetime;
-						temp->item = item;
+						temp->launcher = launcher;
 						g_array_insert_val (app_data->new_apps->garray, x,
 							temp);
 						break;
@@ -1218,13 +2165,13 @@ generate_new_apps (AppShellData * app_data)
 	{
 		for (x = 0; x < app_data->new_apps->max_items; x++)
 		{
-			NewAppData *data =
-				(NewAppData *) g_array_index (app_data->new_apps->garray,
-				NewAppData *, x);
+			NewLauncherData *data =
+				(NewLauncherData *) g_array_index (app_data->new_apps->garray,
+				NewLauncherData *, x);
 			if (data)
 			{
-				insert_launcher_into_category (new_apps_category, data->item,
-					app_data);
+				add_launcher_to_category (new_apps_category,
+					copy_launcher (data->launcher));
 				g_free (data);
 			}
 			else
@@ -1237,78 +2184,177 @@ generate_new_apps (AppShellData * app_data)
 	}
 	g_free (all_apps);
 	g_free (all_apps_file_name);
-	g_strfreev (all_apps_split);
 }
 
 static void
-insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * desktop_item,
-	AppShellData * app_data)
+search_key_add (GString * key, const gchar * text)
 {
-	GtkWidget *launcher;
-	static GtkSizeGroup *icon_group = NULL;
+	gchar *folded;
+
+	/* a newline can't be typed into the search bar, so it keeps the fields apart;
+	   empty ones are kept too so that the name is always the first */
+	if (text)
+	{
+		folded = search_fold (text);
+		g_string_append (key, folded);
+		g_free (folded);
+	}
+
+	g_string_append_c (key, '\n');
+}
 
+static const gchar *
+record_string (const gchar * text)
+{
+	return (text && g_utf8_validate (text, -1, NULL)) ? text : "";
+}
+
+/* Everything create_launcher () needs from a desktop item, for the cache */
+static GVariant *
+create_launcher_record (MateDesktopItem * desktop_item, gsize mtime)
+{
+	const gchar *name;
+	const gchar *description;
 	gchar *filepath;
 	gchar *filename;
-	GtkWidget *tile_icon;
+	GString *search_key;
+	GVariant *record;
 
-	if (!icon_group)
-		icon_group = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
+	/* application_tile_new_full () would refuse anything else */
+	if (mate_desktop_item_get_entry_type (desktop_item) != MATE_DESKTOP_ITEM_TYPE_APPLICATION
+		|| !mate_desktop_item_get_location (desktop_item))
+		return g_variant_new (LAUNCHER_RECORD_TYPE, FALSE, "", "", NULL, "", "", "", "",
+			(guint64) mtime);
 
-	launcher =
-		application_tile_new_full (mate_desktop_item_get_location (desktop_item),
-		app_data->icon_size, app_data->show_tile_generic_name);
-	gtk_widget_set_size_request (launcher, SIZING_TILE_WIDTH, -1);
+	/* what the tile shows, see application_tile_setup () */
+	name = record_string (mate_desktop_item_get_localestring (desktop_item, "Name"));
+	description = mate_desktop_item_get_localestring (desktop_item, "GenericName");
+	if (description && !g_utf8_validate (description, -1, NULL))
+		description = NULL;
 
 	filepath =
-		g_strdup (mate_desktop_item_get_string (desktop_item, MATE_DESKTOP_ITEM_EXEC));
+		g_strdup (record_string (mate_desktop_item_get_string (desktop_item,
+			MATE_DESKTOP_ITEM_EXEC)));
 	g_strdelimit (filepath, " ", '\0');	/* just want the file name - no args or replacements */
 	filename = g_strrstr (filepath, "/");
 	if (filename)
 		g_stpcpy (filepath, filename + 1);
 	filename = g_ascii_strdown (filepath, -1);
 	g_free (filepath);
-	g_object_set_data (G_OBJECT (launcher), TILE_EXEC_NAME, filename);
 
-	tile_icon = NAMEPLATE_TILE (launcher)->image;
+	/* everything the filter looks at, folded once instead of on every keystroke;
+	   the name comes first, see search_score () */
+	search_key = g_string_new (NULL);
+	search_key_add (search_key, name);
+	search_key_add (search_key, description);
+	search_key_add (search_key, filename);
+	search_key_add (search_key,
+		mate_desktop_item_get_localestring (desktop_item, "Keywords"));
+	g_string_truncate (search_key, search_key->len - 1);
+
+	record = g_variant_new (LAUNCHER_RECORD_TYPE, TRUE,
+		record_string (mate_desktop_item_get_location (desktop_item)), name, description,
+		filename, record_string (search_key->str),
+		record_string (mate_desktop_item_get_string (desktop_item, MATE_DESKTOP_ITEM_EXEC)),
+		record_string (mate_desktop_item_get_string (desktop_item,
+			MATE_DESKTOP_ITEM_CATEGORIES)),
+		(guint64) mtime);
+
+	g_free (filename);
+	g_string_free (search_key, TRUE);
+
+	return record;
+}
+
+/* Safe to call from the loading thread, the tile is made later by get_launcher_tile () */
+static LauncherData *
+create_launcher (LauncherCatalog * catalog, GVariant * record)
+{
+	LauncherData *launcher;
+	gboolean application;
+	const gchar *location, *name, *description, *exec_name, *search_key;
+	const gchar *exec, *categories;
+	guint64 mtime;
+
+	g_variant_get (record, "(b&s&sm&s&s&s&s&st)", &application, &location, &name,
+		&description, &exec_name, &search_key, &exec, &categories, &mtime);
+
+	if (!application || check_specific_apps_hack (catalog, exec, categories))
+		return NULL;
+
+	launcher = g_new0 (LauncherData, 1);
+	launcher->location = g_strdup (location);
+	launcher->name = g_strdup (name);
+	launcher->description = g_strdup (description);
+	launcher->exec_name = g_strdup (exec_name);
+	launcher->search_key = g_strdup (search_key);
+	launcher->mtime = mtime;
+	launcher->record = g_variant_ref (record);
+
+	return launcher;
+}
+
+/* For a launcher shown in two categories, which needs a tile for each */
+static LauncherData *
+copy_launcher (LauncherData * launcher)
+{
+	LauncherData *copy = g_new0 (LauncherData, 1);
+
+	copy->location = g_strdup (launcher->location);
+	copy->name = g_strdup (launcher->name);
+	copy->description = g_strdup (launcher->description);
+	copy->exec_name = g_strdup (launcher->exec_name);
+	copy->search_key = g_strdup (launcher->search_key);
+
+	return copy;
+}
+
+static GtkWidget *
+get_launcher_tile (AppShellData * app_data, LauncherData * launcher)
+{
+	static GtkSizeGroup *icon_group = NULL;
+
+	GtkWidget *tile_icon;
+
+	if (launcher->tile)
+		return launcher->tile;
+
+	if (!icon_group)
+		icon_group = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
+
+	launcher->tile = application_tile_new_full (launcher->location,
+		app_data->icon_size, app_data->show_tile_generic_name);
+	if (!launcher->tile)
+		return NULL;
+
+	gtk_widget_set_size_request (launcher->tile, SIZING_TILE_WIDTH, -1);
+
+	tile_icon = NAMEPLATE_TILE (launcher->tile)->image;
 	gtk_size_group_add_widget (icon_group, tile_icon);
 
-	g_signal_connect (launcher, "tile-activated", G_CALLBACK (tile_activated_cb), app_data);
+	g_signal_connect (launcher->tile, "tile-activated", G_CALLBACK (tile_activated_cb), app_data);
 
 	/* Note that this will handle the case of the action being launched via the side panel as
 	   well as directly from the context menu of an individual launcher, because they both
 	   funnel through tile_button_action_activate.
 	*/
-	g_signal_connect (launcher, "tile-action-triggered",
+	g_signal_connect (launcher->tile, "tile-action-triggered",
 		G_CALLBACK (handle_menu_action_performed), app_data);
 
 	/* These will be inserted/removed from tables as the filter changes and we dont want them */
 	/* destroyed when they are removed */
-	g_object_ref (launcher);
+	g_object_ref (launcher->tile);
 
-	/* use alphabetical order instead of the matemenu order. We group all sub items in each top level
-	category together, ignoring sub menus, so we also ignore sub menu layout hints */
-	cat_data->launcher_list =
-		/* g_list_insert (cat_data->launcher_list, launcher, -1); */
-		g_list_insert_sorted (cat_data->launcher_list, launcher, application_launcher_compare);
-	cat_data->filtered_launcher_list =
-		/* g_list_insert (cat_data->filtered_launcher_list, launcher, -1); */
-		g_list_insert_sorted (cat_data->filtered_launcher_list, launcher, application_launcher_compare);
+	return launcher->tile;
 }
 
 static gint
 application_launcher_compare (gconstpointer a, gconstpointer b)
 {
-	ApplicationTile *launcher1 = APPLICATION_TILE (a);
-	ApplicationTile *launcher2 = APPLICATION_TILE (b);
-
-	gchar *val1 = launcher1->name;
-	gchar *val2 = launcher2->name;
+	const LauncherData *launcher1 = a;
+	const LauncherData *launcher2 = b;
 
-	if (val1 == NULL || val2 == NULL)
-	{
-		g_assert_not_reached ();
-	}
-	return g_ascii_strcasecmp (val1, val2);
+	return g_ascii_strcasecmp (launcher1->name, launcher2->name);
 }
 
 static void
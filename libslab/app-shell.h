@@ -56,6 +56,8 @@ typedef struct
 	GArray *garray;
 } NewAppConfig;
 
+/* Only ever allocate it with appshelldata_new (), which keeps private state after
+   it; generate_categories () and layout_shell () refuse one made any other way */
 typedef struct _AppShellData
 {
 	GtkWidget *main_app;
@@ -107,6 +109,8 @@ typedef struct
 	Tile *group_launcher;
 
 	SlabSection *section;
+	/* Unused, always NULL: the launchers are kept by app-shell.c, and their tiles
+	   are only made once they are laid out */
 	GList *launcher_list;
 	GList *filtered_launcher_list;
 } CategoryData;
@@ -125,6 +129,10 @@ typedef struct
 
 void generate_categories (AppShellData * app_data);
 
+/* Loads the menu and its desktop files in a thread. layout_shell () may be called
+   before it is done, the categories are then filled in once they are loaded */
+void generate_categories_async (AppShellData * app_data);
+
 /* If new_apps_max_items is 0 then the new applications category is not created */
 AppShellData *appshelldata_new (const gchar * menu_name,
 	GtkIconSize icon_size, gboolean show_tile_generic_name, gboolean exit_on_close, gint new_apps_max_items);
@@ -30,6 +30,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
@@ -47,6 +48,27 @@
 
 #define TYPE_IS_RECENT(type) ((type) == BOOKMARK_STORE_RECENT_APPS || (type) == BOOKMARK_STORE_RECENT_DOCS)
 
+/* changes within this many milliseconds go into a single write, or a single reload */
+#define SAVE_DELAY   250
+#define RELOAD_DELAY 250
+
+/* The order of a reorderable store. The store keeps it as "rank-N" groups, which
+ * are only read when it is loaded and only written back for the uris whose rank
+ * changed when it is saved. */
+typedef struct {
+	gchar *uri;
+	gint   rank;
+	gint   stored_rank;
+} RankEntry;
+
+/* A write of the store, done in a thread */
+typedef struct {
+	gchar       *path;
+	gchar       *data;
+	gsize        length;
+	struct stat  written;
+} StoreWrite;
+
 typedef struct {
 	BookmarkStoreType        type;
 
@@ -57,6 +79,20 @@ typedef struct {
 	GBookmarkFile           *store;
 	gboolean                 needs_sync;
 
+	GPtrArray               *ranked;
+	GHashTable              *ranks;
+
+	guint                    save_timeout;
+	gboolean                 saving;
+	gboolean                 save_again;
+	guint                    reload_timeout;
+
+	/* the store file as our last write left it, to tell our writes from others */
+	guint                    write_generation;
+	ino_t                    written_ino;
+	time_t                   written_mtime;
+	off_t                    written_size;
+
 	gchar                   *store_path;
 	gchar                   *user_store_path;
 	gboolean                 user_modifiable;
@@ -100,7 +136,13 @@ static void update_agent (BookmarkAgent *);
 static void update_items (BookmarkAgent *);
 static void save_store   (BookmarkAgent *);
 static gint get_rank     (BookmarkAgent *, const gchar *);
-static void set_rank     (BookmarkAgent *, const gchar *, gint);
+
+static gboolean load_ranks       (BookmarkAgent *);
+static void     store_ranks      (BookmarkAgent *);
+static void     append_rank      (BookmarkAgent *, const gchar *, gint);
+static void     remove_rank      (BookmarkAgent *, const gchar *);
+static void     renumber_ranks   (BookmarkAgent *, gint);
+static void     rank_entry_free  (RankEntry *);
 
 static void load_xbel_store          (BookmarkAgent *);
 static void load_places_store        (BookmarkAgent *);
@@ -110,6 +152,12 @@ static void create_app_item          (BookmarkAgent *, const gchar *);
 static void create_doc_item          (BookmarkAgent *, const gchar *);
 static void create_dir_item          (BookmarkAgent *, const gchar *);
 
+static gboolean save_timeout_cb   (gpointer);
+static gboolean reload_timeout_cb (gpointer);
+static void     store_write_free  (StoreWrite *);
+static void     store_write_thread (GTask *, gpointer, gpointer, GCancellable *);
+static void     store_write_done_cb (GObject *, GAsyncResult *, gpointer);
+
 static void store_monitor_cb (GFileMonitor *, GFile *, GFile *,
                               GFileMonitorEvent, gpointer);
 static void weak_destroy_cb  (gpointer, GObject *);
@@ -187,7 +235,8 @@ bookmark_agent_add_item (BookmarkAgent *this, const BookmarkItem *item)
 
 	g_bookmark_file_add_application (priv->store, item->uri, item->app_name, item->app_exec);
 
-	set_rank (this, item->uri, g_bookmark_file_get_size (priv->store) - 1);
+	if (priv->reorderable && get_rank (this, item->uri) < 0)
+		append_rank (this, item->uri, -1);
 
 	save_store (this);
 }
@@ -237,6 +286,10 @@ bookmark_agent_purge_items (BookmarkAgent *this)
 		for (i = 0; i < uris_len; i++) {
 			g_bookmark_file_remove_item (priv->store, uris [i], NULL);
 		}
+		if (priv->reorderable) {
+			g_hash_table_remove_all (priv->ranks);
+			g_ptr_array_set_size (priv->ranked, 0);
+		}
 		save_store (this);
 	}
 	g_strfreev (uris);
@@ -247,14 +300,8 @@ bookmark_agent_remove_item (BookmarkAgent *this, const gchar *uri)
 {
         BookmarkAgentPrivate *priv = PRIVATE (this);
 
-        gint rank;
-
         GError *error = NULL;
 
-        gchar **uris = NULL;
-        gint    rank_i;
-        gint    i;
-
 
         g_return_if_fail (priv->user_modifiable);
 
@@ -271,23 +318,11 @@ bookmark_agent_remove_item (BookmarkAgent *this, const gchar *uri)
 				G_STRFUNC, priv->store_path, uri);
 	}
 	else {
-		rank = get_rank (this, uri);
+		if (priv->reorderable)
+			remove_rank (this, uri);
 
 		g_bookmark_file_remove_item (priv->store, uri, NULL);
 
-		if (rank >= 0) {
-			uris = g_bookmark_file_get_uris (priv->store, NULL);
-				 
-			for (i =  0; uris && uris [i]; ++i) {
-				rank_i = get_rank (this, uris [i]);
-
-				if (rank_i > rank)
-					set_rank (this, uris [i], rank_i - 1);
-			}
-
-			g_strfreev (uris);
-		}
-
 		save_store (this);
 	}
 }
@@ -297,13 +332,40 @@ bookmark_agent_reorder_items (BookmarkAgent *this, const gchar **uris)
 {
 	BookmarkAgentPrivate *priv = PRIVATE (this);
 
+	GPtrArray *ranked;
+	RankEntry *entry;
+
 	gint i;
 
 
 	g_return_if_fail (priv->reorderable);
 
-	for (i = 0; uris && uris [i]; ++i)
-		set_rank (this, uris [i], i);
+	/* the given uris first, then the others keeping their order */
+	ranked = g_ptr_array_sized_new (priv->ranked->len);
+
+	for (i = 0; uris && uris [i]; ++i) {
+		entry = g_hash_table_lookup (priv->ranks, uris [i]);
+
+		if (entry && entry->rank >= 0) {
+			g_ptr_array_add (ranked, entry);
+			entry->rank = -1;
+		}
+	}
+
+	for (i = 0; i < priv->ranked->len; ++i) {
+		entry = g_ptr_array_index (priv->ranked, i);
+
+		if (entry->rank >= 0)
+			g_ptr_array_add (ranked, entry);
+	}
+
+	/* the entries moved over, they're freed with the new array */
+	g_ptr_array_set_free_func (priv->ranked, NULL);
+	g_ptr_array_free (priv->ranked, TRUE);
+	g_ptr_array_set_free_func (ranked, (GDestroyNotify) rank_entry_free);
+	priv->ranked = ranked;
+
+	renumber_ranks (this, 0);
 
 	save_store (this);
 }
@@ -381,6 +443,9 @@ bookmark_agent_update_from_bookmark_file (BookmarkAgent *this, GBookmarkFile *st
 
 	g_list_free (items_ordered);
 
+	if (priv->reorderable)
+		load_ranks (this);
+
 	libslab_checkpoint ("bookmark_agent_update_from_bookmark_file(): updating internal items");
 	update_items (this);
 
@@ -456,6 +521,15 @@ bookmark_agent_init (BookmarkAgent *this)
 	priv->store               = NULL;
 	priv->needs_sync          = FALSE;
 
+	priv->ranked              = g_ptr_array_new_with_free_func ((GDestroyNotify) rank_entry_free);
+	priv->ranks               = g_hash_table_new (g_str_hash, g_str_equal);
+
+	priv->save_timeout        = 0;
+	priv->saving              = FALSE;
+	priv->save_again          = FALSE;
+	priv->reload_timeout      = 0;
+	priv->write_generation    = 0;
+
 	priv->store_path          = NULL;
 	priv->user_store_path     = NULL;
 	priv->user_modifiable     = FALSE;
@@ -595,7 +669,25 @@ finalize (GObject *g_obj)
 	BookmarkAgentPrivate *priv = PRIVATE (g_obj);
 
 	gint i;
+	gchar *dir;
+	GError *error = NULL;
+
+
+	/* a write is never running here, it holds a reference */
+	if (priv->save_timeout) {
+		g_source_remove (priv->save_timeout);
+
+		dir = g_path_get_dirname (priv->store_path);
+		g_mkdir_with_parents (dir, 0700);
+		g_free (dir);
+
+		if (! g_bookmark_file_to_file (priv->store, priv->store_path, & error))
+			libslab_handle_g_error (
+				& error, "%s: couldn't save bookmark file [%s]\n", G_STRFUNC, priv->store_path);
+	}
 
+	if (priv->reload_timeout)
+		g_source_remove (priv->reload_timeout);
 
 	for (i = 0; priv->items && priv->items [i]; ++i)
 		bookmark_item_free (priv->items [i]);
@@ -605,6 +697,9 @@ finalize (GObject *g_obj)
 	g_free (priv->user_store_path);
 	g_free (priv->gtk_store_path);
 
+	g_hash_table_destroy (priv->ranks);
+	g_ptr_array_free (priv->ranked, TRUE);
+
 	if (priv->store_monitor) {
 		g_signal_handlers_disconnect_by_func (priv->store_monitor, store_monitor_cb, this);
 		g_file_monitor_cancel (priv->store_monitor);
@@ -639,6 +734,12 @@ update_agent (BookmarkAgent *this)
 	if (priv->load_store)
 		priv->load_store (this);
 
+	if (priv->reorderable && load_ranks (this)) {
+		save_store (this);
+
+		return;
+	}
+
 	update_items (this);
 }
 
@@ -650,41 +751,25 @@ update_items (BookmarkAgent *this)
 	gchar    **uris            = NULL;
 	gchar    **uris_ordered    = NULL;
 	gsize      n_uris          = 0;
-	gint       rank            = -1;
-	gint       rank_corr       = -1;
 	gboolean   needs_update    = FALSE;
-	gboolean   store_corrupted = FALSE;
 	gchar     *new_title, *old_title;
 
 	gint i;
 
 
-	uris = g_bookmark_file_get_uris (priv->store, & n_uris);
-	uris_ordered = g_new0 (gchar *, n_uris + 1);
-	uris_ordered [n_uris] = NULL;
-
-	for (i = 0; uris && uris [i]; ++i) {
-		rank = get_rank (this, uris [i]);
-
-		if (rank < 0 || rank >= n_uris)
-			rank = i;
-
-		if (uris_ordered [rank]) {
-			store_corrupted = TRUE;
-			rank_corr = rank;
-
-			for (rank = 0; rank < n_uris; ++rank)
-				if (! uris_ordered [rank])
-					break;
+	if (priv->reorderable) {
+		n_uris = priv->ranked->len;
+		uris_ordered = g_new0 (gchar *, n_uris + 1);
 
-			g_warning (
-				"store corruption [%s] - multiple uris with same rank (%d): [%s] [%s], moving latter to %d",
-				priv->store_path, rank_corr, uris_ordered [rank_corr], uris [i], rank);
-		}
-
-		set_rank (this, uris [i], rank);
+		for (i = 0; i < n_uris; ++i)
+			uris_ordered [i] = ((RankEntry *) g_ptr_array_index (priv->ranked, i))->uri;
+	}
+	else {
+		uris = g_bookmark_file_get_uris (priv->store, & n_uris);
+		uris_ordered = g_new0 (gchar *, n_uris + 1);
 
-		uris_ordered [rank] = uris [i];
+		for (i = 0; i < n_uris; ++i)
+			uris_ordered [i] = uris [i];
 	}
 
 	if (priv->n_items != n_uris)
@@ -736,9 +821,6 @@ update_items (BookmarkAgent *this)
 			g_object_notify (G_OBJECT (this), BOOKMARK_AGENT_ITEMS_PROP);
 	}
 
-	if (store_corrupted)
-		save_store (this);
-
 	g_strfreev (uris);
 	g_free (uris_ordered);
 }
@@ -748,20 +830,37 @@ save_store (BookmarkAgent *this)
 {
 	BookmarkAgentPrivate *priv = PRIVATE (this);
 
-	gchar *dir;
-
-
 	g_return_if_fail (priv->user_modifiable);
 
 	priv->needs_sync = TRUE;
 	priv->update_path (this);
 
-	dir = g_path_get_dirname (priv->store_path);
-	g_mkdir_with_parents (dir, 0700);
-	g_free (dir);
+	if (priv->reorderable)
+		store_ranks (this);
 
-	priv->save_store (this);
+	/* the items follow right away, the file once the changes settle */
 	update_items (this);
+
+	if (priv->save_store && ! priv->save_timeout)
+		priv->save_timeout = g_timeout_add (SAVE_DELAY, save_timeout_cb, this);
+}
+
+static gboolean
+save_timeout_cb (gpointer user_data)
+{
+	BookmarkAgent        *this = BOOKMARK_AGENT (user_data);
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+
+	priv->save_timeout = 0;
+
+	/* one write at a time, so that they land in order */
+	if (priv->saving)
+		priv->save_again = TRUE;
+	else
+		priv->save_store (this);
+
+	return FALSE;
 }
 
 static gint
@@ -769,15 +868,28 @@ get_rank (BookmarkAgent *this, const gchar *uri)
 {
 	BookmarkAgentPrivate *priv = PRIVATE (this);
 
+	RankEntry *entry;
+
+
+	if (! priv->reorderable)
+		return -1;
+
+	entry = g_hash_table_lookup (priv->ranks, uri);
+
+	return entry ? entry->rank : -1;
+}
+
+static gint
+get_stored_rank (BookmarkAgent *this, const gchar *uri)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
 	gchar **groups;
 	gint    rank;
 
 	gint i;
 
 
-	if (! priv->reorderable)
-		return -1;
-
 	groups = g_bookmark_file_get_groups (priv->store, uri, NULL, NULL);
 	rank   = -1;
 
@@ -797,31 +909,159 @@ get_rank (BookmarkAgent *this, const gchar *uri)
 	return rank;
 }
 
-static void
-set_rank (BookmarkAgent *this, const gchar *uri, gint rank)
+/* Builds the rank index from the "rank-N" groups of a freshly loaded store.
+ * Returns TRUE if they had to be fixed, so that the store gets saved. */
+static gboolean
+load_ranks (BookmarkAgent *this)
 {
 	BookmarkAgentPrivate *priv = PRIVATE (this);
 
-	gchar **groups;
-	gchar  *group;
+	gchar    **uris            = NULL;
+	gchar    **uris_ordered    = NULL;
+	gint      *stored_ranks    = NULL;
+	gsize      n_uris          = 0;
+	gint       rank            = -1;
+	gint       rank_corr       = -1;
+	gboolean   store_corrupted = FALSE;
 
 	gint i;
 
 
-	if (! (priv->reorderable && bookmark_agent_has_item (this, uri)))
+	uris = g_bookmark_file_get_uris (priv->store, & n_uris);
+	uris_ordered = g_new0 (gchar *, n_uris + 1);
+	stored_ranks = g_new (gint, n_uris + 1);
+
+	for (i = 0; uris && uris [i]; ++i) {
+		rank = get_stored_rank (this, uris [i]);
+
+		stored_ranks [i] = rank;
+
+		if (rank < 0 || rank >= n_uris)
+			rank = i;
+
+		if (uris_ordered [rank]) {
+			store_corrupted = TRUE;
+			rank_corr = rank;
+
+			for (rank = 0; rank < n_uris; ++rank)
+				if (! uris_ordered [rank])
+					break;
+
+			g_warning (
+				"store corruption [%s] - multiple uris with same rank (%d): [%s] [%s], moving latter to %d",
+				priv->store_path, rank_corr, uris_ordered [rank_corr], uris [i], rank);
+		}
+
+		uris_ordered [rank] = uris [i];
+	}
+
+	g_ptr_array_set_size (priv->ranked, 0);
+	g_hash_table_remove_all (priv->ranks);
+
+	for (i = 0; i < n_uris; ++i)
+		append_rank (this, uris_ordered [i], -1);
+
+	for (i = 0; uris && uris [i]; ++i)
+		((RankEntry *) g_hash_table_lookup (priv->ranks, uris [i]))->stored_rank = stored_ranks [i];
+
+	g_strfreev (uris);
+	g_free (uris_ordered);
+	g_free (stored_ranks);
+
+	return store_corrupted;
+}
+
+/* Writes the ranks which changed since the store was loaded or saved back to it */
+static void
+store_ranks (BookmarkAgent *this)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+	RankEntry  *entry;
+	gchar     **groups;
+	gchar      *group;
+
+	gint i, j;
+
+
+	for (i = 0; i < priv->ranked->len; ++i) {
+		entry = g_ptr_array_index (priv->ranked, i);
+
+		if (entry->rank == entry->stored_rank)
+			continue;
+
+		groups = g_bookmark_file_get_groups (priv->store, entry->uri, NULL, NULL);
+
+		for (j = 0; groups && groups [j]; ++j)
+			if (g_str_has_prefix (groups [j], "rank-"))
+				g_bookmark_file_remove_group (priv->store, entry->uri, groups [j], NULL);
+
+		g_strfreev (groups);
+
+		group = g_strdup_printf ("rank-%d", entry->rank);
+		g_bookmark_file_add_group (priv->store, entry->uri, group);
+		g_free (group);
+
+		entry->stored_rank = entry->rank;
+	}
+}
+
+static void
+append_rank (BookmarkAgent *this, const gchar *uri, gint stored_rank)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+	RankEntry *entry;
+
+
+	entry = g_new0 (RankEntry, 1);
+	entry->uri         = g_strdup (uri);
+	entry->rank        = priv->ranked->len;
+	entry->stored_rank = stored_rank;
+
+	g_ptr_array_add (priv->ranked, entry);
+	g_hash_table_insert (priv->ranks, entry->uri, entry);
+}
+
+static void
+remove_rank (BookmarkAgent *this, const gchar *uri)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+	RankEntry *entry;
+	gint       rank;
+
+
+	entry = g_hash_table_lookup (priv->ranks, uri);
+
+	if (! entry)
 		return;
 
-	groups = g_bookmark_file_get_groups (priv->store, uri, NULL, NULL);
+	rank = entry->rank;
 
-	for (i = 0; groups && groups [i]; ++i)
-		if (g_str_has_prefix (groups [i], "rank-"))
-			g_bookmark_file_remove_group (priv->store, uri, groups [i], NULL);
+	g_hash_table_remove (priv->ranks, uri);
+	g_ptr_array_remove_index (priv->ranked, rank);
 
-	g_strfreev (groups);
+	renumber_ranks (this, rank);
+}
+
+static void
+renumber_ranks (BookmarkAgent *this, gint from)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
 
-	group = g_strdup_printf ("rank-%d", rank);
-	g_bookmark_file_add_group (priv->store, uri, group);
-	g_free (group);
+	gint i;
+
+
+	for (i = from; i < priv->ranked->len; ++i)
+		((RankEntry *) g_ptr_array_index (priv->ranked, i))->rank = i;
+}
+
+static void
+rank_entry_free (RankEntry *entry)
+{
+	g_free (entry->uri);
+	g_free (entry);
 }
 
 static void
@@ -1035,12 +1275,94 @@ save_xbel_store (BookmarkAgent *this)
 {
 	BookmarkAgentPrivate *priv = PRIVATE (this);
 
+	StoreWrite *write;
+	GTask      *task;
+
 	GError *error = NULL;
 
 
-	if (! g_bookmark_file_to_file (priv->store, priv->store_path, & error))
+	write = g_new0 (StoreWrite, 1);
+	write->data = g_bookmark_file_to_data (priv->store, & write->length, & error);
+
+	if (! write->data) {
 		libslab_handle_g_error (
 			& error, "%s: couldn't save bookmark file [%s]\n", G_STRFUNC, priv->store_path);
+		store_write_free (write);
+
+		return;
+	}
+
+	write->path = g_strdup (priv->store_path);
+
+	priv->saving = TRUE;
+	priv->write_generation++;
+
+	task = g_task_new (this, NULL, store_write_done_cb, NULL);
+	g_task_set_task_data (task, write, (GDestroyNotify) store_write_free);
+	g_task_run_in_thread (task, store_write_thread);
+	g_object_unref (task);
+}
+
+static void
+store_write_free (StoreWrite *write)
+{
+	g_free (write->path);
+	g_free (write->data);
+	g_free (write);
+}
+
+static void
+store_write_thread (GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable)
+{
+	StoreWrite *write = task_data;
+
+	gchar *dir;
+
+	GError *error = NULL;
+
+
+	dir = g_path_get_dirname (write->path);
+	g_mkdir_with_parents (dir, 0700);
+	g_free (dir);
+
+	/* written to a temporary file and renamed over the store */
+	if (! g_file_set_contents (write->path, write->data, write->length, & error)) {
+		g_task_return_error (task, error);
+
+		return;
+	}
+
+	if (g_stat (write->path, & write->written) < 0)
+		memset (& write->written, 0, sizeof (write->written));
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+store_write_done_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	BookmarkAgent        *this  = BOOKMARK_AGENT (source);
+	BookmarkAgentPrivate *priv  = PRIVATE (this);
+	StoreWrite           *write = g_task_get_task_data (G_TASK (result));
+
+	GError *error = NULL;
+
+
+	priv->saving = FALSE;
+
+	if (g_task_propagate_boolean (G_TASK (result), & error)) {
+		priv->written_ino   = write->written.st_ino;
+		priv->written_mtime = write->written.st_mtime;
+		priv->written_size  = write->written.st_size;
+	}
+	else
+		libslab_handle_g_error (
+			& error, "%s: couldn't save bookmark file [%s]\n", G_STRFUNC, write->path);
+
+	if (priv->save_again) {
+		priv->save_again = FALSE;
+		priv->save_store (this);
+	}
 }
 
 static void
@@ -1215,11 +1537,52 @@ create_dir_item (BookmarkAgent *this, const gchar *uri)
 	g_free (uri_new);
 }
 
+/* Whether the store file is still the one our last write left */
+static gboolean
+is_own_write (BookmarkAgent *this)
+{
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+	struct stat buf;
+
+
+	if (! priv->write_generation || ! priv->store_path || g_stat (priv->store_path, & buf) < 0)
+		return FALSE;
+
+	return buf.st_ino == priv->written_ino && buf.st_mtime == priv->written_mtime &&
+		buf.st_size == priv->written_size;
+}
+
 static void
 store_monitor_cb (GFileMonitor *mon, GFile *f1, GFile *f2,
                   GFileMonitorEvent event_type, gpointer user_data)
 {
-	update_agent (BOOKMARK_AGENT (user_data));
+	BookmarkAgent        *this = BOOKMARK_AGENT (user_data);
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+
+	if (mon == priv->store_monitor && (priv->saving || is_own_write (this)))
+		return;
+
+	if (! priv->reload_timeout)
+		priv->reload_timeout = g_timeout_add (RELOAD_DELAY, reload_timeout_cb, this);
+}
+
+static gboolean
+reload_timeout_cb (gpointer user_data)
+{
+	BookmarkAgent        *this = BOOKMARK_AGENT (user_data);
+	BookmarkAgentPrivate *priv = PRIVATE (this);
+
+
+	/* let our pending changes reach the file first */
+	if (priv->save_timeout || priv->saving)
+		return TRUE;
+
+	priv->reload_timeout = 0;
+	update_agent (this);
+
+	return FALSE;
 }
 
 static void
@@ -429,40 +429,27 @@ load_image (DocumentTile *tile)
 	DocumentTilePrivate *priv = DOCUMENT_TILE_GET_PRIVATE (tile);
 
 	gchar *icon_id = NULL;
-	gboolean free_icon_id = TRUE;
-	MateDesktopThumbnailFactory *thumbnail_factory;
 	GIcon *icon;
 
 	libslab_checkpoint ("document-tile.c: load_image(): start for %s", TILE (tile)->uri);
 
 	if (priv->force_icon_name || ! priv->mime_type) {
-		if (priv->force_icon_name)
-			icon_id = priv->force_icon_name;
-		else
-			icon_id = "text-x-preview";
-		free_icon_id = FALSE;
-
-		goto exit;
-	}
-
-	thumbnail_factory = libslab_thumbnail_factory_get ();
-
-	icon_id = mate_desktop_thumbnail_factory_lookup (thumbnail_factory, TILE (tile)->uri, priv->modified);
-
-	if (! icon_id) {
+		priv->image_is_broken = slab_load_image (
+			GTK_IMAGE (NAMEPLATE_TILE (tile)->image), GTK_ICON_SIZE_DND,
+			priv->force_icon_name ? priv->force_icon_name : "text-x-preview");
+	} else {
+		/* the mime type icon stands in until the thumbnail has been looked up */
 		icon = g_content_type_get_icon (priv->mime_type);
 		g_object_get (icon, "name", &icon_id, NULL);
 
 		g_object_unref (icon);
-	}	
 
-exit:
+		priv->image_is_broken = slab_load_thumbnail (
+			GTK_IMAGE (NAMEPLATE_TILE (tile)->image), GTK_ICON_SIZE_DND,
+			TILE (tile)->uri, priv->modified, icon_id);
 
-	priv->image_is_broken = slab_load_image (
-		GTK_IMAGE (NAMEPLATE_TILE (tile)->image), GTK_ICON_SIZE_DND, icon_id);
-
-	if (free_icon_id && icon_id)
 		g_free (icon_id);
+	}
 
 	libslab_checkpoint ("document-tile.c: load_image(): end");
 }
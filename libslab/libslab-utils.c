@@ -13,6 +13,8 @@
 #include <sys/time.h>
 #include <gtk/gtk.h>
 
+#include "capplets/common/trace-event.h"
+
 #define DESKTOP_ITEM_TERMINAL_EMULATOR_FLAG "TerminalEmulator"
 #define ALTERNATE_DOCPATH_KEY               "DocPath"
 
@@ -484,6 +486,18 @@ libslab_checkpoint_init (const char *checkpoint_config_file_basename,
 	g_free (filename);
 }
 
+void
+libslab_trace_begin (const char *name)
+{
+	trace_event ("libslab", name, "B");
+}
+
+void
+libslab_trace_end (const char *name)
+{
+	trace_event ("libslab", name, "E");
+}
+
 void
 libslab_checkpoint (const char *format, ...)
 {
@@ -491,9 +505,27 @@ libslab_checkpoint (const char *format, ...)
 	struct timeval tv;
 	struct tm tm;
 	struct rusage rusage;
+	gchar *message;
+	gboolean tracing;
+
+	tracing = trace_event_enabled ("libslab");
+
+	if (!checkpoint_file && !tracing)
+		return;
+
+	va_start (args, format);
+	message = g_strdup_vprintf (format, args);
+	va_end (args);
+
+	/* checkpoints show up as instant events in the trace */
+	if (tracing)
+		trace_event ("libslab", message, "i");
 
 	if (!checkpoint_file)
+	{
+		g_free (message);
 		return;
+	}
 
 	gettimeofday (&tv, NULL);
 	tm = *localtime (&tv.tv_sec);
@@ -511,10 +543,9 @@ libslab_checkpoint (const char *format, ...)
 		 (int) rusage.ru_stime.tv_sec,
 		 (int) (rusage.ru_stime.tv_usec / 100));
 
-	va_start (args, format);
-	vfprintf (checkpoint_file, format, args);
-	va_end (args);
-
+	fputs (message, checkpoint_file);
 	fputs ("\n", checkpoint_file);
 	fflush (checkpoint_file);
+
+	g_free (message);
 }
@@ -33,6 +33,8 @@ MateDesktopThumbnailFactory *libslab_thumbnail_factory_get (void);
 
 void libslab_checkpoint_init (const char *checkpoint_config_file_basename, const char *checkpoint_file_basename);
 void libslab_checkpoint (const char *format, ...);
+void libslab_trace_begin (const char *name);
+void libslab_trace_end (const char *name);
 
 #ifdef __cplusplus
 }
@@ -249,6 +249,217 @@ slab_load_image (GtkImage * image, GtkIconSize size, const gchar * image_id)
 	}
 }
 
+#define THUMBNAIL_CACHE_SIZE   256
+#define THUMBNAIL_LOAD_THREADS 2
+#define THUMBNAIL_REQUEST_KEY  "slab-thumbnail-request"
+
+typedef struct {
+	GtkImage                    *image;
+	MateDesktopThumbnailFactory *factory;
+	gchar                       *key;
+	gchar                       *uri;
+	time_t                       mtime;
+	gint                         width;
+	gint                         height;
+	GdkPixbuf                   *pixbuf;
+	gboolean                     looked_up;
+	gint                         cancelled;
+} ThumbnailRequest;
+
+typedef struct {
+	gchar     *key;
+	GdkPixbuf *pixbuf;
+} ThumbnailCacheEntry;
+
+/* Shared by every tile, keyed by uri, mtime and pixel size.  Entries without
+ * a pixbuf remember that the file has no thumbnail.  The queue keeps the most
+ * recently used entry at its head. */
+static GHashTable  *thumbnail_cache;
+static GQueue       thumbnail_lru = G_QUEUE_INIT;
+static GThreadPool *thumbnail_pool;
+
+static void
+thumbnail_cache_entry_free (ThumbnailCacheEntry *entry)
+{
+	g_free (entry->key);
+
+	if (entry->pixbuf)
+		g_object_unref (entry->pixbuf);
+
+	g_free (entry);
+}
+
+static gboolean
+thumbnail_cache_lookup (const gchar *key, GdkPixbuf **pixbuf)
+{
+	GList *link;
+
+	if (! thumbnail_cache)
+		return FALSE;
+
+	link = g_hash_table_lookup (thumbnail_cache, key);
+
+	if (! link)
+		return FALSE;
+
+	g_queue_unlink (&thumbnail_lru, link);
+	g_queue_push_head_link (&thumbnail_lru, link);
+
+	*pixbuf = ((ThumbnailCacheEntry *) link->data)->pixbuf;
+
+	return TRUE;
+}
+
+static void
+thumbnail_cache_insert (const gchar *key, GdkPixbuf *pixbuf)
+{
+	ThumbnailCacheEntry *entry;
+	GdkPixbuf           *cached;
+
+	if (! thumbnail_cache)
+		thumbnail_cache = g_hash_table_new (g_str_hash, g_str_equal);
+	else if (thumbnail_cache_lookup (key, &cached))
+		return;
+
+	entry = g_new0 (ThumbnailCacheEntry, 1);
+	entry->key = g_strdup (key);
+	entry->pixbuf = pixbuf ? g_object_ref (pixbuf) : NULL;
+
+	g_queue_push_head (&thumbnail_lru, entry);
+	g_hash_table_insert (thumbnail_cache, entry->key, thumbnail_lru.head);
+
+	while (g_queue_get_length (&thumbnail_lru) > THUMBNAIL_CACHE_SIZE) {
+		entry = g_queue_pop_tail (&thumbnail_lru);
+
+		g_hash_table_remove (thumbnail_cache, entry->key);
+		thumbnail_cache_entry_free (entry);
+	}
+}
+
+static void
+thumbnail_request_free (ThumbnailRequest *request)
+{
+	g_object_unref (request->factory);
+	g_free (request->key);
+	g_free (request->uri);
+
+	if (request->pixbuf)
+		g_object_unref (request->pixbuf);
+
+	g_free (request);
+}
+
+/* Runs when the image goes away or asks for another thumbnail; the request
+ * itself is freed once the pool hands it back. */
+static void
+thumbnail_request_cancel (gpointer data)
+{
+	ThumbnailRequest *request = data;
+
+	request->image = NULL;
+	g_atomic_int_set (&request->cancelled, 1);
+}
+
+static gboolean
+thumbnail_loaded_idle (gpointer data)
+{
+	ThumbnailRequest *request = data;
+
+	if (request->looked_up)
+		thumbnail_cache_insert (request->key, request->pixbuf);
+
+	if (request->image) {
+		g_object_steal_data (G_OBJECT (request->image), THUMBNAIL_REQUEST_KEY);
+
+		if (request->pixbuf)
+			gtk_image_set_from_pixbuf (request->image, request->pixbuf);
+	}
+
+	thumbnail_request_free (request);
+
+	return FALSE;
+}
+
+static void
+thumbnail_load_thread (gpointer data, gpointer user_data)
+{
+	ThumbnailRequest *request = data;
+	gchar            *path;
+
+	/* the factory serializes lookups with its own lock */
+	if (! g_atomic_int_get (&request->cancelled)) {
+		libslab_trace_begin ("thumbnail");
+
+		path = mate_desktop_thumbnail_factory_lookup (
+			request->factory, request->uri, request->mtime);
+
+		if (path)
+			request->pixbuf = gdk_pixbuf_new_from_file_at_size (
+				path, request->width, request->height, NULL);
+
+		request->looked_up = TRUE;
+
+		g_free (path);
+
+		libslab_trace_end ("thumbnail");
+	}
+
+	g_idle_add (thumbnail_loaded_idle, request);
+}
+
+gboolean
+slab_load_thumbnail (GtkImage * image, GtkIconSize size, const gchar * uri, time_t mtime,
+	const gchar * fallback_id)
+{
+	ThumbnailRequest *request;
+	GdkPixbuf        *pixbuf;
+	gchar            *key;
+	gint              width;
+	gint              height;
+	gboolean          loaded;
+
+	/* drops any load still pending for this image */
+	g_object_set_data (G_OBJECT (image), THUMBNAIL_REQUEST_KEY, NULL);
+
+	gtk_icon_size_lookup (size, &width, &height);
+
+	key = g_strdup_printf ("%s\n%ld\n%d", uri, (glong) mtime, width);
+
+	if (thumbnail_cache_lookup (key, &pixbuf)) {
+		g_free (key);
+
+		if (! pixbuf)
+			return slab_load_image (image, size, fallback_id);
+
+		gtk_image_set_from_pixbuf (image, pixbuf);
+
+		return TRUE;
+	}
+
+	/* icon themes are not thread safe, so the placeholder is loaded here */
+	loaded = slab_load_image (image, size, fallback_id);
+
+	if (! thumbnail_pool)
+		thumbnail_pool = g_thread_pool_new (
+			thumbnail_load_thread, NULL, THUMBNAIL_LOAD_THREADS, FALSE, NULL);
+
+	request = g_new0 (ThumbnailRequest, 1);
+	request->image = image;
+	request->factory = g_object_ref (libslab_thumbnail_factory_get ());
+	request->key = key;
+	request->uri = g_strdup (uri);
+	request->mtime = mtime;
+	request->width = width;
+	request->height = height;
+
+	g_object_set_data_full (G_OBJECT (image), THUMBNAIL_REQUEST_KEY, request,
+		thumbnail_request_cancel);
+
+	g_thread_pool_push (thumbnail_pool, request, NULL);
+
+	return loaded;
+}
+
 gchar *
 string_replace_once (const gchar * str_template, const gchar * key, const gchar * value)
 {
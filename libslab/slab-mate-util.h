@@ -23,6 +23,7 @@
 
 #include <glib.h>
 #include <gtk/gtk.h>
+#include <time.h>
 #include <libmate-desktop/mate-desktop-item.h>
 
 #ifdef __cplusplus
@@ -59,6 +60,8 @@ gboolean open_desktop_item_help (MateDesktopItem * desktop_item);
 gint desktop_item_location_compare (gconstpointer a, gconstpointer b);
 
 gboolean slab_load_image (GtkImage * image, GtkIconSize size, const gchar * image_id);
+gboolean slab_load_thumbnail (GtkImage * image, GtkIconSize size, const gchar * uri, time_t mtime,
+	const gchar * fallback_id);
 
 gchar *string_replace_once (const gchar * str_template, const gchar * key, const gchar * value);
 
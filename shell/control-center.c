@@ -195,7 +195,7 @@ int main(int argc, char* argv[])
 	}
 
 	app_data = appshelldata_new("matecc.menu", GTK_ICON_SIZE_DND, FALSE, TRUE, 0);
-	generate_categories(app_data);
+	generate_categories_async(app_data);
 
 	actions = get_actions_list();
 	layout_shell(app_data, _("Filter"), _("Groups"), _("Common Tasks"), actions, handle_static_action_clicked);
@@ -28,19 +28,31 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
 #include "drw-monitor.h"
 
+/* Seconds to wait before listening for activity again, so that typing
+ * doesn't wake us up on every key press. */
+#define REARM_TIMEOUT 3
+
 struct _DrwMonitorPriv {
 	XScreenSaverInfo *ss_info;
 	guint             timeout_id;
 	unsigned long     last_idle;
 
 	time_t            last_activity;
+
+	/* With the IDLETIME counter of the SYNC extension, the X server
+	 * wakes us up when the user comes back instead of being polled. */
+	XSyncCounter      idle_counter;
+	XSyncAlarm        reset_alarm;
+	int               sync_event_base;
 };
 
 /* Signals */
@@ -54,6 +66,10 @@ static void     drw_monitor_class_init    (DrwMonitorClass *klass);
 static void     drw_monitor_init          (DrwMonitor      *monitor);
 static void     drw_monitor_finalize      (GObject         *object);
 static gboolean drw_monitor_setup         (DrwMonitor      *monitor);
+static GdkFilterReturn
+                drw_monitor_event_filter  (GdkXEvent       *xevent,
+					   GdkEvent        *event,
+					   gpointer         data);
 
 static GObjectClass *parent_class;
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -123,8 +139,16 @@ drw_monitor_finalize (GObject *object)
         
         priv = monitor->priv;
 
-	g_source_remove (priv->timeout_id);
-	priv->timeout_id = 0;
+	if (priv->timeout_id) {
+		g_source_remove (priv->timeout_id);
+		priv->timeout_id = 0;
+	}
+
+	if (priv->reset_alarm != None) {
+		gdk_window_remove_filter (NULL, drw_monitor_event_filter, monitor);
+		XSyncDestroyAlarm (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+				   priv->reset_alarm);
+	}
 
 	if (priv->ss_info) {
 		XFree (priv->ss_info);
@@ -138,23 +162,33 @@ drw_monitor_finalize (GObject *object)
         }
 }
 
+static void
+drw_monitor_user_active (DrwMonitor *monitor)
+{
+	DrwMonitorPriv *priv;
+	time_t          now;
+
+	priv = monitor->priv;
+	now = time (NULL);
+
+	/* A single key press after a long pause isn't typing yet */
+	if (now - priv->last_activity < 25) {
+		g_signal_emit (monitor, signals[ACTIVITY], 0, NULL);
+	}
+
+	priv->last_activity = now;
+}
+
 static gboolean
 drw_monitor_timeout (DrwMonitor *monitor)
 {
 	DrwMonitorPriv *priv;
- 	time_t          now;
 
 	priv = monitor->priv;
 	
 	if (XScreenSaverQueryInfo (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), DefaultRootWindow (GDK_DISPLAY_XDISPLAY(gdk_display_get_default())), priv->ss_info) != 0) {
 		if (priv->ss_info->idle < priv->last_idle) {
- 			now = time (NULL);
- 
- 			if (now - priv->last_activity < 25) {
- 				g_signal_emit (monitor, signals[ACTIVITY], 0, NULL);
- 			}
- 			
- 			priv->last_activity = now;
+			drw_monitor_user_active (monitor);
 		}
 
 		priv->last_idle = priv->ss_info->idle;
@@ -163,6 +197,159 @@ drw_monitor_timeout (DrwMonitor *monitor)
 	return TRUE;
 }
 
+/* Makes the alarm go off as soon as the idle time drops, that is on
+ * the next input event. */
+static void
+drw_monitor_arm_reset_alarm (DrwMonitor *monitor)
+{
+	DrwMonitorPriv       *priv;
+	Display              *dpy;
+	XSyncValue            idle;
+	XSyncAlarmAttributes  attr;
+	unsigned long         flags;
+
+	priv = monitor->priv;
+	dpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+	if (!XSyncQueryCounter (dpy, priv->idle_counter, &idle)) {
+		return;
+	}
+
+	/* The counter has to rise to the value before it can drop below it */
+	if (XSyncValueHigh32 (idle) == 0 && XSyncValueLow32 (idle) == 0) {
+		XSyncIntToValue (&idle, 1);
+	}
+
+	attr.trigger.counter = priv->idle_counter;
+	attr.trigger.value_type = XSyncAbsolute;
+	attr.trigger.test_type = XSyncNegativeTransition;
+	attr.trigger.wait_value = idle;
+	XSyncIntToValue (&attr.delta, 0);
+	attr.events = True;
+
+	flags = XSyncCACounter | XSyncCAValueType | XSyncCATestType |
+		XSyncCAValue | XSyncCADelta | XSyncCAEvents;
+
+	gdk_error_trap_push ();
+
+	if (priv->reset_alarm == None) {
+		priv->reset_alarm = XSyncCreateAlarm (dpy, flags, &attr);
+	} else {
+		XSyncChangeAlarm (dpy, priv->reset_alarm, flags, &attr);
+	}
+
+	gdk_flush ();
+	gdk_error_trap_pop ();
+}
+
+/* The server keeps a triggered alarm active, so without this every
+ * further key press would still send an event. */
+static void
+drw_monitor_disarm_reset_alarm (DrwMonitor *monitor)
+{
+	DrwMonitorPriv       *priv;
+	XSyncAlarmAttributes  attr;
+
+	priv = monitor->priv;
+
+	attr.events = False;
+
+	gdk_error_trap_push ();
+	XSyncChangeAlarm (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+			  priv->reset_alarm, XSyncCAEvents, &attr);
+	gdk_flush ();
+	gdk_error_trap_pop ();
+}
+
+static gboolean
+drw_monitor_rearm_timeout (DrwMonitor *monitor)
+{
+	monitor->priv->timeout_id = 0;
+
+	drw_monitor_arm_reset_alarm (monitor);
+
+	return FALSE;
+}
+
+static GdkFilterReturn
+drw_monitor_event_filter (GdkXEvent *xevent,
+			  GdkEvent  *event,
+			  gpointer   data)
+{
+	DrwMonitor            *monitor = data;
+	DrwMonitorPriv        *priv = monitor->priv;
+	XEvent                *xev = xevent;
+	XSyncAlarmNotifyEvent *alarm_event;
+
+	if (xev->type != priv->sync_event_base + XSyncAlarmNotify) {
+		return GDK_FILTER_CONTINUE;
+	}
+
+	alarm_event = (XSyncAlarmNotifyEvent *) xev;
+	if (alarm_event->alarm != priv->reset_alarm) {
+		return GDK_FILTER_CONTINUE;
+	}
+
+	if (priv->timeout_id == 0) {
+		drw_monitor_disarm_reset_alarm (monitor);
+		drw_monitor_user_active (monitor);
+
+		priv->timeout_id = g_timeout_add_seconds (REARM_TIMEOUT,
+							  (GSourceFunc) drw_monitor_rearm_timeout,
+							  monitor);
+	}
+
+	return GDK_FILTER_REMOVE;
+}
+
+static gboolean
+drw_monitor_setup_idle_alarm (DrwMonitor *monitor)
+{
+	DrwMonitorPriv     *priv;
+	Display            *dpy;
+	XSyncSystemCounter *counters;
+	int                 event_base;
+	int                 error_base;
+	int                 major;
+	int                 minor;
+	int                 n_counters;
+	int                 i;
+
+	priv = monitor->priv;
+	dpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+	if (!XSyncQueryExtension (dpy, &event_base, &error_base) ||
+	    !XSyncInitialize (dpy, &major, &minor)) {
+		return FALSE;
+	}
+
+	counters = XSyncListSystemCounters (dpy, &n_counters);
+	for (i = 0; i < n_counters; i++) {
+		if (strcmp (counters[i].name, "IDLETIME") == 0) {
+			priv->idle_counter = counters[i].counter;
+			break;
+		}
+	}
+	if (counters) {
+		XSyncFreeSystemCounterList (counters);
+	}
+
+	if (i == n_counters) {
+		return FALSE;
+	}
+
+	priv->sync_event_base = event_base;
+
+	drw_monitor_arm_reset_alarm (monitor);
+	if (priv->reset_alarm == None) {
+		return FALSE;
+	}
+
+	gdk_window_add_filter (NULL, drw_monitor_event_filter, monitor);
+
+	return TRUE;
+}
+
 static gboolean
 drw_monitor_setup (DrwMonitor *monitor)
 {
@@ -172,14 +359,19 @@ drw_monitor_setup (DrwMonitor *monitor)
 
 	priv = monitor->priv;
 
+	priv->last_activity = time (NULL);
+
+	if (drw_monitor_setup_idle_alarm (monitor)) {
+		return TRUE;
+	}
+
+	/* Without the SYNC extension, poll the screensaver's idle time */
 	if (!XScreenSaverQueryExtension (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), &event_base, &error_base)) {
 		return FALSE;
 	}
 
 	priv->ss_info = XScreenSaverAllocInfo ();
 
-	priv->last_activity = time (NULL);
-	
 	priv->timeout_id = g_timeout_add_seconds (3, (GSourceFunc) drw_monitor_timeout, monitor);
 	
 	return TRUE;
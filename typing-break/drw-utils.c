@@ -23,70 +23,42 @@
 #include <gtk/gtk.h>
 #include "drw-utils.h"
 
-static GdkPixbuf *
-create_tile_pixbuf (GdkPixbuf    *dest_pixbuf,
-		    GdkPixbuf    *src_pixbuf,
-		    GdkRectangle *field_geom,
-		    guint         alpha,
-		    GdkColor     *bg_color) 
+/* One tile of the ocean stripes, already blended over black, so that
+ * the whole screen can be covered by repeating it in a single paint.
+ */
+static cairo_pattern_t *
+create_stripes_pattern (cairo_t *cr,
+			gdouble  alpha)
 {
-	gboolean need_composite;
-	gboolean use_simple;
-	gdouble  cx, cy;
-	gdouble  colorv;
-	gint     pwidth, pheight;
-
-	need_composite = (alpha < 255 || gdk_pixbuf_get_has_alpha (src_pixbuf));
-	use_simple = (dest_pixbuf == NULL);
-
-	if (dest_pixbuf == NULL)
-		dest_pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
-					      FALSE, 8,
-					      field_geom->width, field_geom->height);
-
-	if (need_composite && use_simple)
-		colorv = ((bg_color->red & 0xff00) << 8) |
-			(bg_color->green & 0xff00) |
-			((bg_color->blue & 0xff00) >> 8);
-	else
-		colorv = 0;
-
-	pwidth = gdk_pixbuf_get_width (src_pixbuf);
-	pheight = gdk_pixbuf_get_height (src_pixbuf);
-
-	for (cy = 0; cy < field_geom->height; cy += pheight) {
-		for (cx = 0; cx < field_geom->width; cx += pwidth) {
-			if (need_composite && !use_simple)
-				gdk_pixbuf_composite (src_pixbuf, dest_pixbuf,
-						      cx, cy,
-						      MIN (pwidth, field_geom->width - cx), 
-						      MIN (pheight, field_geom->height - cy),
-						      cx, cy,
-						      1.0, 1.0,
-						      GDK_INTERP_BILINEAR,
-						      alpha);
-			else if (need_composite && use_simple)
-				gdk_pixbuf_composite_color (src_pixbuf, dest_pixbuf,
-							    cx, cy,
-							    MIN (pwidth, field_geom->width - cx), 
-							    MIN (pheight, field_geom->height - cy),
-							    cx, cy,
-							    1.0, 1.0,
-							    GDK_INTERP_BILINEAR,
-							    alpha,
-							    65536, 65536, 65536,
-							    colorv, colorv);
-			else
-				gdk_pixbuf_copy_area (src_pixbuf,
-						      0, 0,
-						      MIN (pwidth, field_geom->width - cx),
-						      MIN (pheight, field_geom->height - cy),
-						      dest_pixbuf,
-						      cx, cy);
-		}
+	GdkPixbuf       *pixbuf;
+	cairo_surface_t *tile;
+	cairo_t         *tile_cr;
+	cairo_pattern_t *pattern;
+
+	pixbuf = gdk_pixbuf_new_from_file (IMAGEDIR "/ocean-stripes.png", NULL);
+	if (pixbuf == NULL) {
+		return NULL;
 	}
 
-	return dest_pixbuf;
+	tile = cairo_surface_create_similar (cairo_get_target (cr),
+					     CAIRO_CONTENT_COLOR,
+					     gdk_pixbuf_get_width (pixbuf),
+					     gdk_pixbuf_get_height (pixbuf));
+
+	tile_cr = cairo_create (tile);
+	cairo_set_source_rgb (tile_cr, 0.0, 0.0, 0.0);
+	cairo_paint (tile_cr);
+	gdk_cairo_set_source_pixbuf (tile_cr, pixbuf, 0, 0);
+	cairo_paint_with_alpha (tile_cr, alpha);
+	cairo_destroy (tile_cr);
+
+	g_object_unref (pixbuf);
+
+	pattern = cairo_pattern_create_for_surface (tile);
+	cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
+	cairo_surface_destroy (tile);
+
+	return pattern;
 }
 
 static gboolean
@@ -155,12 +127,18 @@ window_expose_event (GtkWidget      *widget,
 static void
 set_pixmap_background (GtkWidget *window)
 {
-	GdkScreen    *screen;
-	GdkPixbuf    *tmp_pixbuf, *pixbuf, *tile_pixbuf;
-	GdkRectangle  rect;
-	GdkColor      color;
-	gint          width, height;
-	cairo_t      *cr;
+	GdkScreen       *screen;
+	GdkWindow       *gdk_window;
+	GdkWindow       *root;
+#if GTK_CHECK_VERSION (3, 0, 0)
+	cairo_surface_t *surface;
+#else
+	GdkPixmap       *pixmap;
+	GdkPixbuf       *tmp_pixbuf;
+#endif
+	cairo_pattern_t *pattern;
+	gint             width, height;
+	cairo_t         *cr;
 
 	gtk_widget_realize (window);
 
@@ -168,63 +146,55 @@ set_pixmap_background (GtkWidget *window)
 	width = gdk_screen_get_width (screen);
 	height = gdk_screen_get_height (screen);
 
+	gdk_window = gtk_widget_get_window (window);
+	root = gdk_screen_get_root_window (screen);
+
+	/* Paint what is on the screen right now straight into the window
+	 * background, so the server shows it as soon as the window maps.
+	 */
 #if GTK_CHECK_VERSION (3, 0, 0)
-	tmp_pixbuf = gdk_pixbuf_get_from_window (gdk_screen_get_root_window (screen),
-						 0,
-						 0,
-						 width, height);
+	surface = gdk_window_create_similar_surface (gdk_window,
+						     CAIRO_CONTENT_COLOR,
+						     width, height);
+	cr = cairo_create (surface);
+	gdk_cairo_set_source_window (cr, root, 0, 0);
 #else
+	pixmap = gdk_pixmap_new (gdk_window, width, height, -1);
+	cr = gdk_cairo_create (pixmap);
+
 	tmp_pixbuf = gdk_pixbuf_get_from_drawable (NULL,
-						   gdk_screen_get_root_window (screen),
+						   root,
 						   gdk_screen_get_system_colormap (screen),
 						   0,
 						   0,
 						   0,
 						   0,
 						   width, height);
-#endif
-
-	pixbuf = gdk_pixbuf_new_from_file (IMAGEDIR "/ocean-stripes.png", NULL);
-
-	rect.x = 0;
-	rect.y = 0;
-	rect.width = width;
-	rect.height = height;
-
-	color.red = 0;
-	color.blue = 0;
-	color.green = 0;
-
-	tile_pixbuf = create_tile_pixbuf (NULL,
-					  pixbuf,
-					  &rect,
-					  155,
-					  &color);
-
-	g_object_unref (pixbuf);
-
-	gdk_pixbuf_composite (tile_pixbuf,
-			      tmp_pixbuf,
-			      0,
-			      0,
-			      width,
-			      height,
-			      0,
-			      0,
-			      1,
-			      1,
-			      GDK_INTERP_NEAREST,
-			      225);
-
-	g_object_unref (tile_pixbuf);
-
-	cr = gdk_cairo_create (gtk_widget_get_window (window));
 	gdk_cairo_set_source_pixbuf (cr, tmp_pixbuf, 0, 0);
+	g_object_unref (tmp_pixbuf);
+#endif
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint (cr);
 
-	g_object_unref (tmp_pixbuf);
+	pattern = create_stripes_pattern (cr, 155 / 255.0);
+	if (pattern != NULL) {
+		cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+		cairo_set_source (cr, pattern);
+		cairo_paint_with_alpha (cr, 225 / 255.0);
+		cairo_pattern_destroy (pattern);
+	}
 
 	cairo_destroy (cr);
+
+#if GTK_CHECK_VERSION (3, 0, 0)
+	pattern = cairo_pattern_create_for_surface (surface);
+	gdk_window_set_background_pattern (gdk_window, pattern);
+	cairo_pattern_destroy (pattern);
+	cairo_surface_destroy (surface);
+#else
+	gdk_window_set_back_pixmap (gdk_window, pixmap, FALSE);
+	g_object_unref (pixmap);
+#endif
 }
 
 void
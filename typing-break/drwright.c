@@ -23,6 +23,7 @@
 #include <config.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <glib/gi18n.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkkeysyms.h>
@@ -79,7 +80,6 @@ struct _DrWright {
 	DrwTimer       *timer;
 	DrwTimer       *idle_timer;
 
-	gint            last_elapsed_time;
 	gint            save_last_time;
 
 	/* Time settings. */
@@ -89,7 +89,9 @@ struct _DrWright {
 
 	gboolean        enabled;
 
-	guint           clock_timeout_id;
+	/* maybe_change_state() runs when something is due, not on a tick */
+	guint           state_timeout_id;
+	time_t          state_check_due;
 #ifdef HAVE_APP_INDICATOR
 	AppIndicator   *indicator;
 #else
@@ -104,6 +106,9 @@ struct _DrWright {
 	GdkPixbuf      *green_bar;
 	GdkPixbuf      *disabled_bar;
 	GdkPixbuf      *composite_bar;
+
+	/* Bars filled to each offset, green ones first, then red ones */
+	GdkPixbuf     **bar_frames;
 #endif /* HAVE_APP_INDICATOR */
 
 	GtkWidget      *warn_dialog;
@@ -112,6 +117,7 @@ struct _DrWright {
 static void     activity_detected_cb           (DrwMonitor     *monitor,
 						DrWright       *drwright);
 static gboolean maybe_change_state             (DrWright       *drwright);
+static void     schedule_state_check           (DrWright       *drwright);
 static gint     get_time_left                  (DrWright       *drwright);
 static gboolean update_status                  (DrWright       *drwright);
 static void     break_window_done_cb           (GtkWidget      *window,
@@ -174,26 +180,77 @@ update_app_indicator (DrWright *dr)
 	app_indicator_set_status (dr->indicator, new_status);
 }
 #else
+/* The bar only has as many fill levels as it is high, so each one is
+ * composited the first time it is shown and reused from then on.
+ */
+static GdkPixbuf *
+get_bar_frame (DrWright *dr,
+	       gboolean  red,
+	       gint      offset)
+{
+	GdkPixbuf *frame;
+	gint       width, height;
+	gint       i;
+
+	width = gdk_pixbuf_get_width (dr->neutral_bar);
+	height = gdk_pixbuf_get_height (dr->neutral_bar);
+
+	if (!dr->bar_frames) {
+		dr->bar_frames = g_new0 (GdkPixbuf *, 2 * (height + 1));
+	}
+
+	i = (red ? height + 1 : 0) + offset;
+
+	if (!dr->bar_frames[i]) {
+		frame = gdk_pixbuf_copy (dr->neutral_bar);
+
+		gdk_pixbuf_composite (red ? dr->red_bar : dr->green_bar,
+				      frame,
+				      0,
+				      offset,
+				      width,
+				      height - offset,
+				      0,
+				      0,
+				      1.0,
+				      1.0,
+				      GDK_INTERP_BILINEAR,
+				      255);
+
+		dr->bar_frames[i] = frame;
+	}
+
+	return dr->bar_frames[i];
+}
+
+static void
+set_icon_pixbuf (DrWright  *dr,
+		 GdkPixbuf *pixbuf)
+{
+	/* Setting the same pixbuf again still makes the tray redraw */
+	if (gtk_status_icon_get_storage_type (dr->icon) == GTK_IMAGE_PIXBUF &&
+	    gtk_status_icon_get_pixbuf (dr->icon) == pixbuf) {
+		return;
+	}
+
+	gtk_status_icon_set_from_pixbuf (dr->icon, pixbuf);
+}
+
 static void
 update_icon (DrWright *dr)
 {
-	GdkPixbuf *pixbuf;
-	GdkPixbuf *tmp_pixbuf;
-	gint       width, height;
+	gint       height;
 	gfloat     r;
 	gint       offset;
+	gboolean   red;
 	gboolean   set_pixbuf;
 
 	if (!dr->enabled) {
-		gtk_status_icon_set_from_pixbuf (dr->icon,
-						 dr->disabled_bar);
+		set_icon_pixbuf (dr, dr->disabled_bar);
 		return;
 	}
 
-	tmp_pixbuf = gdk_pixbuf_copy (dr->neutral_bar);
-
-	width = gdk_pixbuf_get_width (tmp_pixbuf);
-	height = gdk_pixbuf_get_height (tmp_pixbuf);
+	height = gdk_pixbuf_get_height (dr->neutral_bar);
 
 	set_pixbuf = TRUE;
 
@@ -219,42 +276,25 @@ update_icon (DrWright *dr)
 
 	switch (dr->state) {
 	case STATE_WARN:
-		pixbuf = dr->red_bar;
+		red = TRUE;
 		set_pixbuf = FALSE;
 		break;
 
 	case STATE_BREAK_SETUP:
 	case STATE_BREAK:
-		pixbuf = dr->red_bar;
+		red = TRUE;
 		break;
 
 	default:
-		pixbuf = dr->green_bar;
-	}
-
-	gdk_pixbuf_composite (pixbuf,
-			      tmp_pixbuf,
-			      0,
-			      offset,
-			      width,
-			      height - offset,
-			      0,
-			      0,
-			      1.0,
-			      1.0,
-			      GDK_INTERP_BILINEAR,
-			      255);
-
-	if (set_pixbuf) {
-		gtk_status_icon_set_from_pixbuf (dr->icon,
-						 tmp_pixbuf);
+		red = FALSE;
 	}
 
-	if (dr->composite_bar) {
-		g_object_unref (dr->composite_bar);
-	}
+	/* The frames are owned by the cache */
+	dr->composite_bar = get_bar_frame (dr, red, offset);
 
-	dr->composite_bar = tmp_pixbuf;
+	if (set_pixbuf) {
+		set_icon_pixbuf (dr, dr->composite_bar);
+	}
 }
 
 static gboolean
@@ -355,8 +395,8 @@ maybe_change_state (DrWright *dr)
 	elapsed_time = drw_timer_elapsed (dr->timer) + dr->save_last_time;
 	elapsed_idle_time = drw_timer_elapsed (dr->idle_timer);
 
-	if (elapsed_time > dr->last_elapsed_time + dr->warn_time) {
-		/* If the timeout is delayed by the amount of warning time, then
+	if (dr->state_check_due != 0 && time (NULL) > dr->state_check_due + dr->warn_time) {
+		/* If the check is delayed by the amount of warning time, then
 		 * we must have been suspended or stopped, so we just start
 		 * over.
 		 */
@@ -472,17 +512,120 @@ maybe_change_state (DrWright *dr)
 		break;
 	}
 
-	dr->last_elapsed_time = elapsed_time;
-
 #ifdef HAVE_APP_INDICATOR
 	update_app_indicator (dr);
 #else
 	update_icon (dr);
 #endif /* HAVE_APP_INDICATOR */
+	update_status (dr);
+
+	schedule_state_check (dr);
 
 	return TRUE;
 }
 
+#ifndef HAVE_APP_INDICATOR
+/* Seconds until the bar in the tray icon grows by a pixel */
+static gint
+get_icon_refresh (DrWright *dr,
+		  gint      elapsed_time)
+{
+	gint height;
+	gint offset;
+
+	if (!dr->neutral_bar) {
+		return G_MAXINT;
+	}
+
+	height = gdk_pixbuf_get_height (dr->neutral_bar);
+	offset = height * (1.0 - (float) elapsed_time / dr->type_time);
+
+	if (offset <= 1) {
+		return G_MAXINT;
+	}
+
+	return floor (dr->type_time * (1.0 - (float) offset / height)) - elapsed_time + 1;
+}
+#endif /* HAVE_APP_INDICATOR */
+
+/* Seconds until maybe_change_state() has something to do: a state to
+ * move on from, or the tray icon or its tooltip to update. Activity
+ * only ever pushes these further away. */
+static gint
+get_next_state_check (DrWright *dr)
+{
+	gint elapsed_time;
+	gint elapsed_idle_time;
+	gint time_left;
+	gint next;
+
+	elapsed_time = drw_timer_elapsed (dr->timer) + dr->save_last_time;
+	elapsed_idle_time = drw_timer_elapsed (dr->idle_timer);
+
+	switch (dr->state) {
+	case STATE_RUNNING:
+	case STATE_WARN:
+		next = MIN (dr->break_time - elapsed_idle_time,
+			    dr->type_time - elapsed_time);
+		if (dr->state != STATE_WARN) {
+			next = MIN (next, dr->type_time - dr->warn_time - elapsed_time);
+		}
+#ifndef HAVE_APP_INDICATOR
+		next = MIN (next, get_icon_refresh (dr, elapsed_time));
+#endif /* HAVE_APP_INDICATOR */
+		break;
+
+	case STATE_BREAK:
+		next = dr->break_time - (elapsed_time - dr->save_last_time);
+		break;
+
+	default:
+		/* The other states move on by themselves */
+		next = 1;
+		break;
+	}
+
+	/* The tooltip rounds the time left to the minute */
+	time_left = dr->type_time - elapsed_time;
+	next = MIN (next, time_left - (60 * (gint) floor (0.5 + time_left / 60.0) - 30) + 1);
+
+	return MAX (next, 1);
+}
+
+static gboolean
+state_check_timeout_cb (DrWright *dr)
+{
+	dr->state_timeout_id = 0;
+
+	maybe_change_state (dr);
+
+	return FALSE;
+}
+
+static void
+schedule_state_check (DrWright *dr)
+{
+	gint next;
+
+	if (dr->state_timeout_id) {
+		g_source_remove (dr->state_timeout_id);
+		dr->state_timeout_id = 0;
+	}
+
+	/* Nothing happens until it's enabled again */
+	if (!dr->enabled && dr->state == STATE_START) {
+		dr->state_check_due = 0;
+		return;
+	}
+
+	next = get_next_state_check (dr);
+
+	dr->state_check_due = time (NULL) + next;
+	dr->state_timeout_id = g_timeout_add_seconds (next,
+						      (GSourceFunc) state_check_timeout_cb,
+						      dr);
+}
+
 static gboolean
 update_status (DrWright *dr)
 {
@@ -871,13 +1014,7 @@ drwright_new (void)
 	init_tray_icon (dr);
 #endif /* HAVE_APP_INDICATOR */
 
-	g_timeout_add_seconds (12,
-			       (GSourceFunc) update_status,
-			       dr);
-
-	g_timeout_add_seconds (1,
-			       (GSourceFunc) maybe_change_state,
-			       dr);
+	maybe_change_state (dr);
 
 	return dr;
 }